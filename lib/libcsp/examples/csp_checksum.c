@@ -0,0 +1,45 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 GomSpace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include <csp/csp_checksum.h>
+
+/* Check values of the dispatched checksums and a self-test of every
+ * kernel the CPU supports against bitwise reference implementations */
+int main(int argc, char * argv[]) {
+
+	const char check[] = "123456789";
+
+	printf("CRC32C      %08"PRIX32" (expect E3069283)\r\n", csp_crc32c(check, 9));
+	printf("CRC32       %08"PRIX32" (expect CBF43926)\r\n", csp_crc32_ieee(check, 9));
+	printf("CRC16       %04"PRIX16" (expect 29B1)\r\n", csp_crc16(check, 9));
+	printf("Fletcher-16 %04"PRIX16" (expect C8F0 for \"abcde\")\r\n", csp_fletcher16("abcde", 5));
+
+	if (csp_checksum_selftest() != 0) {
+		printf("Checksum self-test FAILED\r\n");
+		return 1;
+	}
+
+	printf("Checksum self-test passed\r\n");
+	return 0;
+
+}
@@ -40,6 +40,26 @@ int csp_queue_enqueue_isr(csp_queue_handle_t handle, void * value, CSP_BASE_TYPE
 int csp_queue_dequeue(csp_queue_handle_t handle, void *buf, uint32_t timeout);
 int csp_queue_dequeue_isr(csp_queue_handle_t handle, void * buf, CSP_BASE_TYPE * task_woken);
 int csp_queue_size(csp_queue_handle_t handle);
+
+#if defined(CSP_POSIX) || defined(CSP_WINDOWS) || defined(CSP_MACOSX)
+/* Batch operations, FreeRTOS queues do not expose their item size */
+
+/**
+ * Enqueue several items. Only the first waits for room, up to timeout ms,
+ * the rest are enqueued as long as there is room.
+ * @param values array of count items
+ * @return number of items enqueued
+ */
+int csp_queue_enqueue_n(csp_queue_handle_t handle, void * values, int count, uint32_t timeout);
+
+/**
+ * Dequeue several items. Only the first waits for data, up to timeout ms,
+ * the rest are taken as long as the queue has more.
+ * @param buf room for count items
+ * @return number of items dequeued
+ */
+int csp_queue_dequeue_n(csp_queue_handle_t handle, void * buf, int count, uint32_t timeout);
+#endif
 int csp_queue_size_isr(csp_queue_handle_t handle);
 
 #ifdef __cplusplus
@@ -41,6 +41,10 @@ extern "C" {
 #define PTHREAD_QUEUE_FULL CSP_QUEUE_ERROR
 #define PTHREAD_QUEUE_OK CSP_QUEUE_OK
 
+#if defined(__linux__)
+/* Lock free ring with futex waits, see pthread_queue.c */
+typedef struct pthread_queue_s pthread_queue_t;
+#else
 typedef struct pthread_queue_s {
 	void * buffer;
 	int size;
@@ -52,12 +56,15 @@ typedef struct pthread_queue_s {
 	pthread_cond_t cond_full;
 	pthread_cond_t cond_empty;
 } pthread_queue_t;
+#endif
 
 pthread_queue_t * pthread_queue_create(int length, size_t item_size);
 void pthread_queue_delete(pthread_queue_t * q);
 int pthread_queue_enqueue(pthread_queue_t * queue, void * value, uint32_t timeout);
 int pthread_queue_dequeue(pthread_queue_t * queue, void * buf, uint32_t timeout);
 int pthread_queue_items(pthread_queue_t * queue);
+int pthread_queue_enqueue_n(pthread_queue_t * queue, void * values, int count, uint32_t timeout);
+int pthread_queue_dequeue_n(pthread_queue_t * queue, void * buf, int count, uint32_t timeout);
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -282,10 +282,23 @@ int csp_bind(csp_socket_t *socket, uint8_t port);
  */
 int csp_route_start_task(unsigned int task_stack_size, unsigned int priority);
 
+/**
+ * Start several router tasks. Packets are spread over them by connection
+ * (addresses and ports), so each connection and its RDP state is handled
+ * by one task in order, while crypto and forwarding of different
+ * connections run in parallel. Use instead of csp_route_start_task().
+ * @param workers Number of router tasks, at most 8
+ * @param task_stack_size The number of portStackType to allocate. This only affects FreeRTOS systems.
+ * @param priority The OS task priority of the routers
+ * @return CSP_ERR type
+ */
+int csp_route_start_workers(unsigned int workers, unsigned int task_stack_size, unsigned int priority);
+
 /**
  * Call the router worker function manually (without the router task)
  * This must be run inside a loop or called periodically for the csp router to work.
  * Use this function instead of calling and starting the router task.
+ * Handles the packets of the first router worker only.
  * @param timeout max blocking time
  * @return -1 if no packet was processed, 0 otherwise
  */
@@ -427,6 +440,13 @@ void csp_memfree(uint8_t node, uint32_t timeout);
  */
 void csp_buf_free(uint8_t node, uint32_t timeout);
 
+/**
+ * Request buffer usage per size class
+ * @param node node id
+ * @param timeout timeout in ms
+ */
+void csp_buf_stats(uint8_t node, uint32_t timeout);
+
 /**
  * Reboot subsystem
  * @param node node id
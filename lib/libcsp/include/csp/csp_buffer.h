@@ -21,10 +21,33 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #ifndef _CSP_BUFFER_H_
 #define _CSP_BUFFER_H_
 
+#include <stdint.h>
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/** Maximum number of buffer size classes */
+#define CSP_BUFFER_CLASSES_MAX 4
+
+/** Configuration of one buffer size class */
+typedef struct {
+	unsigned int size;	/**< Buffer size in bytes */
+	unsigned int count;	/**< Buffers allocated at init, may be 0 */
+	unsigned int max;	/**< Limit when the class grows under load, <= count for a fixed pool */
+} csp_buffer_class_t;
+
+/** Statistics of one buffer size class */
+typedef struct {
+	uint32_t size;		/**< Buffer size in bytes */
+	uint32_t count;		/**< Buffers currently allocated */
+	uint32_t max;		/**< Limit when growing */
+	uint32_t in_use;	/**< Buffers currently handed out */
+	uint32_t high_water;	/**< Most buffers handed out at once */
+	uint32_t failures;	/**< Requests that found no free buffer */
+} csp_buffer_stats_t;
+
 /**
  * Start the buffer handling system
  * You must specify the number for buffers and the size. All buffers are fixed
@@ -37,11 +60,25 @@ extern "C" {
  */
 int csp_buffer_init(int count, int size);
 
+/**
+ * Start the buffer handling system with several size classes.
+ * A request is served from the smallest class that leaves room for the
+ * protocol trailers, or from a larger class when that one is exhausted.
+ * Classes with max > count grow in up to 63 steps of count/4 buffers when they run
+ * dry, and csp_buffer_shrink() releases the growth again when it is idle.
+ *
+ * @param classes Array of size classes, in any order
+ * @param count Number of classes, at most CSP_BUFFER_CLASSES_MAX
+ *
+ * @return CSP_ERR_NONE if malloc() succeeded, CSP_ERR message otherwise.
+ */
+int csp_buffer_init_classes(const csp_buffer_class_t * classes, int count);
+
 /**
  * Get a reference to a free buffer. This function can only be called
  * from task context.
  *
- * @param size Specify what data-size you will put in the buffer
+ * @param size Specify what data-size you will put in the buffer, SIZE_MAX for the largest class
  * @return pointer to a free csp_packet_t or NULL if out of memory
  */
 void * csp_buffer_get(size_t size);
@@ -74,17 +111,37 @@ void csp_buffer_free_isr(void *packet);
 void * csp_buffer_clone(void *buffer);
 
 /**
- * Return how many buffers that are currently free.
+ * Return how many buffers that can still be handed out, counting the
+ * room each class has left to grow.
  * @return number of free buffers
  */
 int csp_buffer_remaining(void);
 
 /**
- * Return the size of the CSP buffers
+ * Return the size of the largest CSP buffers
  * @return size of CSP buffers
  */
 int csp_buffer_size(void);
 
+/**
+ * Return the number of buffer size classes
+ */
+int csp_buffer_classes(void);
+
+/**
+ * Get the usage statistics of a buffer size class
+ * @param index Class index, 0 is the smallest
+ * @param stats Output
+ * @return CSP_ERR_NONE on success, CSP_ERR_INVAL if there is no such class
+ */
+int csp_buffer_stats(int index, csp_buffer_stats_t * stats);
+
+/**
+ * Release buffers a class grew beyond its initial count when they are no
+ * longer needed. Rate limited internally, call it periodically.
+ */
+void csp_buffer_shrink(void);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
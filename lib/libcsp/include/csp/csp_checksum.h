@@ -0,0 +1,115 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 GomSpace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _CSP_CHECKSUM_H_
+#define _CSP_CHECKSUM_H_
+
+/**
+ * Checksum kernels shared by CSP, the KISS interface, libparam and libutil.
+ *
+ * The implementation is chosen on first use from the CPU features: the
+ * SSE4.2 crc32 instruction for CRC32C and carry-less multiply folding
+ * for CRC32 on x86-64, slicing-by-8 tables otherwise.
+ *
+ * The _update functions work on the raw shift register, start with the
+ * initial value and apply the final xor on the result, or use the one
+ * shot functions below.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Update CRC32C (Castagnoli) register
+ * @param crc register, 0xFFFFFFFF to start
+ * @param data pointer to memory
+ * @param length number of bytes
+ * @return updated register
+ */
+uint32_t csp_crc32c_update(uint32_t crc, const void * data, size_t length);
+
+/**
+ * CRC32C (Castagnoli) of a memory area, as used by the CSP CRC32 option
+ * @param data pointer to memory
+ * @param length number of bytes
+ * @return checksum
+ */
+uint32_t csp_crc32c(const void * data, size_t length);
+
+/**
+ * Update CRC32 (IEEE 802.3, zlib) register
+ * @param crc register, 0xFFFFFFFF to start
+ * @param data pointer to memory
+ * @param length number of bytes
+ * @return updated register
+ */
+uint32_t csp_crc32_ieee_update(uint32_t crc, const void * data, size_t length);
+
+/**
+ * CRC32 (IEEE 802.3, zlib) of a memory area
+ * @param data pointer to memory
+ * @param length number of bytes
+ * @return checksum
+ */
+uint32_t csp_crc32_ieee(const void * data, size_t length);
+
+/**
+ * Update CRC16 (CCITT, polynomial 0x1021, MSB first) register
+ * @param crc register, 0xFFFF to start
+ * @param data pointer to memory
+ * @param length number of bytes
+ * @return updated register
+ */
+uint16_t csp_crc16_update(uint16_t crc, const void * data, size_t length);
+
+/**
+ * CRC16 (CCITT-FALSE: initial value 0xFFFF, no final xor) of a memory area
+ * @param data pointer to memory
+ * @param length number of bytes
+ * @return checksum
+ */
+uint16_t csp_crc16(const void * data, size_t length);
+
+/**
+ * Fletcher-16 (modulo 255) of a memory area
+ * @param data pointer to memory
+ * @param length number of bytes
+ * @return (sum2 << 8) | sum1
+ */
+uint16_t csp_fletcher16(const void * data, size_t length);
+
+/**
+ * Compare every checksum kernel this CPU can run (slicing-by-8, SSE4.2,
+ * PCLMUL) with bitwise reference implementations and the standard check
+ * values, over all lengths and alignments of a short buffer and one long
+ * run.
+ * @return 0 if all kernels agree, -1 otherwise
+ */
+int csp_checksum_selftest(void);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _CSP_CHECKSUM_H_ */
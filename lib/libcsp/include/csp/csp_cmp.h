@@ -44,6 +44,7 @@ extern "C" {
 #define CSP_CMP_POKE 5
 #define CSP_CMP_POKE_MAX_LEN 200
 #define CSP_CMP_CLOCK 6
+#define CSP_CMP_BUF_STATS 7
 
 struct csp_cmp_message {
 	uint8_t type;
@@ -73,6 +74,7 @@ struct csp_cmp_message {
 			uint32_t txbytes;
 			uint32_t rxbytes;
 			uint32_t irq;
+			uint32_t dup;
 		} if_stats;
 		struct {
 			uint32_t addr;
@@ -85,6 +87,16 @@ struct csp_cmp_message {
 			char data[CSP_CMP_POKE_MAX_LEN];
 		} poke;
 		csp_timestamp_t clock;
+		struct __attribute__((__packed__)) {
+			uint8_t index;
+			uint8_t classes;
+			uint32_t size;
+			uint32_t count;
+			uint32_t max;
+			uint32_t in_use;
+			uint32_t high_water;
+			uint32_t failures;
+		} buf_stats;
 	};
 } __attribute__ ((packed));
 
@@ -103,6 +115,7 @@ CMP_MESSAGE(CSP_CMP_IF_STATS, if_stats)
 CMP_MESSAGE(CSP_CMP_PEEK, peek)
 CMP_MESSAGE(CSP_CMP_POKE, poke)
 CMP_MESSAGE(CSP_CMP_CLOCK, clock)
+CMP_MESSAGE(CSP_CMP_BUF_STATS, buf_stats)
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -0,0 +1,79 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 GomSpace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _CSP_DIVERSITY_H_
+#define _CSP_DIVERSITY_H_
+
+/**
+ * Diversity reception.
+ *
+ * Several interfaces can receive the same satellite, e.g. a local radio
+ * and a remote station on the ZMQ hub. Once two or more interfaces are
+ * registered here, the deduplicator passes on the first copy of each
+ * packet they receive and drops the others. It also counts which one
+ * delivered first and which missed packets that another one received.
+ * Packets on other interfaces are never deduplicated.
+ *
+ * Requires CSP_USE_DEDUP.
+ */
+
+#include <stdint.h>
+#include <csp/csp_types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of interfaces that can be registered */
+#define CSP_DIVERSITY_SOURCES	8
+
+typedef struct {
+	csp_iface_t * interface;
+	uint32_t first;		/**< Packets this interface delivered first */
+	uint32_t late;		/**< Copies that arrived after another interface's */
+	uint32_t late_ms;	/**< Total delay of the late copies in ms */
+	uint32_t missed;	/**< Packets only other interfaces received, counted when they leave the dedup window */
+} csp_diversity_stats_t;
+
+/**
+ * Register an interface as diversity receiver
+ * @param interface interface receiving the same downlink as the others
+ * @return CSP_ERR_NONE on success, CSP_ERR_NOMEM if all slots are used
+ */
+int csp_diversity_add(csp_iface_t * interface);
+
+/**
+ * Read the statistics of the registered interfaces
+ * @param stats array to fill
+ * @param max number of elements in stats
+ * @return number of elements filled
+ */
+int csp_diversity_stats(csp_diversity_stats_t * stats, int max);
+
+/**
+ * Print the statistics of the registered interfaces
+ */
+void csp_diversity_print(void);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _CSP_DIVERSITY_H_ */
@@ -197,6 +197,7 @@ typedef struct csp_iface_s {
 	uint32_t txbytes;			/**< Transmitted bytes */
 	uint32_t rxbytes;			/**< Received bytes */
 	uint32_t irq;				/**< Interrupts */
+	uint32_t dup;				/**< Duplicate packets discarded */
 	struct csp_iface_s *next;	/**< Next interface */
 } csp_iface_t;
 
@@ -21,8 +21,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 /**
  * @file usart.h
  * Common USART interface,
- * This file is derived from the Gomspace USART driver,
- * the main difference is the assumption that only one USART will be present on a PC
+ * This file is derived from the Gomspace USART driver.
+ * The usart_init/usart_putc family drives a single default port. Drivers
+ * that support several ports also provide the handle based usart_open API.
  */
 
 #ifndef USART_H_
@@ -91,6 +92,41 @@ char usart_getc(void);
 
 int usart_messages_waiting(int handle);
 
+/**
+ * Handle for one open serial port, returned by usart_open
+ */
+typedef struct usart_handle_s usart_handle_t;
+
+/**
+ * Receive callback for a handle
+ * @param arg user argument given to usart_open
+ * @param buf pointer to received data
+ * @param len length of received data
+ * @param pxTaskWoken NULL if task context, pointer to variable if ISR
+ */
+typedef void (*usart_rx_callback_t) (void *arg, uint8_t *buf, int len, void *pxTaskWoken);
+
+/**
+ * Open and configure a serial port.
+ * Received data from all open ports is read by one shared RX thread,
+ * which calls the callback of the port with the data. If a port fails
+ * (e.g. the device is unplugged) the RX thread stops servicing it, while
+ * the other ports keep running.
+ * @param conf port configuration
+ * @param callback receive callback, may be NULL
+ * @param arg user argument passed to callback
+ * @return handle, or NULL if the port could not be opened
+ */
+usart_handle_t * usart_open(struct usart_conf *conf, usart_rx_callback_t callback, void *arg);
+
+/**
+ * Send char buffer on a port
+ * @param handle handle returned by usart_open
+ * @param buf Pointer to data
+ * @param len Length of data
+ */
+void usart_handle_putstr(usart_handle_t *handle, char *buf, int len);
+
 static inline int usart_stdio_msgwaiting(void) {
 	return usart_messages_waiting(0);
 }
@@ -29,12 +29,14 @@ extern "C" {
 
 #include <csp/csp.h>
 #include <csp/csp_interface.h>
+#include <csp/arch/csp_semaphore.h>
 
 /**
  * The KISS interface relies on the USART callback in order to parse incoming
- * messaged from the serial interface. The USART callback however does not
- * support passing the handle number of the responding USART, so you need to implement
- * a USART callback for each handle and then call kiss_rx subsequently.
+ * messaged from the serial interface. With the single port usart_init API
+ * the callback does not identify the USART, so you need to implement a USART
+ * callback for each handle and then call kiss_rx subsequently. Ports opened
+ * with usart_open pass a user argument, which can be the csp interface.
  *
  * In order to initialize the KISS interface. Fist call kiss_init() and then
  * setup your usart to call csp_kiss_rx when new data is available.
@@ -58,6 +60,18 @@ void csp_kiss_rx(csp_iface_t * interface, uint8_t *buf, int len, void *pxTaskWok
  */
 typedef void (*csp_kiss_putc_f)(char buf);
 
+/**
+ * The putstr function is an optional bulk variant of putc. When set, the
+ * kiss interface escapes the complete frame into a buffer and hands it to
+ * the driver in a single call, instead of calling putc for every byte.
+ * The driver_data pointer given to csp_kiss_set_putstr is passed back, so
+ * one function can serve several serial ports.
+ * @param driver_data driver context, e.g. a usart handle
+ * @param buf pointer to escaped frame
+ * @param len length of escaped frame
+ */
+typedef void (*csp_kiss_putstr_f)(void * driver_data, char * buf, int len);
+
 /**
  * The characters not accepted by the kiss interface, are discarded
  * using this function, which must be implemented by the user
@@ -79,6 +93,17 @@ typedef enum {
 	KISS_MODE_SKIP_FRAME,
 } kiss_mode_e;
 
+/** MTU of the KISS interface */
+#define KISS_MTU				256
+
+/**
+ * Size of the transmit buffer used with putstr. This fits the worst case
+ * frame of KISS_MTU, CSP header and CRC32 where every byte must be escaped,
+ * plus FEND, TNC_DATA and the trailing FEND. Larger frames are written in
+ * several putstr calls.
+ */
+#define CSP_KISS_TX_BUF_SIZE	(2 * (KISS_MTU + CSP_HEADER_LENGTH + sizeof(uint32_t)) + 3)
+
 /**
  * This structure should be statically allocated by the user
  * and passed to the kiss interface during the init function
@@ -87,15 +112,30 @@ typedef enum {
 typedef struct csp_kiss_handle_s {
 	csp_kiss_putc_f kiss_putc;
 	csp_kiss_discard_f kiss_discard;
+	csp_kiss_putstr_f kiss_putstr;
+	void * driver_data;
+	csp_bin_sem_handle_t tx_lock;
 	unsigned int rx_length;
 	kiss_mode_e rx_mode;
 	unsigned int rx_first;
 	volatile unsigned char *rx_cbuf;
 	csp_packet_t * rx_packet;
+	unsigned char tx_buf[CSP_KISS_TX_BUF_SIZE];
 } csp_kiss_handle_t;
 
 void csp_kiss_init(csp_iface_t * csp_iface, csp_kiss_handle_t * csp_kiss_handle, csp_kiss_putc_f kiss_putc_f, csp_kiss_discard_f kiss_discard_f, const char * name);
 
+/**
+ * Install a bulk transmit function on an initialised kiss handle.
+ * Frames are then sent with one call to putstr, and kiss_putc may be NULL.
+ * Each kiss handle has its own transmit lock, so interfaces on different
+ * serial ports do not block each other.
+ * @param csp_kiss_handle kiss handle passed to csp_kiss_init
+ * @param kiss_putstr_f bulk transmit function, or NULL to use putc only
+ * @param driver_data context passed to kiss_putstr_f
+ */
+void csp_kiss_set_putstr(csp_kiss_handle_t * csp_kiss_handle, csp_kiss_putstr_f kiss_putstr_f, void * driver_data);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -55,6 +55,14 @@ int csp_queue_dequeue_isr(csp_queue_handle_t handle, void *buf, CSP_BASE_TYPE *
 	return csp_queue_dequeue(handle, buf, 0);
 }
 
+int csp_queue_enqueue_n(csp_queue_handle_t handle, void * values, int count, uint32_t timeout) {
+	return pthread_queue_enqueue_n(handle, values, count, timeout);
+}
+
+int csp_queue_dequeue_n(csp_queue_handle_t handle, void * buf, int count, uint32_t timeout) {
+	return pthread_queue_dequeue_n(handle, buf, count, timeout);
+}
+
 int csp_queue_size(csp_queue_handle_t handle) {
 	return pthread_queue_items(handle);
 }
@@ -177,3 +177,27 @@ int pthread_queue_items(pthread_queue_t * queue) {
 	return items;
 	
 }
+
+int pthread_queue_enqueue_n(pthread_queue_t * queue, void * values, int count, uint32_t timeout) {
+
+	int i;
+
+	for (i = 0; i < count; i++)
+		if (pthread_queue_enqueue(queue, (char *) values + i * queue->item_size, i == 0 ? timeout : 0) != PTHREAD_QUEUE_OK)
+			break;
+
+	return i;
+
+}
+
+int pthread_queue_dequeue_n(pthread_queue_t * queue, void * buf, int count, uint32_t timeout) {
+
+	int i;
+
+	for (i = 0; i < count; i++)
+		if (pthread_queue_dequeue(queue, (char *) buf + i * queue->item_size, i == 0 ? timeout : 0) != PTHREAD_QUEUE_OK)
+			break;
+
+	return i;
+
+}
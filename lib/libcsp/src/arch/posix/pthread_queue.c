@@ -21,6 +21,15 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 /*
 Inspired by c-pthread-queue by Matthew Dickinson
 http://code.google.com/p/c-pthread-queue/
+
+Bounded multi producer, multi consumer ring (D. Vyukov). Every slot has a
+sequence number telling which lap of the ring may use it next, so producers
+and consumers only contend on a compare and swap of their own position.
+Threads sleep on a futex only when the queue is empty or full, and wakeups
+are skipped when nobody sleeps.
+
+Other POSIX systems have no futex, they keep the mutex and condition
+variable queue.
 */
 
 #include <pthread.h>
@@ -29,15 +38,272 @@ http://code.google.com/p/c-pthread-queue/
 #include <string.h>
 #include <time.h>
 #include <stdint.h>
-#include <sys/time.h>
+#if defined(__linux__)
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 
 /* CSP includes */
+#include <csp/csp.h>
 #include <csp/arch/posix/pthread_queue.h>
 
+#if defined(__linux__)
+
+typedef struct {
+	uint64_t seq;
+	char data[];
+} pthread_queue_slot_t;
+
+struct pthread_queue_s {
+	char * buffer;
+	uint64_t size;
+	size_t slot_size;
+	size_t item_size;
+	/* Positions on separate cache lines, they are written by different threads */
+	uint64_t in __attribute__((aligned(64)));
+	uint64_t out __attribute__((aligned(64)));
+	/* Futex words, bumped on every enqueue and dequeue */
+	uint32_t enqueued __attribute__((aligned(64)));
+	uint32_t dequeued;
+	/* Set by threads about to sleep, cleared by the one waking them */
+	uint32_t sleep_empty;
+	uint32_t sleep_full;
+};
+
+static inline pthread_queue_slot_t * pthread_queue_slot(pthread_queue_t * q, uint64_t pos) {
+	return (pthread_queue_slot_t *) (q->buffer + (pos % q->size) * q->slot_size);
+}
+
+static int pthread_queue_futex_wait(uint32_t * word, uint32_t val, const struct timespec * deadline) {
+	/* FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC deadline */
+	return syscall(SYS_futex, word, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG, val, deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+static void pthread_queue_futex_wake(uint32_t * word, int count) {
+	syscall(SYS_futex, word, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, count, NULL, NULL, 0);
+}
+
+static void pthread_queue_deadline(struct timespec * ts, uint32_t timeout) {
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	ts->tv_sec += timeout / 1000;
+	ts->tv_nsec += (timeout % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+static int pthread_queue_try_enqueue(pthread_queue_t * q, const void * value) {
+
+	uint64_t pos = __atomic_load_n(&q->in, __ATOMIC_RELAXED);
+	pthread_queue_slot_t * slot;
+
+	for (;;) {
+		slot = pthread_queue_slot(q, pos);
+		int64_t diff = (int64_t) (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&q->in, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			/* Slot from the previous lap not consumed yet */
+			return 0;
+		} else {
+			pos = __atomic_load_n(&q->in, __ATOMIC_RELAXED);
+		}
+	}
+
+	memcpy(slot->data, value, q->item_size);
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	return 1;
+
+}
+
+static int pthread_queue_try_dequeue(pthread_queue_t * q, void * buf) {
+
+	uint64_t pos = __atomic_load_n(&q->out, __ATOMIC_RELAXED);
+	pthread_queue_slot_t * slot;
+
+	for (;;) {
+		slot = pthread_queue_slot(q, pos);
+		int64_t diff = (int64_t) (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&q->out, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			/* Nothing published in this slot yet */
+			return 0;
+		} else {
+			pos = __atomic_load_n(&q->out, __ATOMIC_RELAXED);
+		}
+	}
+
+	memcpy(buf, slot->data, q->item_size);
+	__atomic_store_n(&slot->seq, pos + q->size, __ATOMIC_RELEASE);
+	return 1;
+
+}
+
+/* Bump a futex word and wake the sleepers, if any. Only the first call
+ * after they went to sleep pays for the system call */
+static void pthread_queue_signal(uint32_t * word, uint32_t * sleep) {
+	__atomic_add_fetch(word, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(sleep, __ATOMIC_SEQ_CST) && __atomic_exchange_n(sleep, 0, __ATOMIC_SEQ_CST))
+		pthread_queue_futex_wake(word, INT_MAX);
+}
+
+/* Sleep until word changes or the deadline passes. Returns 0 on timeout */
+static int pthread_queue_wait(uint32_t * word, uint32_t val,
+		uint32_t timeout, struct timespec * deadline, int * have_deadline) {
+
+	/* The clock is only read once a wait is actually needed */
+	if (timeout != CSP_MAX_DELAY && !*have_deadline) {
+		pthread_queue_deadline(deadline, timeout);
+		*have_deadline = 1;
+	}
+
+	int ret = pthread_queue_futex_wait(word, val, (timeout == CSP_MAX_DELAY) ? NULL : deadline);
+
+	return !(ret != 0 && errno == ETIMEDOUT);
+
+}
+
+pthread_queue_t * pthread_queue_create(int length, size_t item_size) {
+
+	if (length <= 0)
+		return NULL;
+
+	pthread_queue_t * q = calloc(1, sizeof(pthread_queue_t));
+	if (q == NULL)
+		return NULL;
+
+	q->size = length;
+	q->item_size = item_size;
+	q->slot_size = (sizeof(pthread_queue_slot_t) + item_size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+	q->buffer = malloc(length * q->slot_size);
+	if (q->buffer == NULL) {
+		free(q);
+		return NULL;
+	}
+
+	for (int i = 0; i < length; i++)
+		pthread_queue_slot(q, i)->seq = i;
+
+	return q;
+
+}
+
+void pthread_queue_delete(pthread_queue_t * q) {
+
+	if (q == NULL)
+		return;
+
+	free(q->buffer);
+	free(q);
+
+	return;
+
+}
+
+int pthread_queue_enqueue_n(pthread_queue_t * queue, void * values, int count, uint32_t timeout) {
+
+	struct timespec deadline;
+	int have_deadline = 0;
+	int done = 0;
+
+	while (done < count) {
+		if (pthread_queue_try_enqueue(queue, (char *) values + done * queue->item_size)) {
+			done++;
+			continue;
+		}
+
+		/* Only the first item may wait for room */
+		if (done > 0 || timeout == 0)
+			break;
+
+		/* Announce the sleep before the last check, so a concurrent
+		 * dequeue either sees the flag or we see its change */
+		__atomic_store_n(&queue->sleep_full, 1, __ATOMIC_SEQ_CST);
+		uint32_t val = __atomic_load_n(&queue->dequeued, __ATOMIC_SEQ_CST);
+		if (pthread_queue_try_enqueue(queue, values)) {
+			done++;
+			continue;
+		}
+		if (!pthread_queue_wait(&queue->dequeued, val, timeout, &deadline, &have_deadline))
+			break;
+	}
+
+	if (done > 0)
+		pthread_queue_signal(&queue->enqueued, &queue->sleep_empty);
+
+	return done;
+
+}
+
+int pthread_queue_dequeue_n(pthread_queue_t * queue, void * buf, int count, uint32_t timeout) {
+
+	struct timespec deadline;
+	int have_deadline = 0;
+	int done = 0;
+
+	while (done < count) {
+		if (pthread_queue_try_dequeue(queue, (char *) buf + done * queue->item_size)) {
+			done++;
+			continue;
+		}
+
+		/* Only the first item may wait for data */
+		if (done > 0 || timeout == 0)
+			break;
+
+		/* Announce the sleep before the last check, so a concurrent
+		 * enqueue either sees the flag or we see its change */
+		__atomic_store_n(&queue->sleep_empty, 1, __ATOMIC_SEQ_CST);
+		uint32_t val = __atomic_load_n(&queue->enqueued, __ATOMIC_SEQ_CST);
+		if (pthread_queue_try_dequeue(queue, buf)) {
+			done++;
+			continue;
+		}
+		if (!pthread_queue_wait(&queue->enqueued, val, timeout, &deadline, &have_deadline))
+			break;
+	}
+
+	if (done > 0)
+		pthread_queue_signal(&queue->dequeued, &queue->sleep_full);
+
+	return done;
+
+}
+
+int pthread_queue_enqueue(pthread_queue_t * queue, void * value, uint32_t timeout) {
+	return pthread_queue_enqueue_n(queue, value, 1, timeout) ? PTHREAD_QUEUE_OK : PTHREAD_QUEUE_FULL;
+}
+
+int pthread_queue_dequeue(pthread_queue_t * queue, void * buf, uint32_t timeout) {
+	return pthread_queue_dequeue_n(queue, buf, 1, timeout) ? PTHREAD_QUEUE_OK : PTHREAD_QUEUE_EMPTY;
+}
+
+int pthread_queue_items(pthread_queue_t * queue) {
+
+	uint64_t out = __atomic_load_n(&queue->out, __ATOMIC_RELAXED);
+	uint64_t in = __atomic_load_n(&queue->in, __ATOMIC_RELAXED);
+
+	/* Both positions move concurrently, clamp the snapshot */
+	if (in <= out)
+		return 0;
+	if (in - out > queue->size)
+		return queue->size;
+	return in - out;
+
+}
+
+#else
+
 pthread_queue_t * pthread_queue_create(int length, size_t item_size) {
-	
+
 	pthread_queue_t * q = malloc(sizeof(pthread_queue_t));
-	
+
 	if (q != NULL) {
 		q->buffer = malloc(length*item_size);
 		if (q->buffer != NULL) {
@@ -58,7 +324,7 @@ pthread_queue_t * pthread_queue_create(int length, size_t item_size) {
 	}
 
 	return q;
-	
+
 }
 
 void pthread_queue_delete(pthread_queue_t * q) {
@@ -72,90 +338,77 @@ void pthread_queue_delete(pthread_queue_t * q) {
 	return;
 
 }
-	
 
-int pthread_queue_enqueue(pthread_queue_t * queue, void * value, uint32_t timeout) {
-	
-	int ret;
+static int pthread_queue_deadline(struct timespec * ts, uint32_t timeout) {
 
-	/* Calculate timeout */
-	struct timespec ts;
-	if (clock_gettime(CLOCK_REALTIME, &ts))
-		return PTHREAD_QUEUE_ERROR;
-	
-	uint32_t sec = timeout / 1000;
-	uint32_t nsec = (timeout - 1000 * sec) * 1000000;
+	if (clock_gettime(CLOCK_REALTIME, ts))
+		return -1;
 
-	ts.tv_sec += sec;
+	ts->tv_sec += timeout / 1000;
+	ts->tv_nsec += (timeout % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
 
-	if (ts.tv_nsec + nsec > 1000000000)
-		ts.tv_sec++;
+	return 0;
 
-	ts.tv_nsec = (ts.tv_nsec + nsec) % 1000000000;
+}
+
+int pthread_queue_enqueue(pthread_queue_t * queue, void * value, uint32_t timeout) {
+
+	struct timespec ts;
+	if (pthread_queue_deadline(&ts, timeout))
+		return PTHREAD_QUEUE_ERROR;
 
 	/* Get queue lock */
 	pthread_mutex_lock(&(queue->mutex));
 	while (queue->items == queue->size) {
-		ret = pthread_cond_timedwait(&(queue->cond_full), &(queue->mutex), &ts);
-		if (ret != 0) {
+		if (pthread_cond_timedwait(&(queue->cond_full), &(queue->mutex), &ts) != 0) {
 			pthread_mutex_unlock(&(queue->mutex));
 			return PTHREAD_QUEUE_FULL;
 		}
 	}
 
-	/* Coby object from input buffer */
-	memcpy(queue->buffer+(queue->in * queue->item_size), value, queue->item_size);
+	/* Copy object from input buffer */
+	memcpy((char *) queue->buffer + (queue->in * queue->item_size), value, queue->item_size);
 	queue->items++;
 	queue->in = (queue->in + 1) % queue->size;
 	pthread_mutex_unlock(&(queue->mutex));
-	
-	/* Nofify blocked threads */
+
+	/* Notify blocked threads */
 	pthread_cond_broadcast(&(queue->cond_empty));
-	
+
 	return PTHREAD_QUEUE_OK;
-	
+
 }
 
 int pthread_queue_dequeue(pthread_queue_t * queue, void * buf, uint32_t timeout) {
 
-	int ret;
-	
-	/* Calculate timeout */
 	struct timespec ts;
-	if (clock_gettime(CLOCK_REALTIME, &ts))
+	if (pthread_queue_deadline(&ts, timeout))
 		return PTHREAD_QUEUE_ERROR;
-	
-	uint32_t sec = timeout / 1000;
-	uint32_t nsec = (timeout - 1000 * sec) * 1000000;
-
-	ts.tv_sec += sec;
-	
-	if (ts.tv_nsec + nsec > 1000000000)
-		ts.tv_sec++;
 
-	ts.tv_nsec = (ts.tv_nsec + nsec) % 1000000000;
-	
 	/* Get queue lock */
 	pthread_mutex_lock(&(queue->mutex));
 	while (queue->items == 0) {
-		ret = pthread_cond_timedwait(&(queue->cond_empty), &(queue->mutex), &ts);
-		if (ret != 0) {
+		if (pthread_cond_timedwait(&(queue->cond_empty), &(queue->mutex), &ts) != 0) {
 			pthread_mutex_unlock(&(queue->mutex));
 			return PTHREAD_QUEUE_EMPTY;
 		}
 	}
 
-	/* Coby object to output buffer */
-	memcpy(buf, queue->buffer+(queue->out * queue->item_size), queue->item_size);
+	/* Copy object to output buffer */
+	memcpy(buf, (char *) queue->buffer + (queue->out * queue->item_size), queue->item_size);
 	queue->items--;
 	queue->out = (queue->out + 1) % queue->size;
 	pthread_mutex_unlock(&(queue->mutex));
-	
-	/* Nofify blocked threads */
+
+	/* Notify blocked threads */
 	pthread_cond_broadcast(&(queue->cond_full));
 
 	return PTHREAD_QUEUE_OK;
-	
+
 }
 
 int pthread_queue_items(pthread_queue_t * queue) {
@@ -163,7 +416,35 @@ int pthread_queue_items(pthread_queue_t * queue) {
 	pthread_mutex_lock(&(queue->mutex));
 	int items = queue->items;
 	pthread_mutex_unlock(&(queue->mutex));
-	
+
 	return items;
-	
+
 }
+
+int pthread_queue_enqueue_n(pthread_queue_t * queue, void * values, int count, uint32_t timeout) {
+
+	int i;
+
+	/* Only the first item may wait for room */
+	for (i = 0; i < count; i++)
+		if (pthread_queue_enqueue(queue, (char *) values + i * queue->item_size, i == 0 ? timeout : 0) != PTHREAD_QUEUE_OK)
+			break;
+
+	return i;
+
+}
+
+int pthread_queue_dequeue_n(pthread_queue_t * queue, void * buf, int count, uint32_t timeout) {
+
+	int i;
+
+	/* Only the first item may wait for data */
+	for (i = 0; i < count; i++)
+		if (pthread_queue_dequeue(queue, (char *) buf + i * queue->item_size, i == 0 ? timeout : 0) != PTHREAD_QUEUE_OK)
+			break;
+
+	return i;
+
+}
+
+#endif
@@ -31,6 +31,24 @@ int csp_queue_dequeue_isr(csp_queue_handle_t handle, void * buf, CSP_BASE_TYPE *
 	return windows_queue_dequeue(handle, buf, 0);
 }
 
+int csp_queue_enqueue_n(csp_queue_handle_t handle, void * values, int count, uint32_t timeout) {
+	windows_queue_t * queue = handle;
+	int i;
+	for (i = 0; i < count; i++)
+		if (windows_queue_enqueue(queue, (char *) values + i * queue->item_size, i == 0 ? timeout : 0) != WINDOWS_QUEUE_OK)
+			break;
+	return i;
+}
+
+int csp_queue_dequeue_n(csp_queue_handle_t handle, void * buf, int count, uint32_t timeout) {
+	windows_queue_t * queue = handle;
+	int i;
+	for (i = 0; i < count; i++)
+		if (windows_queue_dequeue(queue, (char *) buf + i * queue->item_size, i == 0 ? timeout : 0) != WINDOWS_QUEUE_OK)
+			break;
+	return i;
+}
+
 int csp_queue_size(csp_queue_handle_t handle) {
 	return windows_queue_items(handle);
 }
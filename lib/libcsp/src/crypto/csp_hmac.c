@@ -26,6 +26,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 /* CSP includes */
 #include <csp/csp.h>
+#include <csp/arch/csp_thread.h>
 
 #include "csp_hmac.h"
 #include "csp_sha1.h"
@@ -136,14 +137,134 @@ int csp_hmac_memory(const uint8_t * key, uint32_t keylen, const uint8_t * data,
 	return CSP_ERR_NONE;
 }
 
+/* SHA1 states after absorbing the key XOR ipad and opad blocks. Every
+ * packet resumes from these, so only the message and the outer digest
+ * are compressed per packet. Two slots let a new key be prepared while
+ * the router hashes with the published one. Readers count themselves in
+ * on a slot while copying from it, and a slot is only rewritten once
+ * its count has dropped to zero */
+typedef struct {
+	csp_sha1_state inner;
+	csp_sha1_state outer;
+	uint32_t readers;
+} csp_hmac_key_state_t;
+
+static csp_hmac_key_state_t csp_hmac_states[2];
+static csp_hmac_key_state_t * csp_hmac_active = NULL;
+static bool csp_hmac_setting = false;
+
+static void csp_hmac_prepare(csp_hmac_key_state_t * state, const uint8_t * key) {
+
+	uint32_t i;
+	uint8_t buf[SHA1_BLOCKSIZE];
+
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf, key, HMAC_KEY_LENGTH);
+
+	for (i = 0; i < SHA1_BLOCKSIZE; i++)
+		buf[i] ^= 0x36;
+	csp_sha1_init(&state->inner);
+	csp_sha1_process(&state->inner, buf, SHA1_BLOCKSIZE);
+
+	/* Flip from ipad to opad */
+	for (i = 0; i < SHA1_BLOCKSIZE; i++)
+		buf[i] ^= 0x36 ^ 0x5C;
+	csp_sha1_init(&state->outer);
+	csp_sha1_process(&state->outer, buf, SHA1_BLOCKSIZE);
+
+}
+
+/* Key changes are serialised by csp_hmac_setting, which also guards
+ * csp_hmac_key itself */
+static void csp_hmac_lock(void) {
+	while (__atomic_exchange_n(&csp_hmac_setting, true, __ATOMIC_ACQUIRE))
+		csp_sleep_ms(1);
+}
+
+static void csp_hmac_unlock(void) {
+	__atomic_store_n(&csp_hmac_setting, false, __ATOMIC_RELEASE);
+}
+
+/* Prepare csp_hmac_key and make it the active state, lock held */
+static void csp_hmac_publish(void) {
+
+	/* Take the slot not in use, and wait for readers that picked it up
+	 * before the previous key change to finish copying from it */
+	csp_hmac_key_state_t * state = &csp_hmac_states[0];
+	if (__atomic_load_n(&csp_hmac_active, __ATOMIC_SEQ_CST) == state)
+		state = &csp_hmac_states[1];
+	while (__atomic_load_n(&state->readers, __ATOMIC_SEQ_CST) != 0)
+		csp_sleep_ms(1);
+
+	csp_hmac_prepare(state, csp_hmac_key);
+	__atomic_store_n(&csp_hmac_active, state, __ATOMIC_SEQ_CST);
+
+}
+
+static csp_hmac_key_state_t * csp_hmac_get_state(void) {
+
+	csp_hmac_key_state_t * state = __atomic_load_n(&csp_hmac_active, __ATOMIC_ACQUIRE);
+
+	/* No key set yet, use the all zero key as before */
+	if (state == NULL) {
+		csp_hmac_lock();
+		if (__atomic_load_n(&csp_hmac_active, __ATOMIC_ACQUIRE) == NULL)
+			csp_hmac_publish();
+		csp_hmac_unlock();
+		state = __atomic_load_n(&csp_hmac_active, __ATOMIC_ACQUIRE);
+	}
+
+	return state;
+
+}
+
+/* Pin the published key state. The second look at csp_hmac_active pairs
+ * with the reader check in csp_hmac_publish: either the writer sees our
+ * count, or we see that the slot was retired and try the new one */
+static csp_hmac_key_state_t * csp_hmac_acquire(void) {
+
+	for (;;) {
+		csp_hmac_key_state_t * state = csp_hmac_get_state();
+		__atomic_add_fetch(&state->readers, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&csp_hmac_active, __ATOMIC_SEQ_CST) == state)
+			return state;
+		__atomic_sub_fetch(&state->readers, 1, __ATOMIC_RELEASE);
+	}
+
+}
+
+static void csp_hmac_release(csp_hmac_key_state_t * state) {
+	__atomic_sub_fetch(&state->readers, 1, __ATOMIC_RELEASE);
+}
+
+static void csp_hmac_packet(const uint8_t * data, uint32_t datalen, uint8_t * hmac) {
+
+	csp_hmac_key_state_t * state = csp_hmac_acquire();
+	csp_sha1_state md, outer;
+	uint8_t isha[SHA1_DIGESTSIZE];
+
+	md = state->inner;
+	outer = state->outer;
+	csp_hmac_release(state);
+
+	csp_sha1_process(&md, data, datalen);
+	csp_sha1_done(&md, isha);
+
+	csp_sha1_process(&outer, isha, SHA1_DIGESTSIZE);
+	csp_sha1_done(&outer, hmac);
+
+}
+
 int csp_hmac_set_key(char * key, uint32_t keylen) {
 
 	/* Use SHA1 as KDF */
 	uint8_t hash[SHA1_DIGESTSIZE];
 	csp_sha1_memory((uint8_t *)key, keylen, hash);
 
-	/* Copy key */
+	csp_hmac_lock();
 	memcpy(csp_hmac_key, hash, HMAC_KEY_LENGTH);
+	csp_hmac_publish();
+	csp_hmac_unlock();
 
 	return CSP_ERR_NONE;
 
@@ -159,9 +280,9 @@ int csp_hmac_append(csp_packet_t * packet, bool include_header) {
 
 	/* Calculate HMAC */
 	if (include_header) {
-		csp_hmac_memory(csp_hmac_key, HMAC_KEY_LENGTH, (uint8_t *) &packet->id, packet->length + sizeof(packet->id), hmac);
+		csp_hmac_packet((uint8_t *) &packet->id, packet->length + sizeof(packet->id), hmac);
 	} else {
-		csp_hmac_memory(csp_hmac_key, HMAC_KEY_LENGTH, packet->data, packet->length, hmac);
+		csp_hmac_packet(packet->data, packet->length, hmac);
 	}
 
 	/* Truncate hash and copy to packet */
@@ -182,9 +303,9 @@ int csp_hmac_verify(csp_packet_t * packet, bool include_header) {
 
 	/* Calculate HMAC */
 	if (include_header) {
-		csp_hmac_memory(csp_hmac_key, HMAC_KEY_LENGTH, (uint8_t *) &packet->id, packet->length + sizeof(packet->id) - CSP_HMAC_LENGTH, hmac);
+		csp_hmac_packet((uint8_t *) &packet->id, packet->length + sizeof(packet->id) - CSP_HMAC_LENGTH, hmac);
 	} else {
-		csp_hmac_memory(csp_hmac_key, HMAC_KEY_LENGTH, packet->data, packet->length - CSP_HMAC_LENGTH, hmac);
+		csp_hmac_packet(packet->data, packet->length - CSP_HMAC_LENGTH, hmac);
 	}
 
 	/* Compare calculated HMAC with packet header */
@@ -28,7 +28,12 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include "csp_sha1.h"
 
-#ifdef CSP_USE_HMAC
+#if defined(CSP_USE_HMAC) || defined(CSP_USE_XTEA)
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CSP_SHA1_X86
+#include <immintrin.h>
+#endif
 
 /* Rotate left macro */
 #define ROL(x,y)	(((x) << (y)) | ((x) >> (32-y)))
@@ -61,76 +66,183 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #define F2(x,y,z)  ((x & y) | (z & (x | y)))
 #define F3(x,y,z)  (x ^ y ^ z)
 
-#define FF_0(a, b, c, d, e, i) do {e = (ROL(a, 5) + F0(b,c,d) + e + W[i] + 0x5a827999UL); b = ROL(b, 30);} while (0)
-#define FF_1(a, b, c, d, e, i) do {e = (ROL(a, 5) + F1(b,c,d) + e + W[i] + 0x6ed9eba1UL); b = ROL(b, 30);} while (0)
-#define FF_2(a, b, c, d, e, i) do {e = (ROL(a, 5) + F2(b,c,d) + e + W[i] + 0x8f1bbcdcUL); b = ROL(b, 30);} while (0)
-#define FF_3(a, b, c, d, e, i) do {e = (ROL(a, 5) + F3(b,c,d) + e + W[i] + 0xca62c1d6UL); b = ROL(b, 30);} while (0)
+/* Message schedule kept as a rolling window of 16 words */
+#define W(i)		W[(i) & 15]
+#define EXPAND(i)	(W(i) = ROL(W((i)+13) ^ W((i)+8) ^ W((i)+2) ^ W(i), 1))
+
+#define FF_0(a, b, c, d, e, i) do {e = (ROL(a, 5) + F0(b,c,d) + e + W(i) + 0x5a827999UL); b = ROL(b, 30);} while (0)
+#define FF_1(a, b, c, d, e, i) do {e = (ROL(a, 5) + F1(b,c,d) + e + EXPAND(i) + 0x6ed9eba1UL); b = ROL(b, 30);} while (0)
+#define FF_2(a, b, c, d, e, i) do {e = (ROL(a, 5) + F2(b,c,d) + e + EXPAND(i) + 0x8f1bbcdcUL); b = ROL(b, 30);} while (0)
+#define FF_3(a, b, c, d, e, i) do {e = (ROL(a, 5) + F3(b,c,d) + e + EXPAND(i) + 0xca62c1d6UL); b = ROL(b, 30);} while (0)
+
+/* Round one also expands the schedule once the first 16 words are used */
+#define FF_0X(a, b, c, d, e, i) do {e = (ROL(a, 5) + F0(b,c,d) + e + EXPAND(i) + 0x5a827999UL); b = ROL(b, 30);} while (0)
+
+/* Compress a number of consecutive 64 byte blocks into the state */
+typedef void (*csp_sha1_blocks_fn_t)(uint32_t state[5], const uint8_t * buf, uint32_t blocks);
+
+static void csp_sha1_blocks_sw(uint32_t state[5], const uint8_t * buf, uint32_t blocks) {
+
+	uint32_t a, b, c, d, e, W[16], i;
+
+	while (blocks--) {
+
+		/* Copy the state into 512-bits into W[0..15] */
+		for (i = 0; i < 16; i++)
+			LOAD32H(W[i], buf + (4*i));
+
+		/* Copy state */
+		a = state[0];
+		b = state[1];
+		c = state[2];
+		d = state[3];
+		e = state[4];
+
+		/* Round one */
+		for (i = 0; i < 15; i += 5) {
+		   FF_0(a, b, c, d, e, i);
+		   FF_0(e, a, b, c, d, i + 1);
+		   FF_0(d, e, a, b, c, i + 2);
+		   FF_0(c, d, e, a, b, i + 3);
+		   FF_0(b, c, d, e, a, i + 4);
+		}
+		FF_0(a, b, c, d, e, 15);
+		FF_0X(e, a, b, c, d, 16);
+		FF_0X(d, e, a, b, c, 17);
+		FF_0X(c, d, e, a, b, 18);
+		FF_0X(b, c, d, e, a, 19);
+
+		/* Round two */
+		for (i = 20; i < 40; i += 5) {
+		   FF_1(a, b, c, d, e, i);
+		   FF_1(e, a, b, c, d, i + 1);
+		   FF_1(d, e, a, b, c, i + 2);
+		   FF_1(c, d, e, a, b, i + 3);
+		   FF_1(b, c, d, e, a, i + 4);
+		}
+
+		/* Round three */
+		for (; i < 60; i += 5) {
+		   FF_2(a, b, c, d, e, i);
+		   FF_2(e, a, b, c, d, i + 1);
+		   FF_2(d, e, a, b, c, i + 2);
+		   FF_2(c, d, e, a, b, i + 3);
+		   FF_2(b, c, d, e, a, i + 4);
+		}
+
+		/* Round four */
+		for (; i < 80; i += 5) {
+		   FF_3(a, b, c, d, e, i);
+		   FF_3(e, a, b, c, d, i + 1);
+		   FF_3(d, e, a, b, c, i + 2);
+		   FF_3(c, d, e, a, b, i + 3);
+		   FF_3(b, c, d, e, a, i + 4);
+		}
+
+		/* Store */
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+
+		buf += SHA1_BLOCKSIZE;
+	}
 
-static void csp_sha1_compress(csp_sha1_state * sha1, const uint8_t * buf) {
+}
 
-	uint32_t a, b, c, d, e, W[80], i;
+#ifdef CSP_SHA1_X86
+
+/* One group of four rounds with the SHA extensions. Step g consumes message
+ * words 4g..4g+3 from msg[g % 4] while the words four steps ahead are
+ * being scheduled in the other three registers */
+#define SHA1_NI_STEP(g, ea, eb) do { \
+	if ((g) == 0) \
+		ea = _mm_add_epi32(ea, msg[0]); \
+	else \
+		ea = _mm_sha1nexte_epu32(ea, msg[(g) & 3]); \
+	eb = abcd; \
+	if ((g) >= 3 && (g) <= 18) \
+		msg[((g) + 1) & 3] = _mm_sha1msg2_epu32(msg[((g) + 1) & 3], msg[(g) & 3]); \
+	abcd = _mm_sha1rnds4_epu32(abcd, ea, (g) / 5); \
+	if ((g) >= 1 && (g) <= 16) \
+		msg[((g) + 3) & 3] = _mm_sha1msg1_epu32(msg[((g) + 3) & 3], msg[(g) & 3]); \
+	if ((g) >= 2 && (g) <= 17) \
+		msg[((g) + 2) & 3] = _mm_xor_si128(msg[((g) + 2) & 3], msg[(g) & 3]); \
+} while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void csp_sha1_blocks_shani(uint32_t state[5], const uint8_t * buf, uint32_t blocks) {
+
+	const __m128i bswap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e0, e0_save, e1, msg[4];
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) state), 0x1B);
+	e0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+	while (blocks--) {
+		abcd_save = abcd;
+		e0_save = e0;
+
+		for (int i = 0; i < 4; i++)
+			msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (buf + 16 * i)), bswap);
+
+		SHA1_NI_STEP(0, e0, e1);
+		SHA1_NI_STEP(1, e1, e0);
+		SHA1_NI_STEP(2, e0, e1);
+		SHA1_NI_STEP(3, e1, e0);
+		SHA1_NI_STEP(4, e0, e1);
+		SHA1_NI_STEP(5, e1, e0);
+		SHA1_NI_STEP(6, e0, e1);
+		SHA1_NI_STEP(7, e1, e0);
+		SHA1_NI_STEP(8, e0, e1);
+		SHA1_NI_STEP(9, e1, e0);
+		SHA1_NI_STEP(10, e0, e1);
+		SHA1_NI_STEP(11, e1, e0);
+		SHA1_NI_STEP(12, e0, e1);
+		SHA1_NI_STEP(13, e1, e0);
+		SHA1_NI_STEP(14, e0, e1);
+		SHA1_NI_STEP(15, e1, e0);
+		SHA1_NI_STEP(16, e0, e1);
+		SHA1_NI_STEP(17, e1, e0);
+		SHA1_NI_STEP(18, e0, e1);
+		SHA1_NI_STEP(19, e1, e0);
+
+		e0 = _mm_sha1nexte_epu32(e0, e0_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+
+		buf += SHA1_BLOCKSIZE;
+	}
 
-	/* Copy the state into 512-bits into W[0..15] */
-	for (i = 0; i < 16; i++)
-		LOAD32H(W[i], buf + (4*i));
+	_mm_storeu_si128((__m128i *) state, _mm_shuffle_epi32(abcd, 0x1B));
+	state[4] = _mm_extract_epi32(e0, 3);
 
-	/* Copy state */
-	a = sha1->state[0];
-	b = sha1->state[1];
-	c = sha1->state[2];
-	d = sha1->state[3];
-	e = sha1->state[4];
+}
 
-	/* Expand it */
-	for (i = 16; i < 80; i++)
-		W[i] = ROL(W[i-3] ^ W[i-8] ^ W[i-14] ^ W[i-16], 1);
+#endif // CSP_SHA1_X86
 
-	/* Compress */
-	i = 0;
+static void csp_sha1_blocks_select(uint32_t state[5], const uint8_t * buf, uint32_t blocks);
 
-	/* Round one */
-	for (; i < 20;) {
-	   FF_0(a, b, c, d, e, i++);
-	   FF_0(e, a, b, c, d, i++);
-	   FF_0(d, e, a, b, c, i++);
-	   FF_0(c, d, e, a, b, i++);
-	   FF_0(b, c, d, e, a, i++);
-	}
+static csp_sha1_blocks_fn_t sha1_blocks_impl = csp_sha1_blocks_select;
 
-	/* Round two */
-	for (; i < 40;)  {
-	   FF_1(a, b, c, d, e, i++);
-	   FF_1(e, a, b, c, d, i++);
-	   FF_1(d, e, a, b, c, i++);
-	   FF_1(c, d, e, a, b, i++);
-	   FF_1(b, c, d, e, a, i++);
-	}
+/* Pick the block function on first use, every caller stores the same pointer */
+static void csp_sha1_blocks_select(uint32_t state[5], const uint8_t * buf, uint32_t blocks) {
 
-	/* Round three */
-	for (; i < 60;)  {
-	   FF_2(a, b, c, d, e, i++);
-	   FF_2(e, a, b, c, d, i++);
-	   FF_2(d, e, a, b, c, i++);
-	   FF_2(c, d, e, a, b, i++);
-	   FF_2(b, c, d, e, a, i++);
-	}
+	csp_sha1_blocks_fn_t blocks_fn = csp_sha1_blocks_sw;
 
-	/* Round four */
-	for (; i < 80;)  {
-	   FF_3(a, b, c, d, e, i++);
-	   FF_3(e, a, b, c, d, i++);
-	   FF_3(d, e, a, b, c, i++);
-	   FF_3(c, d, e, a, b, i++);
-	   FF_3(b, c, d, e, a, i++);
-	}
+#ifdef CSP_SHA1_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1"))
+		blocks_fn = csp_sha1_blocks_shani;
+#endif
+
+	__atomic_store_n(&sha1_blocks_impl, blocks_fn, __ATOMIC_RELAXED);
+	blocks_fn(state, buf, blocks);
 
-	/* Store */
-	sha1->state[0] += a;
-	sha1->state[1] += b;
-	sha1->state[2] += c;
-	sha1->state[3] += d;
-	sha1->state[4] += e;
+}
 
+static inline void csp_sha1_compress(csp_sha1_state * sha1, const uint8_t * buf, uint32_t blocks) {
+	__atomic_load_n(&sha1_blocks_impl, __ATOMIC_RELAXED)(sha1->state, buf, blocks);
 }
 
 void csp_sha1_init(csp_sha1_state * sha1) {
@@ -150,10 +262,12 @@ void csp_sha1_process(csp_sha1_state * sha1, const uint8_t * in, uint32_t inlen)
 	uint32_t n;
 	while (inlen > 0) {
 		if (sha1->curlen == 0 && inlen >= SHA1_BLOCKSIZE) {
-		   csp_sha1_compress(sha1, in);
-		   sha1->length += SHA1_BLOCKSIZE * 8;
-		   in += SHA1_BLOCKSIZE;
-		   inlen -= SHA1_BLOCKSIZE;
+		   n = inlen / SHA1_BLOCKSIZE;
+		   csp_sha1_compress(sha1, in, n);
+		   n *= SHA1_BLOCKSIZE;
+		   sha1->length += (uint64_t) n * 8;
+		   in += n;
+		   inlen -= n;
 		} else {
 		   n = MIN(inlen, (SHA1_BLOCKSIZE - sha1->curlen));
 		   memcpy(sha1->buf + sha1->curlen, in, (size_t)n);
@@ -161,7 +275,7 @@ void csp_sha1_process(csp_sha1_state * sha1, const uint8_t * in, uint32_t inlen)
 		   in += n;
 		   inlen -= n;
 		   if (sha1->curlen == SHA1_BLOCKSIZE) {
-			  csp_sha1_compress(sha1, sha1->buf);
+			  csp_sha1_compress(sha1, sha1->buf, 1);
 			  sha1->length += 8*SHA1_BLOCKSIZE;
 			  sha1->curlen = 0;
 		   }
@@ -185,19 +299,17 @@ void csp_sha1_done(csp_sha1_state * sha1, uint8_t * out) {
 	 * encoding like normal.
 	 */
 	if (sha1->curlen > 56) {
-		while (sha1->curlen < 64)
-			sha1->buf[sha1->curlen++] = 0;
-		csp_sha1_compress(sha1, sha1->buf);
+		memset(sha1->buf + sha1->curlen, 0, SHA1_BLOCKSIZE - sha1->curlen);
+		csp_sha1_compress(sha1, sha1->buf, 1);
 		sha1->curlen = 0;
 	}
 
 	/* Pad up to 56 bytes of zeroes */
-	while (sha1->curlen < 56)
-		sha1->buf[sha1->curlen++] = 0;
+	memset(sha1->buf + sha1->curlen, 0, 56 - sha1->curlen);
 
 	/* Store length */
 	STORE64H(sha1->length, sha1->buf + 56);
-	csp_sha1_compress(sha1, sha1->buf);
+	csp_sha1_compress(sha1, sha1->buf, 1);
 
 	/* Copy output */
 	for (i = 0; i < 5; i++)
@@ -214,4 +326,4 @@ void csp_sha1_memory(const uint8_t * msg, uint32_t len, uint8_t * hash) {
 
 }
 
-#endif // CSP_USE_HMAC
+#endif // CSP_USE_HMAC || CSP_USE_XTEA
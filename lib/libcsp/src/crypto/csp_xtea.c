@@ -32,13 +32,24 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #ifdef CSP_USE_XTEA
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CSP_XTEA_X86
+#include <immintrin.h>
+#endif
+
 #define XTEA_BLOCKSIZE 	8
 #define XTEA_ROUNDS 	32
 #define XTEA_KEY_LENGTH	16
+#define XTEA_DELTA		0x9E3779B9
 
 /* XTEA key */
 static uint32_t csp_xtea_key[XTEA_KEY_LENGTH/sizeof(uint32_t)] __attribute__ ((aligned(sizeof(uint32_t))));
 
+/* Round keys, sum + k[..] for both halves of every round. Derived from
+ * csp_xtea_key in csp_xtea_set_key, the all zero key gives all sums */
+static uint32_t csp_xtea_schedule[2 * XTEA_ROUNDS];
+static int csp_xtea_schedule_valid = 0;
+
 #define STORE32L(x, y) do { (y)[3] = (uint8_t)(((x) >> 24) & 0xff); \
 							(y)[2] = (uint8_t)(((x) >> 16) & 0xff); \
 							(y)[1] = (uint8_t)(((x) >> 8) & 0xff); \
@@ -49,35 +60,204 @@ static uint32_t csp_xtea_key[XTEA_KEY_LENGTH/sizeof(uint32_t)] __attribute__ ((a
 								 ((uint32_t)((y)[1] & 0xff) << 8)  | \
 								 ((uint32_t)((y)[0] & 0xff) << 0); } while (0)
 
-/* This function takes 64 bits of data in block and the 128 bits key in key */
-static inline void csp_xtea_encrypt_block(uint8_t *block, uint8_t const *key) {
+#define BSWAP32(x)	((((x) >> 24) & 0xff) | (((x) >> 8) & 0xff00) | (((x) & 0xff00) << 8) | ((x) << 24))
+
+/* XOR the keystream onto data. The first two blocks both use the counter
+ * pair (hi, ctr), block n after that (hi, ctr + n - 1). The counter has
+ * always been incremented after it was loaded for the second block and
+ * the other end expects exactly this sequence */
+typedef void (*csp_xtea_ctr_fn_t)(uint8_t * data, uint32_t len, uint32_t hi, uint32_t ctr);
+
+static void csp_xtea_schedule_init(const uint8_t * key) {
 
-	uint32_t i, v0, v1, delta = 0x9E3779B9, sum = 0, k[4];
+	uint32_t i, sum = 0, k[4];
 
 	LOAD32L(k[0], &key[0]);
 	LOAD32L(k[1], &key[4]);
 	LOAD32L(k[2], &key[8]);
 	LOAD32L(k[3], &key[12]);
 
-	LOAD32L(v0, &block[0]);
-	LOAD32L(v1, &block[4]);
+	for (i = 0; i < XTEA_ROUNDS; i++) {
+		csp_xtea_schedule[2 * i] = sum + k[sum & 3];
+		sum += XTEA_DELTA;
+		csp_xtea_schedule[2 * i + 1] = sum + k[(sum >> 11) & 3];
+	}
+
+}
+
+/* Encrypt the 64 bit block v0, v1 */
+static inline void csp_xtea_encrypt_block(uint32_t * v0, uint32_t * v1) {
+
+	uint32_t i, a = *v0, b = *v1;
 
 	for (i = 0; i < XTEA_ROUNDS; i++) {
-		v0 += (((v1 << 4) ^ (v1 >> 5)) + v1) ^ (sum + k[sum & 3]);
-		sum += delta;
-		v1 += (((v0 << 4) ^ (v0 >> 5)) + v0) ^ (sum + k[(sum >> 11) & 3]);
+		a += (((b << 4) ^ (b >> 5)) + b) ^ csp_xtea_schedule[2 * i];
+		b += (((a << 4) ^ (a >> 5)) + a) ^ csp_xtea_schedule[2 * i + 1];
+	}
+
+	*v0 = a;
+	*v1 = b;
+
+}
+
+static inline void csp_xtea_xor(uint8_t * dst, const uint8_t * src, uint32_t len) {
+
+	uint32_t d, s;
+
+	while (len >= sizeof(uint32_t)) {
+		memcpy(&d, dst, sizeof(d));
+		memcpy(&s, src, sizeof(s));
+		d ^= s;
+		memcpy(dst, &d, sizeof(d));
+		dst += sizeof(uint32_t);
+		src += sizeof(uint32_t);
+		len -= sizeof(uint32_t);
+	}
+
+	while (len--)
+		*dst++ ^= *src++;
+
+}
+
+static void csp_xtea_ctr_sw(uint8_t * data, uint32_t len, uint32_t hi, uint32_t ctr) {
+
+	uint8_t stream[XTEA_BLOCKSIZE];
+	uint32_t v0, v1, n, block = 0;
+
+	while (len > 0) {
+		v0 = BSWAP32(hi);
+		v1 = BSWAP32(ctr);
+		csp_xtea_encrypt_block(&v0, &v1);
+		STORE32L(v0, &stream[0]);
+		STORE32L(v1, &stream[4]);
+
+		n = len < XTEA_BLOCKSIZE ? len : XTEA_BLOCKSIZE;
+		csp_xtea_xor(data, stream, n);
+		data += n;
+		len -= n;
+		if (block++ > 0)
+			ctr++;
+	}
+
+}
+
+#ifdef CSP_XTEA_X86
+
+/* Four blocks per pass in SSE2 lanes, v0 and v1 of block n in lane n */
+static void csp_xtea_ctr_sse2(uint8_t * data, uint32_t len, uint32_t hi, uint32_t ctr) {
+
+	uint8_t stream[4 * XTEA_BLOCKSIZE];
+
+	/* Lanes of the first pass start with the repeated counter */
+	__m128i b = _mm_add_epi32(_mm_set1_epi32(ctr), _mm_set_epi32(2, 1, 0, 0));
+	ctr += 3;
+
+	while (len > 0) {
+		__m128i a = _mm_set1_epi32(BSWAP32(hi));
+
+		/* Byte swap each counter, SSE2 has no byte shuffle */
+		b = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(b, 24), _mm_srli_epi32(b, 24)),
+				_mm_or_si128(_mm_and_si128(_mm_slli_epi32(b, 8), _mm_set1_epi32(0xff0000)),
+						_mm_and_si128(_mm_srli_epi32(b, 8), _mm_set1_epi32(0xff00))));
+
+		for (int i = 0; i < XTEA_ROUNDS; i++) {
+			a = _mm_add_epi32(a, _mm_xor_si128(_mm_add_epi32(_mm_xor_si128(_mm_slli_epi32(b, 4), _mm_srli_epi32(b, 5)), b),
+					_mm_set1_epi32(csp_xtea_schedule[2 * i])));
+			b = _mm_add_epi32(b, _mm_xor_si128(_mm_add_epi32(_mm_xor_si128(_mm_slli_epi32(a, 4), _mm_srli_epi32(a, 5)), a),
+					_mm_set1_epi32(csp_xtea_schedule[2 * i + 1])));
+		}
+
+		/* Interleave back to v0, v1 per block, which is the keystream byte order */
+		__m128i s0 = _mm_unpacklo_epi32(a, b);
+		__m128i s1 = _mm_unpackhi_epi32(a, b);
+
+		if (len < sizeof(stream)) {
+			_mm_storeu_si128((__m128i *) &stream[0], s0);
+			_mm_storeu_si128((__m128i *) &stream[16], s1);
+			csp_xtea_xor(data, stream, len);
+			break;
+		}
+
+		__m128i * p = (__m128i *) data;
+		_mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), s0));
+		_mm_storeu_si128(p + 1, _mm_xor_si128(_mm_loadu_si128(p + 1), s1));
+
+		b = _mm_add_epi32(_mm_set1_epi32(ctr), _mm_set_epi32(3, 2, 1, 0));
+		ctr += 4;
+		data += sizeof(stream);
+		len -= sizeof(stream);
 	}
 
-	STORE32L(v0, &block[0]);
-	STORE32L(v1, &block[4]);
+}
+
+/* Eight blocks per pass in AVX2 lanes */
+__attribute__((target("avx2")))
+static void csp_xtea_ctr_avx2(uint8_t * data, uint32_t len, uint32_t hi, uint32_t ctr) {
+
+	const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	uint8_t stream[8 * XTEA_BLOCKSIZE];
+
+	/* Lanes of the first pass start with the repeated counter */
+	__m256i lanes = _mm256_add_epi32(_mm256_set1_epi32(ctr), _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6));
+	ctr += 7;
+
+	while (len > 0) {
+		__m256i a = _mm256_set1_epi32(BSWAP32(hi));
+		__m256i b = _mm256_shuffle_epi8(lanes, bswap);
+
+		for (int i = 0; i < XTEA_ROUNDS; i++) {
+			a = _mm256_add_epi32(a, _mm256_xor_si256(_mm256_add_epi32(_mm256_xor_si256(_mm256_slli_epi32(b, 4), _mm256_srli_epi32(b, 5)), b),
+					_mm256_set1_epi32(csp_xtea_schedule[2 * i])));
+			b = _mm256_add_epi32(b, _mm256_xor_si256(_mm256_add_epi32(_mm256_xor_si256(_mm256_slli_epi32(a, 4), _mm256_srli_epi32(a, 5)), a),
+					_mm256_set1_epi32(csp_xtea_schedule[2 * i + 1])));
+		}
+
+		/* Unpack works within 128 bit halves, blocks 0 1 4 5 and 2 3 6 7 */
+		__m256i lo = _mm256_unpacklo_epi32(a, b);
+		__m256i hi_blocks = _mm256_unpackhi_epi32(a, b);
+		__m256i s0 = _mm256_permute2x128_si256(lo, hi_blocks, 0x20);
+		__m256i s1 = _mm256_permute2x128_si256(lo, hi_blocks, 0x31);
+
+		if (len < sizeof(stream)) {
+			_mm256_storeu_si256((__m256i *) &stream[0], s0);
+			_mm256_storeu_si256((__m256i *) &stream[32], s1);
+			csp_xtea_xor(data, stream, len);
+			break;
+		}
+
+		__m256i * p = (__m256i *) data;
+		_mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), s0));
+		_mm256_storeu_si256(p + 1, _mm256_xor_si256(_mm256_loadu_si256(p + 1), s1));
+
+		lanes = _mm256_add_epi32(_mm256_set1_epi32(ctr), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+		ctr += 8;
+		data += sizeof(stream);
+		len -= sizeof(stream);
+	}
 
 }
 
-static inline void csp_xtea_xor_byte(uint8_t * dst, uint8_t * src, uint32_t len) {
+#endif // CSP_XTEA_X86
+
+static void csp_xtea_ctr_select(uint8_t * data, uint32_t len, uint32_t hi, uint32_t ctr);
+
+static csp_xtea_ctr_fn_t xtea_ctr_impl = csp_xtea_ctr_select;
+
+/* Pick the keystream kernel on first use, every caller stores the same pointer */
+static void csp_xtea_ctr_select(uint8_t * data, uint32_t len, uint32_t hi, uint32_t ctr) {
+
+	csp_xtea_ctr_fn_t ctr_fn = csp_xtea_ctr_sw;
 
-	unsigned int i;
-	for (i = 0; i < len; i++)
-		dst[i] ^= src[i];
+#ifdef CSP_XTEA_X86
+	__builtin_cpu_init();
+	ctr_fn = csp_xtea_ctr_sse2;
+	if (__builtin_cpu_supports("avx2"))
+		ctr_fn = csp_xtea_ctr_avx2;
+#endif
+
+	__atomic_store_n(&xtea_ctr_impl, ctr_fn, __ATOMIC_RELAXED);
+	ctr_fn(data, len, hi, ctr);
 
 }
 
@@ -89,6 +269,8 @@ int csp_xtea_set_key(char * key, uint32_t keylen) {
 
 	/* Copy key */
 	memcpy(csp_xtea_key, hash, XTEA_KEY_LENGTH);
+	csp_xtea_schedule_init((uint8_t *)csp_xtea_key);
+	csp_xtea_schedule_valid = 1;
 
 	return CSP_ERR_NONE;
 
@@ -96,30 +278,17 @@ int csp_xtea_set_key(char * key, uint32_t keylen) {
 
 int csp_xtea_encrypt(uint8_t * plain, const uint32_t len, uint32_t iv[2]) {
 
-	unsigned int i;
-	uint32_t stream[2];
-
 	uint32_t blocks = (len + XTEA_BLOCKSIZE - 1)/ XTEA_BLOCKSIZE;
-	uint32_t remain;
-
-	/* Initialize stream */
-	stream[0] = csp_htobe32(iv[0]);
-	stream[1] = csp_htobe32(iv[1]);
 
-	for (i = 0; i < blocks; i++) {
-		/* Create stream */
-		csp_xtea_encrypt_block((uint8_t *)stream, (uint8_t *)csp_xtea_key);
-
-		/* Calculate remaining bytes */
-		remain = len - i * XTEA_BLOCKSIZE;
+	/* No key set yet, run with the all zero key */
+	if (!csp_xtea_schedule_valid) {
+		csp_xtea_schedule_init((uint8_t *)csp_xtea_key);
+		csp_xtea_schedule_valid = 1;
+	}
 
-		/* XOR plain text with stream to generate cipher text */
-		csp_xtea_xor_byte(&plain[len - remain], (uint8_t *)stream, remain < XTEA_BLOCKSIZE ? remain : XTEA_BLOCKSIZE);
+	__atomic_load_n(&xtea_ctr_impl, __ATOMIC_RELAXED)(plain, len, iv[0], iv[1]);
 
-		/* Increment counter */
-		stream[0] = csp_htobe32(iv[0]);
-		stream[1] = csp_htobe32(iv[1]++);
-	}
+	iv[1] += blocks;
 
 	return CSP_ERR_NONE;
 
@@ -28,89 +28,507 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <csp/arch/csp_queue.h>
 #include <csp/arch/csp_malloc.h>
 #include <csp/arch/csp_semaphore.h>
+#include <csp/arch/csp_time.h>
 
 #ifndef CSP_BUFFER_ALIGN
 #define CSP_BUFFER_ALIGN	(sizeof(int *))
 #endif
 
+/* Room kept behind the requested size in all but the largest class, for
+ * the trailers appended on the way out (RDP header, HMAC, CRC32, nonce) */
+#define CSP_BUFFER_SLACK		32
+
+/* Allocations per class, the initial one is never released */
+#define CSP_BUFFER_CHUNKS		64
+
+/* Minimum time between shrinks, and the time a released chunk is kept
+ * before its memory is freed, in ms */
+#define CSP_BUFFER_SHRINK_INTERVAL	10000
+
 typedef struct csp_skbf_s {
 	unsigned int refcount;
+	unsigned int next;		/* Free list link, index + 1 */
+	uint8_t class;
+	uint8_t chunk;
+	uint16_t slot;
 	void * skbf_addr;
 	char skbf_data[];
 } csp_skbf_t;
 
-static csp_queue_handle_t csp_buffers;
-static char * csp_buffer_pool;
-static unsigned int count, size;
+typedef struct {
+	unsigned int size;		/* Buffer size, packet header included */
+	unsigned int skbfsize;
+	unsigned int max;		/* Limit when growing */
+	unsigned int grow;		/* Buffers added per chunk */
+	unsigned int base_chunks;	/* Chunks from init, never released */
+	unsigned int chunks;
+	char * chunk[CSP_BUFFER_CHUNKS];
+	unsigned int chunk_len[CSP_BUFFER_CHUNKS];
+	char * retired[CSP_BUFFER_CHUNKS];
+	unsigned int retired_count;
+	/* Statistics, updated atomically */
+	unsigned int count;
+	unsigned int in_use;
+	unsigned int high_water;
+	unsigned int failures;
+#if defined(CSP_POSIX)
+	uint64_t free_head;
+#else
+	csp_queue_handle_t queue;
+#endif
+} csp_buffer_pool_t;
 
-CSP_DEFINE_CRITICAL(csp_critical_lock);
+static csp_buffer_pool_t csp_buffer_pools[CSP_BUFFER_CLASSES_MAX];
+static unsigned int csp_buffer_classes_count;
 
-int csp_buffer_init(int buf_count, int buf_size) {
+/* Serializes growing and shrinking, never taken on the fast path */
+static csp_mutex_t csp_buffer_lock;
+static uint32_t csp_buffer_shrink_time;
+
+static inline unsigned int csp_buffer_index(csp_skbf_t * buf) {
+	return (buf->chunk << 16) | buf->slot;
+}
+
+static inline csp_skbf_t * csp_buffer_at(csp_buffer_pool_t * pool, unsigned int index) {
+	return (csp_skbf_t *) &pool->chunk[index >> 16][(index & 0xFFFF) * pool->skbfsize];
+}
+
+#if defined(CSP_POSIX)
 
-	unsigned int i;
+#include <pthread.h>
+
+/* Lock free buffer pool. Free buffers form a stack linked by index.
+ * The head holds the top index + 1 in the low word and a change counter
+ * in the high word, so a pop racing with pop/push of the same buffer
+ * (ABA) fails its compare and swap. Each thread keeps a small magazine of
+ * buffers per class in front of the shared stacks. */
+
+#define CSP_BUFFER_MAGAZINE	8
+
+typedef struct {
+	unsigned int count;
+	csp_skbf_t * buf[CSP_BUFFER_MAGAZINE];
+} csp_buffer_magazine_t;
+
+static pthread_key_t magazine_key;
+static __thread csp_buffer_magazine_t magazine[CSP_BUFFER_CLASSES_MAX];
+static __thread int magazine_registered;
+
+static csp_skbf_t * csp_buffer_stack_pop(csp_buffer_pool_t * pool) {
+	uint64_t old = __atomic_load_n(&pool->free_head, __ATOMIC_ACQUIRE);
+	uint64_t new;
 	csp_skbf_t * buf;
 
-	count = buf_count;
-	size = buf_size + CSP_BUFFER_PACKET_OVERHEAD;
-	unsigned int skbfsize = (sizeof(csp_skbf_t) + size);
-	skbfsize = CSP_BUFFER_ALIGN * ((skbfsize + CSP_BUFFER_ALIGN - 1) / CSP_BUFFER_ALIGN);
-	unsigned int poolsize = count * skbfsize;
+	do {
+		if ((uint32_t) old == 0)
+			return NULL;
+		buf = csp_buffer_at(pool, (uint32_t) old - 1);
+		new = (((old >> 32) + 1) << 32) | __atomic_load_n(&buf->next, __ATOMIC_RELAXED);
+	} while (!__atomic_compare_exchange_n(&pool->free_head, &old, new, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
 
-	csp_buffer_pool = csp_malloc(poolsize);
-	if (csp_buffer_pool == NULL)
-		goto fail_malloc;
+	return buf;
+}
 
-	csp_buffers = csp_queue_create(count, sizeof(void *));
-	if (!csp_buffers)
-		goto fail_queue;
+static void csp_buffer_stack_push(csp_buffer_pool_t * pool, csp_skbf_t * buf) {
+	uint32_t index = csp_buffer_index(buf) + 1;
+	uint64_t old = __atomic_load_n(&pool->free_head, __ATOMIC_RELAXED);
+	uint64_t new;
 
-	if (CSP_INIT_CRITICAL(csp_critical_lock) != CSP_ERR_NONE)
-		goto fail_critical;
+	do {
+		__atomic_store_n(&buf->next, (uint32_t) old, __ATOMIC_RELAXED);
+		new = (((old >> 32) + 1) << 32) | index;
+	} while (!__atomic_compare_exchange_n(&pool->free_head, &old, new, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
 
-	memset(csp_buffer_pool, 0, poolsize);
+/* Return the magazines of an exiting thread to the shared stacks */
+static void csp_buffer_magazine_flush(void * arg) {
+	csp_buffer_magazine_t * mag = arg;
+	for (unsigned int c = 0; c < csp_buffer_classes_count; c++)
+		while (mag[c].count > 0)
+			csp_buffer_stack_push(&csp_buffer_pools[c], mag[c].buf[--mag[c].count]);
+}
 
-	for (i = 0; i < count; i++) {
+static csp_skbf_t * csp_buffer_pop(csp_buffer_pool_t * pool) {
+	csp_buffer_magazine_t * mag = &magazine[pool - csp_buffer_pools];
+
+	if (mag->count > 0)
+		return mag->buf[--mag->count];
+	return csp_buffer_stack_pop(pool);
+}
+
+static void csp_buffer_push(csp_buffer_pool_t * pool, csp_skbf_t * buf) {
+	csp_buffer_magazine_t * mag = &magazine[pool - csp_buffer_pools];
+
+	if (mag->count < CSP_BUFFER_MAGAZINE) {
+		if (!magazine_registered) {
+			pthread_setspecific(magazine_key, magazine);
+			magazine_registered = 1;
+		}
+		mag->buf[mag->count++] = buf;
+	} else {
+		csp_buffer_stack_push(pool, buf);
+	}
+}
+
+static int csp_buffer_pool_init(csp_buffer_pool_t * pool) {
+	pool->free_head = 0;
+	return CSP_ERR_NONE;
+}
+
+#define csp_buffer_pool_take(pool)		csp_buffer_stack_pop(pool)
+#define csp_buffer_pool_put(pool, buf)		csp_buffer_stack_push(pool, buf)
+#define csp_buffer_pop_isr(pool)		csp_buffer_pop(pool)
+#define csp_buffer_push_isr(pool, buf)		csp_buffer_push(pool, buf)
+
+/* Reference count updates may race between threads sharing a packet */
+static inline void csp_buffer_ref_init(csp_skbf_t * buf) {
+	__atomic_store_n(&buf->refcount, 1, __ATOMIC_RELAXED);
+}
+
+/* Drop one reference. Returns the count before the drop, 0 if already free */
+static inline unsigned int csp_buffer_ref_put(csp_skbf_t * buf) {
+	unsigned int old = __atomic_load_n(&buf->refcount, __ATOMIC_ACQUIRE);
+	do {
+		if (old == 0)
+			return 0;
+	} while (!__atomic_compare_exchange_n(&buf->refcount, &old, old - 1, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+	return old;
+}
+
+#else
+
+static int csp_buffer_pool_init(csp_buffer_pool_t * pool) {
+	pool->queue = csp_queue_create(pool->max, sizeof(void *));
+	if (!pool->queue)
+		return CSP_ERR_NOMEM;
+	return CSP_ERR_NONE;
+}
+
+static csp_skbf_t * csp_buffer_pop(csp_buffer_pool_t * pool) {
+	csp_skbf_t * buf = NULL;
+	csp_queue_dequeue(pool->queue, &buf, 0);
+	return buf;
+}
+
+static void csp_buffer_push(csp_buffer_pool_t * pool, csp_skbf_t * buf) {
+	csp_queue_enqueue(pool->queue, &buf, 0);
+}
+
+static csp_skbf_t * csp_buffer_pop_isr(csp_buffer_pool_t * pool) {
+	csp_skbf_t * buf = NULL;
+	CSP_BASE_TYPE task_woken = 0;
+	csp_queue_dequeue_isr(pool->queue, &buf, &task_woken);
+	return buf;
+}
+
+static void csp_buffer_push_isr(csp_buffer_pool_t * pool, csp_skbf_t * buf) {
+	CSP_BASE_TYPE task_woken = 0;
+	csp_queue_enqueue_isr(pool->queue, &buf, &task_woken);
+}
+
+#define csp_buffer_pool_take(pool)		csp_buffer_pop(pool)
+#define csp_buffer_pool_put(pool, buf)		csp_buffer_push(pool, buf)
+
+static inline void csp_buffer_ref_init(csp_skbf_t * buf) {
+	buf->refcount = 1;
+}
+
+static inline unsigned int csp_buffer_ref_put(csp_skbf_t * buf) {
+	unsigned int old = buf->refcount;
+	if (old > 0)
+		buf->refcount = old - 1;
+	return old;
+}
+
+#endif
+
+/* Allocate a chunk of buffers and put them on the free list, called with
+ * csp_buffer_lock held or during init */
+static int csp_buffer_chunk_add(csp_buffer_pool_t * pool, unsigned int len) {
+
+	unsigned int c = pool->chunks;
+
+	if (c >= CSP_BUFFER_CHUNKS || len == 0)
+		return CSP_ERR_NOMEM;
+
+	char * mem = csp_malloc(len * pool->skbfsize);
+	if (mem == NULL)
+		return CSP_ERR_NOMEM;
+	memset(mem, 0, len * pool->skbfsize);
+
+	/* Publish the chunk before any of its buffers can be popped */
+	pool->chunk[c] = mem;
+	pool->chunk_len[c] = len;
+	pool->chunks = c + 1;
+	__atomic_add_fetch(&pool->count, len, __ATOMIC_RELAXED);
+
+	for (unsigned int i = 0; i < len; i++) {
 
 		/* We have already taken care of pointer alignment since
 		 * skbfsize is an integer multiple of sizeof(int *)
 		 * but the explicit cast to a void * is still necessary
 		 * to tell the compiler so.
 		 */
-		buf = (void *) &csp_buffer_pool[i * skbfsize];
+		csp_skbf_t * buf = (void *) &mem[i * pool->skbfsize];
 		buf->refcount = 0;
+		buf->class = pool - csp_buffer_pools;
+		buf->chunk = c;
+		buf->slot = i;
 		buf->skbf_addr = buf;
 
-		csp_queue_enqueue(csp_buffers, &buf, 0);
+		csp_buffer_pool_put(pool, buf);
 
 	}
 
 	return CSP_ERR_NONE;
 
-fail_critical:
-	csp_queue_remove(csp_buffers);
-fail_queue:
-	csp_free(csp_buffer_pool);
-fail_malloc:
-	return CSP_ERR_NOMEM;
+}
+
+int csp_buffer_init_classes(const csp_buffer_class_t * classes, int count) {
+
+	csp_buffer_class_t sorted[CSP_BUFFER_CLASSES_MAX];
+
+	if (count < 1 || count > CSP_BUFFER_CLASSES_MAX)
+		return CSP_ERR_INVAL;
+
+	/* Smallest class first */
+	for (int i = 0; i < count; i++) {
+		int j = i;
+		for (; j > 0 && sorted[j - 1].size > classes[i].size; j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = classes[i];
+	}
+
+	if (csp_mutex_create(&csp_buffer_lock) != CSP_MUTEX_OK)
+		return CSP_ERR_NOMEM;
+
+	memset(csp_buffer_pools, 0, sizeof(csp_buffer_pools));
+
+#if defined(CSP_POSIX)
+	if (pthread_key_create(&magazine_key, csp_buffer_magazine_flush) != 0)
+		return CSP_ERR_NOMEM;
+#endif
+
+	for (int i = 0; i < count; i++) {
+		csp_buffer_pool_t * pool = &csp_buffer_pools[i];
+		unsigned int initial = sorted[i].count;
+		unsigned int max = (sorted[i].max > initial) ? sorted[i].max : initial;
+
+		if (sorted[i].size == 0 || initial > 0xFFFF)
+			return CSP_ERR_INVAL;
+
+		pool->size = sorted[i].size + CSP_BUFFER_PACKET_OVERHEAD;
+		pool->skbfsize = (sizeof(csp_skbf_t) + pool->size);
+		pool->skbfsize = CSP_BUFFER_ALIGN * ((pool->skbfsize + CSP_BUFFER_ALIGN - 1) / CSP_BUFFER_ALIGN);
+		pool->grow = ((initial > 0) ? initial : max) / 4;
+		if (pool->grow == 0)
+			pool->grow = 1;
+		if (pool->grow > 0xFFFF)
+			pool->grow = 0xFFFF;
+		if (max > initial + (CSP_BUFFER_CHUNKS - 1) * pool->grow)
+			max = initial + (CSP_BUFFER_CHUNKS - 1) * pool->grow;
+		pool->max = max;
+
+		if (csp_buffer_pool_init(pool) != CSP_ERR_NONE)
+			return CSP_ERR_NOMEM;
+
+		if (initial > 0) {
+			if (csp_buffer_chunk_add(pool, initial) != CSP_ERR_NONE)
+				return CSP_ERR_NOMEM;
+			pool->base_chunks = 1;
+		}
+	}
+
+	csp_buffer_classes_count = count;
+	csp_buffer_shrink_time = csp_get_ms();
+
+	return CSP_ERR_NONE;
+
+}
+
+int csp_buffer_init(int buf_count, int buf_size) {
+
+	csp_buffer_class_t class = {
+		.size = buf_size,
+		.count = buf_count,
+		.max = buf_count,
+	};
+
+	return csp_buffer_init_classes(&class, 1);
+
+}
+
+/* Add a chunk to a pool that ran dry and take a buffer from it */
+static csp_skbf_t * csp_buffer_grow(csp_buffer_pool_t * pool) {
+
+	csp_skbf_t * buf;
+
+	if (pool->count >= pool->max)
+		return NULL;
+
+	csp_mutex_lock(&csp_buffer_lock, CSP_MAX_DELAY);
+
+	/* Another task may have grown the pool, or a shrink returned its buffers */
+	buf = csp_buffer_pool_take(pool);
+	if (buf == NULL && pool->count < pool->max) {
+		unsigned int len = pool->max - pool->count;
+		if (len > pool->grow)
+			len = pool->grow;
+		if (csp_buffer_chunk_add(pool, len) == CSP_ERR_NONE) {
+			csp_log_buffer("Grow class %u to %u buffers", (unsigned int) (pool - csp_buffer_pools), pool->count);
+			buf = csp_buffer_pool_take(pool);
+		}
+	}
+
+	csp_mutex_unlock(&csp_buffer_lock);
+
+	return buf;
+
+}
+
+/* Release the newest chunk of a pool if all of its buffers are free */
+static int csp_buffer_pool_shrink(csp_buffer_pool_t * pool) {
+
+	unsigned int last = pool->chunks - 1;
+	unsigned int len = pool->chunk_len[last];
+	unsigned int held_count = 0;
+	csp_skbf_t * held = NULL, * others = NULL, * buf;
+
+	if (pool->chunks <= pool->base_chunks)
+		return 0;
+
+	/* Keep a chunk of free buffers in reserve, so a burst does not regrow at once */
+	unsigned int in_use = __atomic_load_n(&pool->in_use, __ATOMIC_RELAXED);
+	if (pool->count - in_use < len + pool->grow)
+		return 0;
+
+	/* Drain the free list, set aside the buffers of the last chunk */
+	while ((buf = csp_buffer_pool_take(pool)) != NULL) {
+		csp_skbf_t ** list = (buf->chunk == last) ? &held : &others;
+		buf->skbf_addr = *list;
+		*list = buf;
+		if (buf->chunk == last)
+			held_count++;
+	}
+
+	while (others != NULL) {
+		buf = others;
+		others = buf->skbf_addr;
+		buf->skbf_addr = buf;
+		csp_buffer_pool_put(pool, buf);
+	}
+
+	if (held_count < len) {
+		while (held != NULL) {
+			buf = held;
+			held = buf->skbf_addr;
+			buf->skbf_addr = buf;
+			csp_buffer_pool_put(pool, buf);
+		}
+		return 0;
+	}
+
+	/* A pop that loaded the head before the drain may still read the
+	 * chunk, so its memory is only freed on the next shrink */
+	pool->retired[pool->retired_count++] = pool->chunk[last];
+	pool->chunks = last;
+	__atomic_sub_fetch(&pool->count, len, __ATOMIC_RELAXED);
+	csp_log_buffer("Shrink class %u to %u buffers", (unsigned int) (pool - csp_buffer_pools), pool->count);
+
+	return 1;
+
+}
+
+void csp_buffer_shrink(void) {
+
+	uint32_t now = csp_get_ms();
+
+	if (now - csp_buffer_shrink_time < CSP_BUFFER_SHRINK_INTERVAL)
+		return;
+	csp_buffer_shrink_time = now;
+
+	if (csp_mutex_lock(&csp_buffer_lock, 0) != CSP_MUTEX_OK)
+		return;
+
+	for (unsigned int c = 0; c < csp_buffer_classes_count; c++) {
+		csp_buffer_pool_t * pool = &csp_buffer_pools[c];
+
+		while (pool->retired_count > 0)
+			csp_free(pool->retired[--pool->retired_count]);
+
+		while (csp_buffer_pool_shrink(pool))
+			;
+	}
+
+	csp_mutex_unlock(&csp_buffer_lock);
+
+}
+
+/* Smallest class that fits the request with room for trailers */
+static int csp_buffer_class_for(size_t buf_size) {
+
+	unsigned int top = csp_buffer_classes_count - 1;
+
+	/* SIZE_MAX asks for the largest buffer available */
+	if (buf_size == SIZE_MAX)
+		return top;
+
+	for (unsigned int c = 0; c < top; c++)
+		if (buf_size + CSP_BUFFER_SLACK + CSP_BUFFER_PACKET_OVERHEAD <= csp_buffer_pools[c].size)
+			return c;
+
+	if (buf_size + CSP_BUFFER_PACKET_OVERHEAD <= csp_buffer_pools[top].size)
+		return top;
+
+	return -1;
+
+}
+
+static void csp_buffer_account(csp_buffer_pool_t * pool) {
+	unsigned int used = __atomic_add_fetch(&pool->in_use, 1, __ATOMIC_RELAXED);
+	unsigned int high = __atomic_load_n(&pool->high_water, __ATOMIC_RELAXED);
+	while (used > high && !__atomic_compare_exchange_n(&pool->high_water, &high, used, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/* Take a buffer from the class or, when that runs dry, a larger one */
+static csp_skbf_t * csp_buffer_take(int class, int isr) {
+
+	csp_skbf_t * buffer = NULL;
+
+	for (unsigned int c = class; c < csp_buffer_classes_count; c++) {
+		csp_buffer_pool_t * pool = &csp_buffer_pools[c];
+
+		buffer = isr ? csp_buffer_pop_isr(pool) : csp_buffer_pop(pool);
+		if (buffer == NULL && !isr)
+			buffer = csp_buffer_grow(pool);
+		if (buffer != NULL) {
+			csp_buffer_account(pool);
+			return buffer;
+		}
+	}
+
+	__atomic_add_fetch(&csp_buffer_pools[class].failures, 1, __ATOMIC_RELAXED);
+	return NULL;
 
 }
 
 void *csp_buffer_get_isr(size_t buf_size) {
 
 	csp_skbf_t * buffer = NULL;
-	CSP_BASE_TYPE task_woken = 0;
 
-	if (buf_size + CSP_BUFFER_PACKET_OVERHEAD > size)
+	int class = csp_buffer_class_for(buf_size);
+	if (class < 0)
 		return NULL;
 
-	csp_queue_dequeue_isr(csp_buffers, &buffer, &task_woken);
+	buffer = csp_buffer_take(class, 1);
 	if (buffer == NULL)
 		return NULL;
 
 	if (buffer != buffer->skbf_addr)
 		return NULL;
 
-	buffer->refcount++;
+	csp_buffer_ref_init(buffer);
 	return buffer->skbf_data;
 
 }
@@ -119,12 +537,13 @@ void *csp_buffer_get(size_t buf_size) {
 
 	csp_skbf_t * buffer = NULL;
 
-	if (buf_size + CSP_BUFFER_PACKET_OVERHEAD > size) {
+	int class = csp_buffer_class_for(buf_size);
+	if (class < 0) {
 		csp_log_error("Attempt to allocate too large block %u", buf_size);
 		return NULL;
 	}
 
-	csp_queue_dequeue(csp_buffers, &buffer, 0);
+	buffer = csp_buffer_take(class, 0);
 	if (buffer == NULL) {
 		csp_log_error("Out of buffers");
 		return NULL;
@@ -137,12 +556,11 @@ void *csp_buffer_get(size_t buf_size) {
 		return NULL;
 	}
 
-	buffer->refcount++;
+	csp_buffer_ref_init(buffer);
 	return buffer->skbf_data;
 }
 
 void csp_buffer_free_isr(void *packet) {
-	CSP_BASE_TYPE task_woken = 0;
 	if (!packet)
 		return;
 
@@ -151,17 +569,13 @@ void csp_buffer_free_isr(void *packet) {
 	if (((uintptr_t) buf % CSP_BUFFER_ALIGN) > 0)
 		return;
 
-	if (buf->skbf_addr != buf)
+	if (buf->skbf_addr != buf || buf->class >= csp_buffer_classes_count)
 		return;
 
-	if (buf->refcount == 0) {
-		return;
-	} else if (buf->refcount > 1) {
-		buf->refcount--;
-		return;
-	} else {
-		buf->refcount = 0;
-		csp_queue_enqueue_isr(csp_buffers, &buf, &task_woken);
+	if (csp_buffer_ref_put(buf) == 1) {
+		csp_buffer_pool_t * pool = &csp_buffer_pools[buf->class];
+		__atomic_sub_fetch(&pool->in_use, 1, __ATOMIC_RELAXED);
+		csp_buffer_push_isr(pool, buf);
 	}
 
 }
@@ -179,22 +593,23 @@ void csp_buffer_free(void *packet) {
 		return;
 	}
 
-	if (buf->skbf_addr != buf) {
+	if (buf->skbf_addr != buf || buf->class >= csp_buffer_classes_count) {
 		csp_log_error("FREE: Invalid CSP buffer pointer %p", packet);
 		return;
 	}
 
-	if (buf->refcount == 0) {
+	unsigned int refcount = csp_buffer_ref_put(buf);
+	if (refcount == 0) {
 		csp_log_error("FREE: Buffer already free %p", buf);
 		return;
-	} else if (buf->refcount > 1) {
-		buf->refcount--;
-		csp_log_error("FREE: Buffer %p in use by %u users", buf, buf->refcount);
+	} else if (refcount > 1) {
+		csp_log_error("FREE: Buffer %p in use by %u users", buf, refcount - 1);
 		return;
 	} else {
-		buf->refcount = 0;
+		csp_buffer_pool_t * pool = &csp_buffer_pools[buf->class];
 		csp_log_buffer("FREE: %p", buf);
-		csp_queue_enqueue(csp_buffers, &buf, 0);
+		__atomic_sub_fetch(&pool->in_use, 1, __ATOMIC_RELAXED);
+		csp_buffer_push(pool, buf);
 	}
 
 }
@@ -206,19 +621,50 @@ void *csp_buffer_clone(void *buffer) {
 	if (!packet)
 		return NULL;
 
-	csp_packet_t *clone = csp_buffer_get(packet->length);
+	/* Same class as the original, the clone may grow by the same trailers */
+	csp_skbf_t * buf = buffer - sizeof(csp_skbf_t);
+	if (buf->skbf_addr != buf || buf->class >= csp_buffer_classes_count)
+		return NULL;
+
+	csp_skbf_t * clone = csp_buffer_take(buf->class, 0);
+	if (clone == NULL)
+		return NULL;
 
-	if (clone)
-		memcpy(clone, packet, size);
+	csp_buffer_ref_init(clone);
+	memcpy(clone->skbf_data, packet, csp_buffer_pools[buf->class].size);
 
-	return clone;
+	return clone->skbf_data;
 
 }
 
 int csp_buffer_remaining(void) {
-	return csp_queue_size(csp_buffers);
+	int remaining = 0;
+	for (unsigned int c = 0; c < csp_buffer_classes_count; c++)
+		remaining += csp_buffer_pools[c].max - __atomic_load_n(&csp_buffer_pools[c].in_use, __ATOMIC_RELAXED);
+	return remaining;
 }
 
 int csp_buffer_size(void) {
-	return size;
+	return csp_buffer_pools[csp_buffer_classes_count - 1].size;
+}
+
+int csp_buffer_classes(void) {
+	return csp_buffer_classes_count;
+}
+
+int csp_buffer_stats(int index, csp_buffer_stats_t * stats) {
+
+	if (index < 0 || index >= (int) csp_buffer_classes_count)
+		return CSP_ERR_INVAL;
+
+	csp_buffer_pool_t * pool = &csp_buffer_pools[index];
+	stats->size = pool->size - CSP_BUFFER_PACKET_OVERHEAD;
+	stats->count = __atomic_load_n(&pool->count, __ATOMIC_RELAXED);
+	stats->max = pool->max;
+	stats->in_use = __atomic_load_n(&pool->in_use, __ATOMIC_RELAXED);
+	stats->high_water = __atomic_load_n(&pool->high_water, __ATOMIC_RELAXED);
+	stats->failures = __atomic_load_n(&pool->failures, __ATOMIC_RELAXED);
+
+	return CSP_ERR_NONE;
+
 }
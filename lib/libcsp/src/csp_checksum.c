@@ -0,0 +1,394 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 GomSpace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <csp/csp_checksum.h>
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#define CSP_CHECKSUM_TAB		PROGMEM
+#define TAB32(tab, i)			pgm_read_dword(&(tab)[i])
+#define TAB16(tab, i)			pgm_read_word(&(tab)[i])
+#else
+#define CSP_CHECKSUM_TAB
+#define TAB32(tab, i)			((tab)[i])
+#define TAB16(tab, i)			((tab)[i])
+#endif
+
+#include "csp_checksum_tab.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CSP_CHECKSUM_X86
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+/* Fletcher sums fit 32 bits for this many bytes between reductions */
+#define FLETCHER16_BLOCK		4096
+
+/* Buffer for every length and alignment in csp_checksum_selftest() */
+#define CSP_CHECKSUM_TEST_SIZE	300
+
+typedef uint32_t (*csp_crc32_fn_t)(uint32_t crc, const uint8_t * data, size_t length);
+
+static uint32_t csp_crc32_slice8(const uint32_t tab[8][256], uint32_t crc, const uint8_t * data, size_t length) {
+
+#ifndef __AVR__
+	while (length >= 8) {
+		uint32_t one = crc ^ (data[0] | data[1] << 8 | data[2] << 16 | (uint32_t) data[3] << 24);
+		uint32_t two = data[4] | data[5] << 8 | data[6] << 16 | (uint32_t) data[7] << 24;
+		crc = tab[7][one & 0xFF] ^ tab[6][(one >> 8) & 0xFF] ^ tab[5][(one >> 16) & 0xFF] ^ tab[4][one >> 24]
+			^ tab[3][two & 0xFF] ^ tab[2][(two >> 8) & 0xFF] ^ tab[1][(two >> 16) & 0xFF] ^ tab[0][two >> 24];
+		data += 8;
+		length -= 8;
+	}
+#endif
+
+	while (length--)
+		crc = TAB32(tab[0], (crc ^ *data++) & 0xFF) ^ (crc >> 8);
+
+	return crc;
+
+}
+
+static uint32_t csp_crc32c_sw(uint32_t crc, const uint8_t * data, size_t length) {
+	return csp_crc32_slice8(crc32c_tab, crc, data, length);
+}
+
+static uint32_t csp_crc32_ieee_sw(uint32_t crc, const uint8_t * data, size_t length) {
+	return csp_crc32_slice8(crc32_tab, crc, data, length);
+}
+
+#ifdef CSP_CHECKSUM_X86
+
+__attribute__((target("sse4.2")))
+static uint32_t csp_crc32c_sse42(uint32_t crc, const uint8_t * data, size_t length) {
+
+	uint64_t crc64 = crc;
+
+	while (length >= 8) {
+		uint64_t word;
+		__builtin_memcpy(&word, data, sizeof(word));
+		crc64 = _mm_crc32_u64(crc64, word);
+		data += 8;
+		length -= 8;
+	}
+
+	crc = crc64;
+	while (length--)
+		crc = _mm_crc32_u8(crc, *data++);
+
+	return crc;
+
+}
+
+/* Fold 64 byte blocks with carry-less multiplication, then Barrett reduce.
+ * Constants are x^n mod P in the bit reflected domain, see Intel's "Fast
+ * CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction" */
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t csp_crc32_ieee_pclmul_fold(uint32_t crc, const uint8_t * data, size_t length) {
+
+	const __m128i k1k2 = _mm_set_epi64x(0x01C6E41596, 0x0154442BD4);
+	const __m128i k3k4 = _mm_set_epi64x(0x00CCAA009E, 0x01751997D0);
+	const __m128i k5k0 = _mm_set_epi64x(0, 0x0163CD6124);
+	const __m128i poly = _mm_set_epi64x(0x01F7011641, 0x01DB710641);
+	const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+	__m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+	/* length is a multiple of 16 and at least 64 */
+	x1 = _mm_loadu_si128((const __m128i *) (data + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *) (data + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *) (data + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *) (data + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	data += 64;
+	length -= 64;
+
+	while (length >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *) (data + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *) (data + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *) (data + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *) (data + 0x30)));
+		data += 64;
+		length -= 64;
+	}
+
+	/* Fold the four lanes and any remaining 16 byte blocks into one */
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x4), x5);
+
+	while (length >= 16) {
+		x2 = _mm_loadu_si128((const __m128i *) data);
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x2), x5);
+		data += 16;
+		length -= 16;
+	}
+
+	/* 128 to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask32);
+	x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k5k0, 0x00), x2);
+
+	/* Barrett reduction to 32 bits */
+	x2 = _mm_and_si128(x1, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+	x2 = _mm_and_si128(x2, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return _mm_extract_epi32(x1, 1);
+
+}
+
+static uint32_t csp_crc32_ieee_pclmul(uint32_t crc, const uint8_t * data, size_t length) {
+
+	if (length >= 64) {
+		size_t bulk = length & ~(size_t) 15;
+		crc = csp_crc32_ieee_pclmul_fold(crc, data, bulk);
+		data += bulk;
+		length -= bulk;
+	}
+
+	return csp_crc32_ieee_sw(crc, data, length);
+
+}
+
+#endif // CSP_CHECKSUM_X86
+
+static uint32_t csp_crc32c_select(uint32_t crc, const uint8_t * data, size_t length);
+static uint32_t csp_crc32_ieee_select(uint32_t crc, const uint8_t * data, size_t length);
+
+static csp_crc32_fn_t crc32c_impl = csp_crc32c_select;
+static csp_crc32_fn_t crc32_ieee_impl = csp_crc32_ieee_select;
+
+/* Pick the kernels on first use, every caller stores the same pointers */
+static void csp_checksum_select(void) {
+
+	csp_crc32_fn_t crc32c = csp_crc32c_sw;
+	csp_crc32_fn_t crc32_ieee = csp_crc32_ieee_sw;
+
+#ifdef CSP_CHECKSUM_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2"))
+		crc32c = csp_crc32c_sse42;
+	if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul"))
+		crc32_ieee = csp_crc32_ieee_pclmul;
+#endif
+
+	__atomic_store_n(&crc32c_impl, crc32c, __ATOMIC_RELAXED);
+	__atomic_store_n(&crc32_ieee_impl, crc32_ieee, __ATOMIC_RELAXED);
+
+}
+
+static uint32_t csp_crc32c_select(uint32_t crc, const uint8_t * data, size_t length) {
+	csp_checksum_select();
+	return crc32c_impl(crc, data, length);
+}
+
+static uint32_t csp_crc32_ieee_select(uint32_t crc, const uint8_t * data, size_t length) {
+	csp_checksum_select();
+	return crc32_ieee_impl(crc, data, length);
+}
+
+uint32_t csp_crc32c_update(uint32_t crc, const void * data, size_t length) {
+	return __atomic_load_n(&crc32c_impl, __ATOMIC_RELAXED)(crc, data, length);
+}
+
+uint32_t csp_crc32c(const void * data, size_t length) {
+	return csp_crc32c_update(0xFFFFFFFF, data, length) ^ 0xFFFFFFFF;
+}
+
+uint32_t csp_crc32_ieee_update(uint32_t crc, const void * data, size_t length) {
+	return __atomic_load_n(&crc32_ieee_impl, __ATOMIC_RELAXED)(crc, data, length);
+}
+
+uint32_t csp_crc32_ieee(const void * data, size_t length) {
+	return csp_crc32_ieee_update(0xFFFFFFFF, data, length) ^ 0xFFFFFFFF;
+}
+
+uint16_t csp_crc16_update(uint16_t crc, const void * data, size_t length) {
+
+	const uint8_t * p = data;
+
+#ifndef __AVR__
+	while (length >= 8) {
+		crc = crc16_tab[7][p[0] ^ (crc >> 8)] ^ crc16_tab[6][p[1] ^ (crc & 0xFF)]
+			^ crc16_tab[5][p[2]] ^ crc16_tab[4][p[3]] ^ crc16_tab[3][p[4]]
+			^ crc16_tab[2][p[5]] ^ crc16_tab[1][p[6]] ^ crc16_tab[0][p[7]];
+		p += 8;
+		length -= 8;
+	}
+#endif
+
+	while (length--)
+		crc = (crc << 8) ^ TAB16(crc16_tab[0], (crc >> 8) ^ *p++);
+
+	return crc;
+
+}
+
+uint16_t csp_crc16(const void * data, size_t length) {
+	return csp_crc16_update(0xFFFF, data, length);
+}
+
+uint16_t csp_fletcher16(const void * data, size_t length) {
+
+	const uint8_t * p = data;
+	uint32_t sum1 = 0, sum2 = 0;
+
+	/* Reduce once per block instead of once per byte, same result */
+	while (length) {
+		size_t block = (length < FLETCHER16_BLOCK) ? length : FLETCHER16_BLOCK;
+		length -= block;
+		while (block--) {
+			sum1 += *p++;
+			sum2 += sum1;
+		}
+		sum1 %= 255;
+		sum2 %= 255;
+	}
+
+	return (sum2 << 8) | sum1;
+
+}
+
+/* Bitwise references for csp_checksum_selftest() */
+static uint32_t csp_crc32_bitwise(uint32_t poly, uint32_t crc, const uint8_t * data, size_t length) {
+
+	while (length--) {
+		crc ^= *data++;
+		for (int i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (poly & -(crc & 1));
+	}
+
+	return crc;
+
+}
+
+static uint16_t csp_crc16_bitwise(uint16_t crc, const uint8_t * data, size_t length) {
+
+	while (length--) {
+		crc ^= *data++ << 8;
+		for (int i = 0; i < 8; i++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+
+	return crc;
+
+}
+
+static uint16_t csp_fletcher16_bytewise(const uint8_t * data, size_t length) {
+
+	uint16_t sum1 = 0, sum2 = 0;
+
+	while (length--) {
+		sum1 = (sum1 + *data++) % 255;
+		sum2 = (sum2 + sum1) % 255;
+	}
+
+	return (sum2 << 8) | sum1;
+
+}
+
+/* Check value, then every length and alignment of buf, then one long run */
+static int csp_crc32_kernel_check(csp_crc32_fn_t fn, uint32_t poly, uint32_t check,
+		const uint8_t * buf, size_t size, const uint8_t * run, size_t run_length) {
+
+	if ((fn(0xFFFFFFFF, (const uint8_t *) "123456789", 9) ^ 0xFFFFFFFF) != check)
+		return -1;
+
+	for (size_t offset = 0; offset < 16; offset++)
+		for (size_t length = 0; offset + length <= size; length++)
+			if (fn(0xFFFFFFFF, buf + offset, length) != csp_crc32_bitwise(poly, 0xFFFFFFFF, buf + offset, length))
+				return -1;
+
+	if (fn(0xFFFFFFFF, run, run_length) != csp_crc32_bitwise(poly, 0xFFFFFFFF, run, run_length))
+		return -1;
+
+	return 0;
+
+}
+
+int csp_checksum_selftest(void) {
+
+	uint8_t buf[CSP_CHECKSUM_TEST_SIZE];
+	uint32_t seed = 1;
+	int ret = 0;
+
+	for (size_t i = 0; i < sizeof(buf); i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+
+	/* The tables make a long input that crosses the Fletcher reduction block */
+	const uint8_t * run = (const uint8_t *) crc32c_tab;
+	size_t run_length = sizeof(crc32c_tab) + 1;
+
+	ret |= csp_crc32_kernel_check(csp_crc32c_sw, 0x82F63B78, 0xE3069283, buf, sizeof(buf), run, run_length);
+	ret |= csp_crc32_kernel_check(csp_crc32_ieee_sw, 0xEDB88320, 0xCBF43926, buf, sizeof(buf), run, run_length);
+
+#ifdef CSP_CHECKSUM_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2"))
+		ret |= csp_crc32_kernel_check(csp_crc32c_sse42, 0x82F63B78, 0xE3069283, buf, sizeof(buf), run, run_length);
+	if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul"))
+		ret |= csp_crc32_kernel_check(csp_crc32_ieee_pclmul, 0xEDB88320, 0xCBF43926, buf, sizeof(buf), run, run_length);
+#endif
+
+	/* The dispatched entry points as well */
+	if (csp_crc32c("123456789", 9) != 0xE3069283 || csp_crc32_ieee("123456789", 9) != 0xCBF43926)
+		ret = -1;
+
+	if (csp_crc16("123456789", 9) != 0x29B1 || csp_fletcher16("abcde", 5) != 0xC8F0)
+		ret = -1;
+
+	for (size_t offset = 0; offset < 16; offset++) {
+		for (size_t length = 0; offset + length <= sizeof(buf); length++) {
+			if (csp_crc16_update(0xFFFF, buf + offset, length) != csp_crc16_bitwise(0xFFFF, buf + offset, length))
+				ret = -1;
+			if (csp_fletcher16(buf + offset, length) != csp_fletcher16_bytewise(buf + offset, length))
+				ret = -1;
+		}
+	}
+
+	if (csp_crc16(run, run_length) != csp_crc16_bitwise(0xFFFF, run, run_length)
+			|| csp_fletcher16(run, run_length) != csp_fletcher16_bytewise(run, run_length))
+		ret = -1;
+
+	return ret ? -1 : 0;
+
+}
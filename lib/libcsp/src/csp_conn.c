@@ -19,6 +19,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
 #include <stdlib.h>
+#include <assert.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
@@ -42,22 +43,157 @@ static csp_conn_t arr_conn[CSP_CONN_MAX];
 /* Connection pool lock */
 static csp_bin_sem_handle_t conn_lock;
 
+/* Client connections are indexed by the masked incoming identifier in an
+ * open addressing table with linear probing. Slots hold the pool index + 1,
+ * 0 is empty. The table is only written with conn_lock held, lookups are
+ * lock free and retry if conn_hash_seq changed while probing. */
+#if CSP_CONN_MAX > 2048
+#error "CSP_CONN_MAX too large for the connection table"
+#elif CSP_CONN_MAX > 512
+#define CSP_CONN_HASH_SIZE	4096
+#elif CSP_CONN_MAX > 128
+#define CSP_CONN_HASH_SIZE	1024
+#elif CSP_CONN_MAX > 32
+#define CSP_CONN_HASH_SIZE	256
+#elif CSP_CONN_MAX > 8
+#define CSP_CONN_HASH_SIZE	64
+#else
+#define CSP_CONN_HASH_SIZE	16
+#endif
+
+static uint16_t conn_hash[CSP_CONN_HASH_SIZE];
+static uint32_t conn_hash_seq;
+
+/* Free connections in the order they were closed, so the least recently
+ * used one is given out first. Protected by conn_lock */
+static uint16_t conn_free[CSP_CONN_MAX];
+static unsigned int conn_free_head;
+static unsigned int conn_free_count;
+
 /* Source port */
 static uint8_t sport;
 
 /* Source port lock */
 static csp_bin_sem_handle_t sport_lock;
 
-void csp_conn_check_timeouts(void) {
+void csp_conn_check_timeouts(int worker) {
 #ifdef CSP_USE_RDP
-	int i;
-	for (i = 0; i < CSP_CONN_MAX; i++)
-		if (arr_conn[i].state == CONN_OPEN)
-			if (arr_conn[i].idin.flags & CSP_FRDP)
-				csp_rdp_check_timeouts(&arr_conn[i]);
+	/* Each worker has the timers of the connections it receives for */
+	csp_rdp_check_timers(worker);
 #endif
 }
 
+static inline unsigned int csp_conn_hash_slot(uint32_t id) {
+
+	uint32_t key = id & CSP_ID_CONN_MASK;
+	key ^= key >> 16;
+	key *= 0x45d9f3b;
+	key ^= key >> 16;
+	return key & (CSP_CONN_HASH_SIZE - 1);
+
+}
+
+static inline void csp_conn_hash_write_begin(void) {
+
+	__atomic_store_n(&conn_hash_seq, conn_hash_seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+}
+
+static inline void csp_conn_hash_write_end(void) {
+
+	__atomic_store_n(&conn_hash_seq, conn_hash_seq + 1, __ATOMIC_RELEASE);
+
+}
+
+/* Called with conn_lock held, after idin is set */
+static void csp_conn_hash_insert(csp_conn_t * conn) {
+
+	unsigned int slot = csp_conn_hash_slot(conn->idin.ext);
+
+	while (conn_hash[slot] != 0)
+		slot = (slot + 1) & (CSP_CONN_HASH_SIZE - 1);
+
+	csp_conn_hash_write_begin();
+	__atomic_store_n(&conn_hash[slot], (uint16_t) (conn - arr_conn + 1), __ATOMIC_RELAXED);
+	csp_conn_hash_write_end();
+
+}
+
+/* Called with conn_lock held. Later entries of the probe sequence are
+ * shifted back into the hole, so lookups never need tombstones */
+static void csp_conn_hash_remove(csp_conn_t * conn) {
+
+	uint16_t entry = conn - arr_conn + 1;
+	unsigned int hole = csp_conn_hash_slot(conn->idin.ext);
+
+	while (conn_hash[hole] != entry) {
+		if (conn_hash[hole] == 0)
+			return;
+		hole = (hole + 1) & (CSP_CONN_HASH_SIZE - 1);
+	}
+
+	csp_conn_hash_write_begin();
+
+	unsigned int next = hole;
+	while (1) {
+		next = (next + 1) & (CSP_CONN_HASH_SIZE - 1);
+		if (conn_hash[next] == 0)
+			break;
+		unsigned int home = csp_conn_hash_slot(arr_conn[conn_hash[next] - 1].idin.ext);
+		/* Move the entry unless its home lies cyclically in (hole, next] */
+		if (((next - home) & (CSP_CONN_HASH_SIZE - 1)) >= ((next - hole) & (CSP_CONN_HASH_SIZE - 1))) {
+			__atomic_store_n(&conn_hash[hole], conn_hash[next], __ATOMIC_RELAXED);
+			hole = next;
+		}
+	}
+	__atomic_store_n(&conn_hash[hole], 0, __ATOMIC_RELAXED);
+
+	csp_conn_hash_write_end();
+
+}
+
+/* Called with conn_lock held */
+static void csp_conn_free_push(csp_conn_t * conn) {
+
+	assert(conn_free_count < CSP_CONN_MAX);
+	conn_free[(conn_free_head + conn_free_count) % CSP_CONN_MAX] = conn - arr_conn;
+	conn_free_count++;
+
+}
+
+static csp_conn_t * csp_conn_hash_find(uint32_t id) {
+
+	csp_conn_t * conn;
+	uint32_t seq;
+
+	do {
+		seq = __atomic_load_n(&conn_hash_seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+
+		conn = NULL;
+		unsigned int slot = csp_conn_hash_slot(id);
+		unsigned int probes;
+		for (probes = 0; probes < CSP_CONN_HASH_SIZE; probes++) {
+			uint16_t entry = __atomic_load_n(&conn_hash[slot], __ATOMIC_RELAXED);
+			if (entry == 0)
+				break;
+			csp_conn_t * candidate = &arr_conn[entry - 1];
+			if ((candidate->idin.ext & CSP_ID_CONN_MASK) == (id & CSP_ID_CONN_MASK)) {
+				conn = candidate;
+				break;
+			}
+			slot = (slot + 1) & (CSP_CONN_HASH_SIZE - 1);
+		}
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || __atomic_load_n(&conn_hash_seq, __ATOMIC_RELAXED) != seq);
+
+	return conn;
+
+}
+
 int csp_conn_get_rxq(int prio) {
 
 #ifdef CSP_USE_QOS
@@ -124,8 +260,16 @@ int csp_conn_init(void) {
 		return CSP_ERR_NOMEM;
 	}
 
+#ifdef CSP_USE_RDP
+	if (csp_rdp_init() != CSP_ERR_NONE) {
+		csp_log_error("Failed to create RDP timers");
+		return CSP_ERR_NOMEM;
+	}
+#endif
+
 	int i, prio;
 	for (i = 0; i < CSP_CONN_MAX; i++) {
+		conn_free[i] = i;
 		for (prio = 0; prio < CSP_RX_QUEUES; prio++)
 			arr_conn[i].rx_queue[prio] = csp_queue_create(CSP_RX_QUEUE_LENGTH, sizeof(csp_packet_t *));
 
@@ -146,6 +290,8 @@ int csp_conn_init(void) {
 		}
 #endif
 	}
+	conn_free_head = 0;
+	conn_free_count = CSP_CONN_MAX;
 
 	if (csp_bin_sem_create(&conn_lock) != CSP_SEMAPHORE_OK) {
 		csp_log_error("No more memory for conn semaphore");
@@ -162,6 +308,13 @@ csp_conn_t * csp_conn_find(uint32_t id, uint32_t mask) {
 	int i;
 	csp_conn_t * conn;
 
+	if (mask == CSP_ID_CONN_MASK) {
+		conn = csp_conn_hash_find(id);
+		if (conn && (conn->state != CONN_CLOSED) && (conn->type == CONN_CLIENT))
+			return conn;
+		return NULL;
+	}
+
 	for (i = 0; i < CSP_CONN_MAX; i++) {
 		conn = &arr_conn[i];
 		if ((conn->state != CONN_CLOSED) && (conn->type == CONN_CLIENT) && (conn->idin.ext & mask) == (id & mask))
@@ -197,8 +350,6 @@ int csp_conn_flush_rx_queue(csp_conn_t * conn) {
 
 csp_conn_t * csp_conn_allocate(csp_conn_type_t type) {
 
-	int i, j;
-	static uint8_t csp_conn_last_given = 0;
 	csp_conn_t * conn;
 
 	if (csp_bin_sem_wait(&conn_lock, 100) != CSP_SEMAPHORE_OK) {
@@ -206,27 +357,20 @@ csp_conn_t * csp_conn_allocate(csp_conn_type_t type) {
 		return NULL;
 	}
 
-	/* Search for free connection */
-	i = csp_conn_last_given;
-	i = (i + 1) % CSP_CONN_MAX;
-
-	for (j = 0; j < CSP_CONN_MAX; j++) {
-		conn = &arr_conn[i];
-		if (conn->state == CONN_CLOSED)
-			break;
-		i = (i + 1) % CSP_CONN_MAX;
-	}
-
-	if (conn->state == CONN_OPEN) {
+	/* Take the connection that has been closed the longest */
+	if (conn_free_count == 0) {
 		csp_log_error("No more free connections");
 		csp_bin_sem_post(&conn_lock);
 		return NULL;
 	}
 
+	conn = &arr_conn[conn_free[conn_free_head]];
+	conn_free_head = (conn_free_head + 1) % CSP_CONN_MAX;
+	conn_free_count--;
+
 	conn->state = CONN_OPEN;
 	conn->socket = NULL;
 	conn->type = type;
-	csp_conn_last_given = i;
 	csp_bin_sem_post(&conn_lock);
 
 	return conn;
@@ -247,6 +391,12 @@ csp_conn_t * csp_conn_new(csp_id_t idin, csp_id_t idout) {
 
 		/* Ensure connection queue is empty */
 		csp_conn_flush_rx_queue(conn);
+
+		/* Make the connection visible to incoming packets. The
+		 * connection is already taken, so wait rather than leak it */
+		csp_bin_sem_wait(&conn_lock, CSP_MAX_DELAY);
+		csp_conn_hash_insert(conn);
+		csp_bin_sem_post(&conn_lock);
 	}
 
 	return conn;
@@ -278,8 +428,19 @@ int csp_close(csp_conn_t * conn) {
 		return CSP_ERR_TIMEDOUT;
 	}
 
+	/* Another task may have closed it while we waited for the lock, the
+	 * slot must only go back on the free list once */
+	if (conn->state == CONN_CLOSED) {
+		csp_bin_sem_post(&conn_lock);
+		csp_log_protocol("Conn already closed");
+		return CSP_ERR_NONE;
+	}
+
 	/* Set to closed */
 	conn->state = CONN_CLOSED;
+	if (conn->type == CONN_CLIENT)
+		csp_conn_hash_remove(conn);
+	csp_conn_free_push(conn);
 
 	/* Ensure connection queue is empty */
 	csp_conn_flush_rx_queue(conn);
@@ -32,6 +32,8 @@ extern "C" {
 #include <csp/arch/csp_queue.h>
 #include <csp/arch/csp_semaphore.h>
 
+#include "csp_timer.h"
+
 /** @brief Connection states */
 typedef enum {
 	CONN_CLOSED = 0,
@@ -52,6 +54,21 @@ typedef enum {
 	RDP_CLOSE_WAIT,
 } csp_rdp_state_t;
 
+/** Out of order segments are kept at seq_nr % CSP_RDP_RX_RING. A power of
+ * two at least twice the largest window, so the index survives the 16 bit
+ * sequence number wrapping, and at least the 32 bits of one rx_map word */
+#if CSP_RDP_MAX_WINDOW <= 16
+#define CSP_RDP_RX_RING 32
+#elif CSP_RDP_MAX_WINDOW <= 32
+#define CSP_RDP_RX_RING 64
+#elif CSP_RDP_MAX_WINDOW <= 64
+#define CSP_RDP_RX_RING 128
+#elif CSP_RDP_MAX_WINDOW <= 128
+#define CSP_RDP_RX_RING 256
+#else
+#error "CSP_RDP_MAX_WINDOW too large for the RDP receive ring"
+#endif
+
 /** @brief RDP Connection header
  *  @note Do not try to pack this struct, the posix sem handle will stop working */
 typedef struct {
@@ -69,9 +86,20 @@ typedef struct {
 	uint32_t ack_timeout;
 	uint32_t ack_delay_count;
 	uint32_t ack_timestamp;
+	uint32_t rto;			/**< Retransmission timeout, from srtt and rttvar */
+	uint32_t srtt;			/**< Smoothed round trip time, 0 before the first sample */
+	uint32_t rttvar;		/**< Round trip time variation */
+	uint32_t rtt_timestamp;		/**< Time rtt_seq was sent */
+	uint16_t rtt_seq;		/**< Segment being timed */
+	uint8_t rtt_timing;		/**< rtt_seq is being timed */
+	uint16_t recover;		/**< snd_nxt at the last window reduction */
+	uint32_t cwnd;			/**< Segments allowed in flight, at most window_size */
+	uint32_t cwnd_acked;		/**< Segments acknowledged towards growing cwnd */
 	csp_bin_sem_handle_t tx_wait;
 	csp_queue_handle_t tx_queue;
-	csp_queue_handle_t rx_queue;
+	csp_packet_t * rx_ring[CSP_RDP_RX_RING];	/**< Out of order segments */
+	uint32_t rx_map[CSP_RDP_RX_RING / 32];	/**< Occupied slots of rx_ring */
+	csp_timer_t timer;		/**< Due at the earliest pending timeout */
 } csp_rdp_t;
 
 /** @brief Connection struct */
@@ -100,7 +128,7 @@ int csp_conn_init(void);
 csp_conn_t * csp_conn_allocate(csp_conn_type_t type);
 csp_conn_t * csp_conn_find(uint32_t id, uint32_t mask);
 csp_conn_t * csp_conn_new(csp_id_t idin, csp_id_t idout);
-void csp_conn_check_timeouts(void);
+void csp_conn_check_timeouts(int worker);
 int csp_conn_get_rxq(int prio);
 
 #ifdef __cplusplus
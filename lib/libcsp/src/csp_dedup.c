@@ -21,44 +21,257 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <stdlib.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 #include <inttypes.h>
 
 #include <csp/csp.h>
 #include <csp/arch/csp_time.h>
-#include <csp/csp_crc32.h>
+#include <csp/arch/csp_semaphore.h>
+#include <csp/csp_diversity.h>
 
-/* Check the last CSP_DEDUP_COUNT packets for duplicates */
-#define CSP_DEDUP_COUNT		16
+#include "csp_dedup.h"
+
+/* Remember up to CSP_DEDUP_COUNT packets */
+#ifndef CSP_DEDUP_COUNT
+#define CSP_DEDUP_COUNT		64
+#endif
 
 /* Only consider packet a duplicate if received under CSP_DEDUP_WINDOW_MS ago */
+#ifndef CSP_DEDUP_WINDOW_MS
 #define CSP_DEDUP_WINDOW_MS	1000
+#endif
+
+/* Open addressing table of ring index + 1, 0 is empty. At most half full */
+#if CSP_DEDUP_COUNT > 8192
+#error CSP_DEDUP_COUNT too large
+#elif CSP_DEDUP_COUNT > 2048
+#define CSP_DEDUP_HASH_SIZE	16384
+#elif CSP_DEDUP_COUNT > 512
+#define CSP_DEDUP_HASH_SIZE	4096
+#elif CSP_DEDUP_COUNT > 128
+#define CSP_DEDUP_HASH_SIZE	1024
+#elif CSP_DEDUP_COUNT > 32
+#define CSP_DEDUP_HASH_SIZE	256
+#else
+#define CSP_DEDUP_HASH_SIZE	64
+#endif
+
+typedef struct {
+	uint64_t hash;
+	uint32_t timestamp;
+	uint8_t sources;	/* Diversity receivers that delivered a copy */
+} csp_dedup_entry_t;
+
+/* Packets in arrival order, so the oldest is always at the head */
+static csp_dedup_entry_t dedup_ring[CSP_DEDUP_COUNT];
+static unsigned int dedup_head;
+static unsigned int dedup_count;
+
+static uint16_t dedup_hash[CSP_DEDUP_HASH_SIZE];
+
+/* Diversity receivers, the bit of a source in an entry is 1 << index */
+static csp_diversity_stats_t dedup_sources[CSP_DIVERSITY_SOURCES];
+static int dedup_source_count;
+
+/* Router workers check packets concurrently */
+static csp_bin_sem_handle_t dedup_lock;
+
+/* Hash of header and payload, a word at a time */
+static uint64_t csp_dedup_packet_hash(const csp_packet_t * packet) {
+
+	const uint8_t * p = (const uint8_t *) &packet->id;
+	size_t length = packet->length + sizeof(packet->id);
+	uint64_t h = 0x9E3779B97F4A7C15ULL ^ length;
+	uint64_t word;
+
+	while (length >= sizeof(word)) {
+		memcpy(&word, p, sizeof(word));
+		h = (h ^ word) * 0xFF51AFD7ED558CCDULL;
+		h ^= h >> 32;
+		p += sizeof(word);
+		length -= sizeof(word);
+	}
+	word = 0;
+	memcpy(&word, p, length);
+	h = (h ^ word) * 0xFF51AFD7ED558CCDULL;
+
+	h ^= h >> 29;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 32;
+	return h;
+
+}
+
+static inline unsigned int csp_dedup_slot(uint64_t hash) {
+	return hash & (CSP_DEDUP_HASH_SIZE - 1);
+}
+
+/* Called with dedup_lock held */
+static csp_dedup_entry_t * csp_dedup_find(uint64_t hash) {
 
-/* Store packet CRC's in a ringbuffer */
-static uint32_t csp_dedup_array[CSP_DEDUP_COUNT] = {};
-static uint32_t csp_dedup_timestamp[CSP_DEDUP_COUNT] = {};
-static int csp_dedup_in = 0;
+	for (unsigned int slot = csp_dedup_slot(hash); dedup_hash[slot] != 0; slot = (slot + 1) & (CSP_DEDUP_HASH_SIZE - 1))
+		if (dedup_ring[dedup_hash[slot] - 1].hash == hash)
+			return &dedup_ring[dedup_hash[slot] - 1];
+
+	return NULL;
+
+}
+
+/* Called with dedup_lock held. Returns the source bit of the interface, 0 if
+ * it is not a diversity receiver */
+static uint8_t csp_dedup_source(csp_iface_t * interface) {
+
+	for (int i = 0; i < dedup_source_count; i++)
+		if (dedup_sources[i].interface == interface)
+			return 1 << i;
+
+	return 0;
+
+}
+
+/* Called with dedup_lock held */
+static void csp_dedup_push(uint64_t hash, uint32_t now, uint8_t source) {
+
+	unsigned int index = (dedup_head + dedup_count) % CSP_DEDUP_COUNT;
+	dedup_ring[index].hash = hash;
+	dedup_ring[index].timestamp = now;
+	dedup_ring[index].sources = source;
+	dedup_count++;
+
+	unsigned int slot = csp_dedup_slot(hash);
+	while (dedup_hash[slot] != 0)
+		slot = (slot + 1) & (CSP_DEDUP_HASH_SIZE - 1);
+	dedup_hash[slot] = index + 1;
+
+}
+
+/* Called with dedup_lock held. Drop the oldest packet, later entries of its
+ * probe sequence are shifted back into the hole */
+static void csp_dedup_pop(void) {
+
+	uint16_t entry = dedup_head + 1;
+	unsigned int hole = csp_dedup_slot(dedup_ring[dedup_head].hash);
+
+	/* The packet is final now, receivers without a copy missed it */
+	uint8_t sources = dedup_ring[dedup_head].sources;
+	if (sources) {
+		for (int i = 0; i < dedup_source_count; i++)
+			if (!(sources & (1 << i)))
+				dedup_sources[i].missed++;
+	}
 
-bool csp_dedup_is_duplicate(csp_packet_t *packet)
+	dedup_head = (dedup_head + 1) % CSP_DEDUP_COUNT;
+	dedup_count--;
+
+	while (dedup_hash[hole] != entry)
+		hole = (hole + 1) & (CSP_DEDUP_HASH_SIZE - 1);
+
+	unsigned int next = hole;
+	while (1) {
+		next = (next + 1) & (CSP_DEDUP_HASH_SIZE - 1);
+		if (dedup_hash[next] == 0)
+			break;
+		unsigned int home = csp_dedup_slot(dedup_ring[dedup_hash[next] - 1].hash);
+		/* Move the entry unless its home lies cyclically in (hole, next] */
+		if (((next - home) & (CSP_DEDUP_HASH_SIZE - 1)) >= ((next - hole) & (CSP_DEDUP_HASH_SIZE - 1))) {
+			dedup_hash[hole] = dedup_hash[next];
+			hole = next;
+		}
+	}
+	dedup_hash[hole] = 0;
+
+}
+
+int csp_dedup_init(void) {
+
+	if (csp_bin_sem_create(&dedup_lock) != CSP_SEMAPHORE_OK)
+		return CSP_ERR_NOMEM;
+
+	return CSP_ERR_NONE;
+
+}
+
+bool csp_dedup_is_duplicate(csp_packet_t *packet, csp_iface_t *interface)
 {
-	/* Calculate CRC32 for packet */
-	uint32_t crc = csp_crc32_memory((const uint8_t *) &packet->id, packet->length + sizeof(packet->id));
+	/* Only copies of one downlink arriving through several receivers are
+	 * dropped. Other traffic, and everything with a single receiver, may
+	 * legitimately repeat e.g. a poll with an unchanged reply */
+	if (__atomic_load_n(&dedup_source_count, __ATOMIC_RELAXED) < 2)
+		return false;
+
+	uint64_t hash = csp_dedup_packet_hash(packet);
 
-	/* Check if we have received this packet before */
-	for (int i = 0; i < CSP_DEDUP_COUNT; i++) {
+	csp_bin_sem_wait(&dedup_lock, CSP_MAX_DELAY);
 
-		/* Check for match */
-		if (crc == csp_dedup_array[i]) {
+	uint8_t source = csp_dedup_source(interface);
+	if (source == 0) {
+		csp_bin_sem_post(&dedup_lock);
+		return false;
+	}
+
+	/* Expire from the oldest end */
+	uint32_t now = csp_get_ms();
+	while (dedup_count > 0 && now - dedup_ring[dedup_head].timestamp >= CSP_DEDUP_WINDOW_MS)
+		csp_dedup_pop();
+
+	csp_dedup_entry_t * entry = csp_dedup_find(hash);
+	if (entry == NULL) {
+		/* Full, forget the oldest packet before its window is over */
+		if (dedup_count == CSP_DEDUP_COUNT)
+			csp_dedup_pop();
+		csp_dedup_push(hash, now, source);
+		dedup_sources[__builtin_ctz(source)].first++;
+	} else if (!(entry->sources & source)) {
+		/* First copy through this receiver, another one was faster */
+		entry->sources |= source;
+		dedup_sources[__builtin_ctz(source)].late++;
+		dedup_sources[__builtin_ctz(source)].late_ms += now - entry->timestamp;
+	}
 
-			/* Check the timestamp */
-			if (csp_get_ms() < csp_dedup_timestamp[i] + CSP_DEDUP_WINDOW_MS)
-				return true;
+	csp_bin_sem_post(&dedup_lock);
+
+	return entry != NULL;
+}
+
+int csp_diversity_add(csp_iface_t * interface) {
+
+	int ret = CSP_ERR_NONE;
+
+	csp_bin_sem_wait(&dedup_lock, CSP_MAX_DELAY);
+	if (csp_dedup_source(interface) == 0) {
+		if (dedup_source_count < CSP_DIVERSITY_SOURCES) {
+			dedup_sources[dedup_source_count].interface = interface;
+			__atomic_store_n(&dedup_source_count, dedup_source_count + 1, __ATOMIC_RELAXED);
+		} else {
+			ret = CSP_ERR_NOMEM;
 		}
 	}
+	csp_bin_sem_post(&dedup_lock);
+
+	return ret;
+
+}
 
-	/* If not, insert packet into duplicate list */
-	csp_dedup_array[csp_dedup_in] = crc;
-	csp_dedup_timestamp[csp_dedup_in] = csp_get_ms();
-	csp_dedup_in = (csp_dedup_in + 1) % CSP_DEDUP_COUNT;
+int csp_diversity_stats(csp_diversity_stats_t * stats, int max) {
+
+	csp_bin_sem_wait(&dedup_lock, CSP_MAX_DELAY);
+	int count = (dedup_source_count < max) ? dedup_source_count : max;
+	memcpy(stats, dedup_sources, count * sizeof(*stats));
+	csp_bin_sem_post(&dedup_lock);
+
+	return count;
+
+}
+
+void csp_diversity_print(void) {
+
+	csp_diversity_stats_t stats[CSP_DIVERSITY_SOURCES];
+	int count = csp_diversity_stats(stats, CSP_DIVERSITY_SOURCES);
+
+	for (int i = 0; i < count; i++) {
+		printf("%-8s first: %05"PRIu32" late: %05"PRIu32" (avg %"PRIu32" ms) missed: %05"PRIu32"\r\n",
+				stats[i].interface->name, stats[i].first, stats[i].late,
+				stats[i].late ? stats[i].late_ms / stats[i].late : 0, stats[i].missed);
+	}
 
-	return false;
 }
@@ -22,10 +22,18 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #define CSP_DEDUP_H_
 
 /**
- * Check for a duplicate packet
+ * Setup the deduplicator
+ * @return CSP_ERR_NONE on success, otherwise an error code
+ */
+int csp_dedup_init(void);
+
+/**
+ * Check for a duplicate packet. Only packets received on a registered
+ * diversity source are checked, and only while two or more are registered.
  * @param packet pointer to packet
+ * @param interface interface the packet arrived on
  * @return false if not a duplicate, true if duplicate
  */
-bool csp_dedup_is_duplicate(csp_packet_t *packet);
+bool csp_dedup_is_duplicate(csp_packet_t *packet, csp_iface_t *interface);
 
 #endif /* CSP_DEDUP_H_ */
@@ -46,6 +46,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include "csp_route.h"
 #include "csp_promisc.h"
 #include "csp_qfifo.h"
+#include "csp_dedup.h"
 #include "transport/csp_transport.h"
 
 /** CSP address of this node */
@@ -119,6 +120,12 @@ int csp_init(unsigned char address) {
 	if (ret != CSP_ERR_NONE)
 		return ret;
 
+#ifdef CSP_USE_DEDUP
+	ret = csp_dedup_init();
+	if (ret != CSP_ERR_NONE)
+		return ret;
+#endif
+
 	/* Loopback */
 	csp_iflist_add(&csp_if_lo);
 
@@ -20,63 +20,161 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <csp/csp.h>
 #include <csp/arch/csp_queue.h>
+#include <csp/arch/csp_semaphore.h>
 #include "csp_qfifo.h"
 
-static csp_queue_handle_t qfifo[CSP_ROUTE_FIFOS];
+/* Router input of one worker */
+typedef struct {
+	csp_queue_handle_t qfifo[CSP_ROUTE_FIFOS];
 #ifdef CSP_USE_QOS
-static csp_queue_handle_t qfifo_events;
+	/* Bit n set when qfifo[n] may hold packets. The rings are the truth, a
+	 * reader clears a bit only after finding its ring empty */
+	uint32_t pending;
+	/* Readers sleeping on wakeup, writers post only when there are any */
+	uint32_t sleepers;
+	csp_bin_sem_handle_t wakeup;
 #endif
+} csp_qfifo_shard_t;
 
-int csp_qfifo_init(void) {
+static csp_qfifo_shard_t qfifo_shards[CSP_ROUTE_WORKERS_MAX];
+static int qfifo_shard_count = 0;
+
+static int csp_qfifo_shard_init(csp_qfifo_shard_t * shard) {
 	int prio;
 
 	/* Create router fifos for each priority */
 	for (prio = 0; prio < CSP_ROUTE_FIFOS; prio++) {
-		if (qfifo[prio] == NULL) {
-			qfifo[prio] = csp_queue_create(CSP_FIFO_INPUT, sizeof(csp_qfifo_t));
-			if (!qfifo[prio])
+		if (shard->qfifo[prio] == NULL) {
+			shard->qfifo[prio] = csp_queue_create(CSP_FIFO_INPUT, sizeof(csp_qfifo_t));
+			if (!shard->qfifo[prio])
 				return CSP_ERR_NOMEM;
 		}
 	}
 
 #ifdef CSP_USE_QOS
-	/* Create QoS fifo notification queue */
-	qfifo_events = csp_queue_create(CSP_FIFO_INPUT, sizeof(int));
-	if (!qfifo_events)
+	/* Create QoS reader wakeup */
+	if (csp_bin_sem_create(&shard->wakeup) != CSP_SEMAPHORE_OK)
 		return CSP_ERR_NOMEM;
+	/* Created available, take it so the first read sleeps */
+	csp_bin_sem_wait(&shard->wakeup, 0);
 #endif
 
 	return CSP_ERR_NONE;
 
 }
 
-int csp_qfifo_read(csp_qfifo_t * input) {
+int csp_qfifo_init(void) {
+
+	if (qfifo_shard_count > 0)
+		return CSP_ERR_NONE;
+
+	if (csp_qfifo_shard_init(&qfifo_shards[0]) != CSP_ERR_NONE)
+		return CSP_ERR_NOMEM;
+	qfifo_shard_count = 1;
+
+	return CSP_ERR_NONE;
+
+}
+
+int csp_qfifo_set_shards(int count) {
+
+	if (count < 1 || count > CSP_ROUTE_WORKERS_MAX)
+		return CSP_ERR_INVAL;
+
+	for (int i = qfifo_shard_count; i < count; i++)
+		if (csp_qfifo_shard_init(&qfifo_shards[i]) != CSP_ERR_NONE)
+			return CSP_ERR_NOMEM;
+
+	__atomic_store_n(&qfifo_shard_count, count, __ATOMIC_RELEASE);
+
+	return CSP_ERR_NONE;
+
+}
+
+int csp_qfifo_shard(uint32_t id) {
+
+	int count = __atomic_load_n(&qfifo_shard_count, __ATOMIC_ACQUIRE);
+	if (count <= 1)
+		return 0;
+
+	/* Mix the connection tuple, neighbouring ports should spread */
+	uint32_t key = id & CSP_ID_CONN_MASK;
+	key ^= key >> 16;
+	key *= 0x45d9f3b;
+	key ^= key >> 16;
+
+	return key % count;
+
+}
 
 #ifdef CSP_USE_QOS
-	int prio, found, event;
+/* Take the packet with the highest priority, without waiting */
+static int csp_qfifo_take(csp_qfifo_shard_t * shard, csp_qfifo_t * input) {
 
-	/* Wait for packet in any queue */
-	if (csp_queue_dequeue(qfifo_events, &event, FIFO_TIMEOUT) != CSP_QUEUE_OK)
-		return CSP_ERR_TIMEDOUT;
+	uint32_t pending;
 
-	/* Find packet with highest priority */
-	found = 0;
-	for (prio = 0; prio < CSP_ROUTE_FIFOS; prio++) {
-		if (csp_queue_dequeue(qfifo[prio], input, 0) == CSP_QUEUE_OK) {
-			found = 1;
+	while ((pending = __atomic_load_n(&shard->pending, __ATOMIC_SEQ_CST)) != 0) {
+		int prio = __builtin_ctz(pending);
+		if (csp_queue_dequeue(shard->qfifo[prio], input, 0) == CSP_QUEUE_OK)
+			return 1;
+
+		/* Ring drained, a writer racing with us sets the bit again */
+		__atomic_and_fetch(&shard->pending, ~(1U << prio), __ATOMIC_SEQ_CST);
+		if (csp_queue_size(shard->qfifo[prio]) > 0)
+			__atomic_or_fetch(&shard->pending, 1U << prio, __ATOMIC_SEQ_CST);
+	}
+
+	return 0;
+
+}
+#endif
+
+int csp_qfifo_read_batch(int index, csp_qfifo_t * input, int max) {
+
+	csp_qfifo_shard_t * shard = &qfifo_shards[index];
+	int count = 0;
+
+#ifdef CSP_USE_QOS
+	while (!csp_qfifo_take(shard, &input[0])) {
+		/* Register as sleeper before the last look, a writer either sees
+		 * us and posts or we see its pending bit */
+		__atomic_add_fetch(&shard->sleepers, 1, __ATOMIC_SEQ_CST);
+		if (csp_qfifo_take(shard, &input[0])) {
+			__atomic_sub_fetch(&shard->sleepers, 1, __ATOMIC_SEQ_CST);
 			break;
 		}
+		int ret = csp_bin_sem_wait(&shard->wakeup, FIFO_TIMEOUT);
+		__atomic_sub_fetch(&shard->sleepers, 1, __ATOMIC_SEQ_CST);
+		if (ret != CSP_SEMAPHORE_OK)
+			return 0;
 	}
+	count = 1;
 
-	if (!found) {
-		csp_log_warn("Spurious wakeup: No packet found");
-		return CSP_ERR_TIMEDOUT;
-	}
+	/* Take the rest in priority order, new urgent packets still come first */
+	while (count < max && csp_qfifo_take(shard, &input[count]))
+		count++;
+
+	/* More left than we take, hand over to another sleeping reader */
+	if (__atomic_load_n(&shard->pending, __ATOMIC_SEQ_CST) && __atomic_load_n(&shard->sleepers, __ATOMIC_SEQ_CST))
+		csp_bin_sem_post(&shard->wakeup);
 #else
-	if (csp_queue_dequeue(qfifo[0], input, FIFO_TIMEOUT) != CSP_QUEUE_OK)
-		return CSP_ERR_TIMEDOUT;
+	if (csp_queue_dequeue(shard->qfifo[0], &input[0], FIFO_TIMEOUT) != CSP_QUEUE_OK)
+		return 0;
+	count = 1;
+
+	while (count < max && csp_queue_dequeue(shard->qfifo[0], &input[count], 0) == CSP_QUEUE_OK)
+		count++;
 #endif
 
+	return count;
+
+}
+
+int csp_qfifo_read(csp_qfifo_t * input) {
+
+	if (csp_qfifo_read_batch(0, input, 1) == 0)
+		return CSP_ERR_TIMEDOUT;
+
 	return CSP_ERR_NONE;
 
 }
@@ -107,19 +205,23 @@ void csp_qfifo_write(csp_packet_t * packet, csp_iface_t * interface, CSP_BASE_TY
 	int fifo = 0;
 #endif
 
+	/* Packets of one connection always go to the same worker */
+	csp_qfifo_shard_t * shard = &qfifo_shards[csp_qfifo_shard(packet->id.ext)];
+
 	if (pxTaskWoken == NULL)
-		result = csp_queue_enqueue(qfifo[fifo], &queue_element, 0);
+		result = csp_queue_enqueue(shard->qfifo[fifo], &queue_element, 0);
 	else
-		result = csp_queue_enqueue_isr(qfifo[fifo], &queue_element, pxTaskWoken);
+		result = csp_queue_enqueue_isr(shard->qfifo[fifo], &queue_element, pxTaskWoken);
 
 #ifdef CSP_USE_QOS
-	static int event = 0;
-
 	if (result == CSP_QUEUE_OK) {
-		if (pxTaskWoken == NULL)
-			csp_queue_enqueue(qfifo_events, &event, 0);
-		else
-			csp_queue_enqueue_isr(qfifo_events, &event, pxTaskWoken);
+		__atomic_or_fetch(&shard->pending, 1U << fifo, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&shard->sleepers, __ATOMIC_SEQ_CST)) {
+			if (pxTaskWoken == NULL)
+				csp_bin_sem_post(&shard->wakeup);
+			else
+				csp_bin_sem_post_isr(&shard->wakeup, pxTaskWoken);
+		}
 	}
 #endif
 
@@ -27,6 +27,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #define FIFO_TIMEOUT CSP_MAX_DELAY		//! If no RDP, the router can sleep untill data arrives
 #endif
 
+/** Maximum number of router workers, each with its own input queues */
+#define CSP_ROUTE_WORKERS_MAX 8
+
 /**
  * Init FIFO/QOS queues
  * @return CSP_ERR type
@@ -45,4 +48,30 @@ typedef struct {
  */
 int csp_qfifo_read(csp_qfifo_t * input);
 
+/**
+ * Read up to max packets from the input queue of a router worker, highest
+ * priority first. Waits for the first packet only.
+ * @param index worker index
+ * @param input array of max router queue item elements
+ * @param max number of elements in input
+ * @return number of packets read, 0 on timeout
+ */
+int csp_qfifo_read_batch(int index, csp_qfifo_t * input, int max);
+
+/**
+ * Split the router input in count queues, one per worker. Set it before
+ * traffic starts, packets already queued stay with worker 0.
+ * @param count number of workers, at most CSP_ROUTE_WORKERS_MAX
+ * @return CSP_ERR type
+ */
+int csp_qfifo_set_shards(int count);
+
+/**
+ * Worker index for a packet or connection id. Only the connection tuple
+ * (addresses and ports) is used, so a connection stays on one worker.
+ * @param id csp_id_t ext field
+ * @return worker index
+ */
+int csp_qfifo_shard(uint32_t id);
+
 #endif /* CSP_QFIFO_H_ */
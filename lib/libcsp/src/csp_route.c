@@ -41,6 +41,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include "csp_dedup.h"
 #include "transport/csp_transport.h"
 
+/* Packets taken from the input queue per wakeup */
+#define CSP_ROUTE_BATCH 8
+
 /**
  * Check supported packet options
  * @param interface pointer to incoming interface
@@ -166,27 +169,16 @@ static int csp_route_security_check(uint32_t security_opts, csp_iface_t * interf
 
 }
 
-int csp_route_work(uint32_t timeout) {
+/* Route one packet from the input queue */
+static void csp_route_input(csp_qfifo_t * input) {
 
-	csp_qfifo_t input;
-	csp_packet_t * packet;
+	csp_packet_t * packet = input->packet;
 	csp_conn_t * conn;
 	csp_socket_t * socket;
 
-#ifdef CSP_USE_RDP
-	/* Check connection timeouts (currently only for RDP) */
-	csp_conn_check_timeouts();
-#endif
-
-	/* Get next packet to route */
-	if (csp_qfifo_read(&input) != CSP_ERR_NONE)
-		return -1;
-
-	packet = input.packet;
-
 	csp_log_packet("INP: S %u, D %u, Dp %u, Sp %u, Pr %u, Fl 0x%02X, Sz %"PRIu16" VIA: %s",
 			packet->id.src, packet->id.dst, packet->id.dport,
-			packet->id.sport, packet->id.pri, packet->id.flags, packet->length, input.interface->name);
+			packet->id.sport, packet->id.pri, packet->id.flags, packet->length, input->interface->name);
 
 	/* Here there be promiscuous mode */
 #ifdef CSP_USE_PROMISC
@@ -194,12 +186,15 @@ int csp_route_work(uint32_t timeout) {
 #endif
 
 #ifdef CSP_USE_DEDUP
-	/* Check for duplicates */
-	if (csp_dedup_is_duplicate(packet)) {
+	/* Check for copies from several diversity receivers. RDP drops its own
+	 * duplicates by sequence number and has to see retransmissions to ACK
+	 * them again, so they only count */
+	if (csp_dedup_is_duplicate(packet, input->interface) && !(packet->id.flags & CSP_FRDP)) {
 		/* Discard packet */
 		csp_log_packet("Duplicate packet discarded");
+		input->interface->dup++;
 		csp_buffer_free(packet);
-		return 0;
+		return;
 	}
 #endif
 
@@ -210,9 +205,9 @@ int csp_route_work(uint32_t timeout) {
 		csp_iface_t * dstif = csp_rtable_find_iface(packet->id.dst);
 
 		/* If the message resolves to the input interface, don't loop it back out */
-		if ((dstif == NULL) || ((dstif == input.interface) && (input.interface->split_horizon_off == 0))) {
+		if ((dstif == NULL) || ((dstif == input->interface) && (input->interface->split_horizon_off == 0))) {
 			csp_buffer_free(packet);
-			return 0;
+			return;
 		}
 
 		/* Otherwise, actually send the message */
@@ -222,13 +217,13 @@ int csp_route_work(uint32_t timeout) {
 		}
 
 		/* Next message, please */
-		return 0;
+		return;
 	}
 
 	/* Discard packets with unsupported options */
-	if (csp_route_check_options(input.interface, packet) != CSP_ERR_NONE) {
+	if (csp_route_check_options(input->interface, packet) != CSP_ERR_NONE) {
 		csp_buffer_free(packet);
-		return 0;
+		return;
 	}
 
 	/* The message is to me, search for incoming socket */
@@ -236,16 +231,16 @@ int csp_route_work(uint32_t timeout) {
 
 	/* If the socket is connection-less, deliver now */
 	if (socket && (socket->opts & CSP_SO_CONN_LESS)) {
-		if (csp_route_security_check(socket->opts, input.interface, packet) < 0) {
+		if (csp_route_security_check(socket->opts, input->interface, packet) < 0) {
 			csp_buffer_free(packet);
-			return 0;
+			return;
 		}
 		if (csp_queue_enqueue(socket->socket, &packet, 0) != CSP_QUEUE_OK) {
 			csp_log_error("Conn-less socket queue full");
 			csp_buffer_free(packet);
-			return 0;
+			return;
 		}
-		return 0;
+		return;
 	}
 
 	/* Search for an existing connection */
@@ -257,13 +252,13 @@ int csp_route_work(uint32_t timeout) {
 		/* Reject packet if no matching socket is found */
 		if (!socket) {
 			csp_buffer_free(packet);
-			return 0;
+			return;
 		}
 
 		/* Run security check on incoming packet */
-		if (csp_route_security_check(socket->opts, input.interface, packet) < 0) {
+		if (csp_route_security_check(socket->opts, input->interface, packet) < 0) {
 			csp_buffer_free(packet);
-			return 0;
+			return;
 		}
 
 		/* New incoming connection accepted */
@@ -282,7 +277,7 @@ int csp_route_work(uint32_t timeout) {
 		if (!conn) {
 			csp_log_error("No more connections available");
 			csp_buffer_free(packet);
-			return 0;
+			return;
 		}
 
 		/* Store the socket queue and options */
@@ -293,9 +288,9 @@ int csp_route_work(uint32_t timeout) {
 	} else {
 
 		/* Run security check on incoming packet */
-		if (csp_route_security_check(conn->opts, input.interface, packet) < 0) {
+		if (csp_route_security_check(conn->opts, input->interface, packet) < 0) {
 			csp_buffer_free(packet);
-			return 0;
+			return;
 		}
 
 	}
@@ -304,34 +299,73 @@ int csp_route_work(uint32_t timeout) {
 	/* Pass packet to RDP module */
 	if (packet->id.flags & CSP_FRDP) {
 		csp_rdp_new_packet(conn, packet);
-		return 0;
+		return;
 	}
 #endif
 
 	/* Pass packet to UDP module */
 	csp_udp_new_packet(conn, packet);
+}
+
+/* Route the next batch of packets of one worker */
+static int csp_route_work_shard(int worker) {
+
+	csp_qfifo_t input[CSP_ROUTE_BATCH];
+
+#ifdef CSP_USE_RDP
+	/* Check connection timeouts (currently only for RDP) */
+	csp_conn_check_timeouts(worker);
+#endif
+
+	/* Get the next packets to route, one wakeup for the whole batch */
+	int count = csp_qfifo_read_batch(worker, input, CSP_ROUTE_BATCH);
+	if (count == 0)
+		return -1;
+
+	for (int i = 0; i < count; i++)
+		csp_route_input(&input[i]);
+
 	return 0;
 }
 
+int csp_route_work(uint32_t timeout) {
+	return csp_route_work_shard(0);
+}
+
 CSP_DEFINE_TASK(csp_task_router) {
 
+	int worker = (intptr_t) param;
+
 	/* Here there be routing */
 	while (1) {
-		csp_route_work(FIFO_TIMEOUT);
+		csp_route_work_shard(worker);
+		/* Return buffers grown during a burst, rate limited */
+		csp_buffer_shrink();
 	}
 
 }
 
-int csp_route_start_task(unsigned int task_stack_size, unsigned int priority) {
+int csp_route_start_workers(unsigned int workers, unsigned int task_stack_size, unsigned int priority) {
+
+	static csp_thread_handle_t handle_router[CSP_ROUTE_WORKERS_MAX];
 
-	static csp_thread_handle_t handle_router;
-	int ret = csp_thread_create(csp_task_router, "RTE", task_stack_size, NULL, priority, &handle_router);
+	if (csp_qfifo_set_shards(workers) != CSP_ERR_NONE) {
+		csp_log_error("Invalid number of router workers %u", workers);
+		return CSP_ERR_INVAL;
+	}
 
-	if (ret != 0) {
-		csp_log_error("Failed to start router task");
-		return CSP_ERR_NOMEM;
+	for (unsigned int i = 0; i < workers; i++) {
+		int ret = csp_thread_create(csp_task_router, "RTE", task_stack_size, (void *) (intptr_t) i, priority, &handle_router[i]);
+		if (ret != 0) {
+			csp_log_error("Failed to start router task");
+			return CSP_ERR_NOMEM;
+		}
 	}
 
 	return CSP_ERR_NONE;
 
 }
+
+int csp_route_start_task(unsigned int task_stack_size, unsigned int priority) {
+	return csp_route_start_workers(1, task_stack_size, priority);
+}
@@ -110,6 +110,7 @@ static int do_cmp_if_stats(struct csp_cmp_message *cmp) {
 	cmp->if_stats.txbytes =  csp_hton32(ifc->txbytes);
 	cmp->if_stats.rxbytes =  csp_hton32(ifc->rxbytes);
 	cmp->if_stats.irq = 	 csp_hton32(ifc->irq);
+	cmp->if_stats.dup =      csp_hton32(ifc->dup);
 
 	return CSP_ERR_NONE;
 }
@@ -159,6 +160,24 @@ static int do_cmp_clock(struct csp_cmp_message *cmp) {
 
 }
 
+static int do_cmp_buf_stats(struct csp_cmp_message *cmp) {
+
+	csp_buffer_stats_t stats;
+
+	if (csp_buffer_stats(cmp->buf_stats.index, &stats) != CSP_ERR_NONE)
+		return CSP_ERR_INVAL;
+
+	cmp->buf_stats.classes = csp_buffer_classes();
+	cmp->buf_stats.size = csp_hton32(stats.size);
+	cmp->buf_stats.count = csp_hton32(stats.count);
+	cmp->buf_stats.max = csp_hton32(stats.max);
+	cmp->buf_stats.in_use = csp_hton32(stats.in_use);
+	cmp->buf_stats.high_water = csp_hton32(stats.high_water);
+	cmp->buf_stats.failures = csp_hton32(stats.failures);
+	return CSP_ERR_NONE;
+
+}
+
 /* CSP Management Protocol handler */
 int csp_cmp_handler(csp_conn_t * conn, csp_packet_t * packet) {
 
@@ -182,7 +201,11 @@ int csp_cmp_handler(csp_conn_t * conn, csp_packet_t * packet) {
 
 		case CSP_CMP_IF_STATS:
 			ret = do_cmp_if_stats(cmp);
-			packet->length = CMP_SIZE(if_stats);
+			/* Peers built before dup was added ask for the shorter reply */
+			if (packet->length == CMP_SIZE(if_stats) - sizeof(cmp->if_stats.dup))
+				packet->length = CMP_SIZE(if_stats) - sizeof(cmp->if_stats.dup);
+			else
+				packet->length = CMP_SIZE(if_stats);
 			break;
 
 		case CSP_CMP_PEEK:
@@ -197,6 +220,11 @@ int csp_cmp_handler(csp_conn_t * conn, csp_packet_t * packet) {
 			ret = do_cmp_clock(cmp);
 			break;
 
+		case CSP_CMP_BUF_STATS:
+			ret = do_cmp_buf_stats(cmp);
+			packet->length = CMP_SIZE(buf_stats);
+			break;
+
 		default:
 			ret = CSP_ERR_INVAL;
 			break;
@@ -207,6 +207,26 @@ void csp_buf_free(uint8_t node, uint32_t timeout) {
 
 }
 
+void csp_buf_stats(uint8_t node, uint32_t timeout) {
+
+	struct csp_cmp_message msg;
+	uint8_t classes = 1;
+
+	for (uint8_t i = 0; i < classes; i++) {
+		msg.buf_stats.index = i;
+		if (csp_cmp_buf_stats(node, timeout, &msg) != CSP_ERR_NONE) {
+			printf("Network error\r\n");
+			return;
+		}
+		classes = msg.buf_stats.classes;
+		printf("Buffers of %"PRIu32" bytes at node %"PRIu8": in use %"PRIu32", allocated %"PRIu32"/%"PRIu32", high water %"PRIu32", failures %"PRIu32"\r\n",
+				csp_ntoh32(msg.buf_stats.size), node, csp_ntoh32(msg.buf_stats.in_use),
+				csp_ntoh32(msg.buf_stats.count), csp_ntoh32(msg.buf_stats.max),
+				csp_ntoh32(msg.buf_stats.high_water), csp_ntoh32(msg.buf_stats.failures));
+	}
+
+}
+
 void csp_uptime(uint8_t node, uint32_t timeout) {
 
 	uint32_t uptime = 0;
@@ -0,0 +1,192 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 GomSpace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include <csp/csp.h>
+#include <csp/arch/csp_semaphore.h>
+#include "csp_timer.h"
+
+#define CSP_TIMER_SLOT_MASK	(CSP_TIMER_SLOTS - 1)
+
+static inline void csp_timer_link(csp_timer_t ** head, csp_timer_t * timer) {
+
+	timer->next = *head;
+	if (timer->next)
+		timer->next->pprev = &timer->next;
+	timer->pprev = head;
+	*head = timer;
+
+}
+
+static inline void csp_timer_unlink(csp_timer_t * timer) {
+
+	*timer->pprev = timer->next;
+	if (timer->next)
+		timer->next->pprev = timer->pprev;
+	timer->next = NULL;
+	timer->pprev = NULL;
+
+}
+
+/* Put a timer in the slot of the lowest level that reaches its expiry */
+static void csp_timer_place(csp_timer_wheel_t * wheel, csp_timer_t * timer) {
+
+	uint32_t delta = timer->expires - wheel->now;
+	int level;
+
+	if ((int32_t) delta < 0) {
+		timer->expires = wheel->now;
+		delta = 0;
+	} else if (delta > CSP_TIMER_MAX) {
+		timer->expires = wheel->now + CSP_TIMER_MAX;
+		delta = CSP_TIMER_MAX;
+	}
+
+	for (level = 0; level < CSP_TIMER_LEVELS - 1; level++)
+		if (delta < (1UL << ((level + 1) * CSP_TIMER_SLOT_BITS)))
+			break;
+
+	int index = (timer->expires >> (level * CSP_TIMER_SLOT_BITS)) & CSP_TIMER_SLOT_MASK;
+	csp_timer_link(&wheel->slot[level][index], timer);
+
+}
+
+/* Move the timers of one slot down to the levels below */
+static void csp_timer_cascade(csp_timer_wheel_t * wheel, int level, int index) {
+
+	csp_timer_t * timer = wheel->slot[level][index];
+	wheel->slot[level][index] = NULL;
+
+	while (timer) {
+		csp_timer_t * next = timer->next;
+		csp_timer_place(wheel, timer);
+		timer = next;
+	}
+
+}
+
+int csp_timer_wheel_init(csp_timer_wheel_t * wheel, uint32_t now) {
+
+	memset(wheel->slot, 0, sizeof(wheel->slot));
+	wheel->expired = NULL;
+	wheel->count = 0;
+	wheel->now = now;
+
+	if (csp_mutex_create(&wheel->lock) != CSP_MUTEX_OK)
+		return CSP_ERR_NOMEM;
+
+	return CSP_ERR_NONE;
+
+}
+
+void csp_timer_init(csp_timer_t * timer, void (*callback)(void * arg), void * arg) {
+
+	timer->next = NULL;
+	timer->pprev = NULL;
+	timer->expires = 0;
+	timer->callback = callback;
+	timer->arg = arg;
+
+}
+
+void csp_timer_arm(csp_timer_wheel_t * wheel, csp_timer_t * timer, uint32_t expires) {
+
+	csp_mutex_lock(&wheel->lock, CSP_MAX_DELAY);
+
+	if (timer->pprev) {
+		if ((int32_t) (expires - timer->expires) >= 0) {
+			csp_mutex_unlock(&wheel->lock);
+			return;
+		}
+		csp_timer_unlink(timer);
+	} else {
+		wheel->count++;
+	}
+
+	timer->expires = expires;
+	csp_timer_place(wheel, timer);
+
+	csp_mutex_unlock(&wheel->lock);
+
+}
+
+void csp_timer_cancel(csp_timer_wheel_t * wheel, csp_timer_t * timer) {
+
+	csp_mutex_lock(&wheel->lock, CSP_MAX_DELAY);
+
+	if (timer->pprev) {
+		csp_timer_unlink(timer);
+		wheel->count--;
+	}
+
+	csp_mutex_unlock(&wheel->lock);
+
+}
+
+void csp_timer_run(csp_timer_wheel_t * wheel, uint32_t now) {
+
+	csp_mutex_lock(&wheel->lock, CSP_MAX_DELAY);
+
+	while ((int32_t) (now - wheel->now) >= 0) {
+
+		/* Nothing armed, skip the idle ticks */
+		if (wheel->count == 0) {
+			wheel->now = now + 1;
+			break;
+		}
+
+		uint32_t tick = wheel->now;
+		int index = tick & CSP_TIMER_SLOT_MASK;
+
+		/* Refill the lower levels each time one wraps around */
+		int level;
+		for (level = 1; level < CSP_TIMER_LEVELS && index == 0; level++) {
+			index = (tick >> (level * CSP_TIMER_SLOT_BITS)) & CSP_TIMER_SLOT_MASK;
+			csp_timer_cascade(wheel, level, index);
+		}
+		index = tick & CSP_TIMER_SLOT_MASK;
+
+		/* Timers armed from the callbacks land in the next tick or later */
+		wheel->now = tick + 1;
+		if (wheel->slot[0][index] == NULL)
+			continue;
+
+		wheel->expired = wheel->slot[0][index];
+		wheel->expired->pprev = &wheel->expired;
+		wheel->slot[0][index] = NULL;
+
+		/* One at a time, so the others can be cancelled or re-armed while
+		 * the callback runs without the lock */
+		while (wheel->expired) {
+			csp_timer_t * timer = wheel->expired;
+			csp_timer_unlink(timer);
+			wheel->count--;
+			csp_mutex_unlock(&wheel->lock);
+			timer->callback(timer->arg);
+			csp_mutex_lock(&wheel->lock, CSP_MAX_DELAY);
+		}
+
+	}
+
+	csp_mutex_unlock(&wheel->lock);
+
+}
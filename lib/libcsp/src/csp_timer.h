@@ -0,0 +1,108 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 GomSpace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef CSP_TIMER_H_
+#define CSP_TIMER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include <csp/arch/csp_semaphore.h>
+
+/**
+ * Hierarchical timer wheel with a resolution of one ms. Arming, cancelling
+ * and expiring a timer are O(1), timers further out than the first level
+ * are cascaded down a level at a time. Timers can be armed and cancelled
+ * from any task, csp_timer_run() is called by the single task that owns
+ * the wheel and runs the callbacks.
+ */
+
+#define CSP_TIMER_LEVELS	4
+#define CSP_TIMER_SLOT_BITS	6
+#define CSP_TIMER_SLOTS		(1 << CSP_TIMER_SLOT_BITS)
+
+/** Longest timeout in ms, later expiry times are clamped */
+#define CSP_TIMER_MAX		((1UL << (CSP_TIMER_LEVELS * CSP_TIMER_SLOT_BITS)) - 1)
+
+typedef struct csp_timer_s {
+	struct csp_timer_s * next;
+	struct csp_timer_s ** pprev;	/* NULL when not armed */
+	uint32_t expires;
+	void (*callback)(void * arg);
+	void * arg;
+} csp_timer_t;
+
+typedef struct {
+	csp_mutex_t lock;
+	uint32_t now;			/* Next tick to expire */
+	unsigned int count;		/* Armed timers */
+	csp_timer_t * expired;		/* Due in the tick being run */
+	csp_timer_t * slot[CSP_TIMER_LEVELS][CSP_TIMER_SLOTS];
+} csp_timer_wheel_t;
+
+/**
+ * Initialise an empty wheel
+ * @param wheel wheel to initialise
+ * @param now current time in ms
+ * @return CSP_ERR type
+ */
+int csp_timer_wheel_init(csp_timer_wheel_t * wheel, uint32_t now);
+
+/**
+ * Initialise a timer, it is not armed
+ * @param timer timer to initialise
+ * @param callback called from csp_timer_run() when the timer expires
+ * @param arg argument to callback
+ */
+void csp_timer_init(csp_timer_t * timer, void (*callback)(void * arg), void * arg);
+
+/**
+ * Arm a timer, or move it earlier if it is already armed. An armed timer
+ * is never postponed, so independent deadlines can each be armed and the
+ * earliest wins.
+ * @param wheel wheel the timer belongs to
+ * @param timer timer to arm
+ * @param expires time in ms, a time in the past expires on the next run
+ */
+void csp_timer_arm(csp_timer_wheel_t * wheel, csp_timer_t * timer, uint32_t expires);
+
+/**
+ * Disarm a timer, no effect if it is not armed
+ * @param wheel wheel the timer belongs to
+ * @param timer timer to cancel
+ */
+void csp_timer_cancel(csp_timer_wheel_t * wheel, csp_timer_t * timer);
+
+/**
+ * Expire all timers due at or before now and call their callbacks. A
+ * timer is disarmed before its callback runs, the callback may arm it again.
+ * @param wheel wheel to run
+ * @param now current time in ms
+ */
+void csp_timer_run(csp_timer_wheel_t * wheel, uint32_t now);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* CSP_TIMER_H_ */
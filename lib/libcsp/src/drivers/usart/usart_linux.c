@@ -32,11 +32,30 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <csp/csp.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
+
+/* Size of the RX thread read buffer, shared by all ports */
+#define USART_RX_BUF_SIZE	4096
+#define USART_MAX_EVENTS	8
+
+struct usart_handle_s {
+	int fd;
+	/* Held while the fd is written and while usart_release() closes it */
+	pthread_mutex_t lock;
+	usart_rx_callback_t callback;
+	void * arg;
+};
 
 int usart_stdio_id = 0;
-int fd;
 usart_callback_t usart_callback = NULL;
 
+/* Port used by the single port API (usart_init, usart_putc, ...) */
+static usart_handle_t * usart_default = NULL;
+
+/* One epoll RX thread services every open port */
+static pthread_once_t usart_rx_once = PTHREAD_ONCE_INIT;
+static int usart_epoll_fd = -1;
+
 static void *serial_rx_thread(void *vptr_args);
 
 int getbaud(int fd) {
@@ -130,16 +149,36 @@ int getbaud(int fd) {
 
 }
 
-void usart_init(struct usart_conf * conf) {
+static void usart_rx_start(void) {
 
-	struct termios options;
 	pthread_t rx_thread;
 
+	usart_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (usart_epoll_fd < 0) {
+		printf("Failed to create epoll instance: %s\r\n", strerror(errno));
+		return;
+	}
+
+	if (pthread_create(&rx_thread, NULL, serial_rx_thread, NULL) != 0) {
+		close(usart_epoll_fd);
+		usart_epoll_fd = -1;
+		return;
+	}
+
+	pthread_detach(rx_thread);
+
+}
+
+usart_handle_t * usart_open(struct usart_conf * conf, usart_rx_callback_t callback, void * arg) {
+
+	struct termios options;
+	int fd;
+
 	fd = open(conf->device, O_RDWR | O_NOCTTY | O_NONBLOCK);
 
 	if (fd < 0) {
 		printf("Failed to open %s: %s\r\n", conf->device, strerror(errno));
-		return;
+		return NULL;
 	}
 
 	int brate = 0;
@@ -184,9 +223,66 @@ void usart_init(struct usart_conf * conf) {
 	if (tcflush(fd, TCIOFLUSH) == -1)
 		printf("Error flushing serial port - %s(%d).\n", strerror(errno), errno);
 
-	if (pthread_create(&rx_thread, NULL, serial_rx_thread, NULL) != 0)
-		return;
+	usart_handle_t * handle = malloc(sizeof(*handle));
+	if (handle == NULL) {
+		close(fd);
+		return NULL;
+	}
+	handle->fd = fd;
+	handle->callback = callback;
+	handle->arg = arg;
+	pthread_mutex_init(&handle->lock, NULL);
 
+	/* Register the port with the RX thread */
+	pthread_once(&usart_rx_once, usart_rx_start);
+	if (usart_epoll_fd < 0) {
+		close(fd);
+		pthread_mutex_destroy(&handle->lock);
+		free(handle);
+		return NULL;
+	}
+
+	struct epoll_event ev = {.events = EPOLLIN, .data.ptr = handle};
+	if (epoll_ctl(usart_epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+		printf("Failed to watch %s: %s\r\n", conf->device, strerror(errno));
+		close(fd);
+		pthread_mutex_destroy(&handle->lock);
+		free(handle);
+		return NULL;
+	}
+
+	return handle;
+
+}
+
+void usart_handle_putstr(usart_handle_t * handle, char * buf, int len) {
+	/* The lock keeps usart_release() from closing the fd, and the number
+	 * being reused by another open, in the middle of the write. It also
+	 * keeps frames from different tasks from interleaving. */
+	pthread_mutex_lock(&handle->lock);
+
+	/* Write the whole buffer, a tty may accept it in pieces */
+	while (handle->fd >= 0 && len > 0) {
+		ssize_t written = write(handle->fd, buf, len);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		buf += written;
+		len -= written;
+	}
+
+	pthread_mutex_unlock(&handle->lock);
+}
+
+static void usart_default_rx(void * arg, uint8_t * buf, int len, void * pxTaskWoken) {
+	if (usart_callback)
+		usart_callback(buf, len, pxTaskWoken);
+}
+
+void usart_init(struct usart_conf * conf) {
+	usart_default = usart_open(conf, usart_default_rx, NULL);
 }
 
 void usart_set_callback(usart_callback_t callback) {
@@ -198,18 +294,32 @@ void usart_insert(char c, void * pxTaskWoken) {
 }
 
 void usart_putstr(char * buf, int len) {
-	if (write(fd, buf, len) != len)
+	if (usart_default == NULL)
 		return;
+	usart_handle_putstr(usart_default, buf, len);
 }
 
 void usart_putc(char c) {
-	if (write(fd, &c, 1) != 1)
+	if (usart_default == NULL)
 		return;
+	usart_handle_putstr(usart_default, &c, 1);
 }
 
 char usart_getc(void) {
 	char c;
-	if (read(fd, &c, 1) != 1) return 0;
+	int fd = -1;
+	if (usart_default == NULL)
+		return 0;
+	/* Read from a duplicate, the read may block and must not hold the lock */
+	pthread_mutex_lock(&usart_default->lock);
+	if (usart_default->fd >= 0)
+		fd = dup(usart_default->fd);
+	pthread_mutex_unlock(&usart_default->lock);
+	if (fd < 0)
+		return 0;
+	if (read(fd, &c, 1) != 1)
+		c = 0;
+	close(fd);
 	return c;
 }
 
@@ -224,19 +334,49 @@ int usart_messages_waiting(int handle) {
   return (FD_ISSET(0, &fds));
 }
 
+/* Close a port that stopped working. Writers may still hold the handle,
+ * so it stays allocated with an invalid fd and later writes are dropped.
+ * Only called from the RX thread, which reads the fd without the lock. */
+static void usart_release(usart_handle_t * handle) {
+	pthread_mutex_lock(&handle->lock);
+	if (handle->fd >= 0) {
+		epoll_ctl(usart_epoll_fd, EPOLL_CTL_DEL, handle->fd, NULL);
+		close(handle->fd);
+		handle->fd = -1;
+	}
+	pthread_mutex_unlock(&handle->lock);
+}
+
 static void *serial_rx_thread(void *vptr_args) {
-	unsigned int length;
-	uint8_t * cbuf = malloc(100000);
+	struct epoll_event events[USART_MAX_EVENTS];
+	uint8_t * cbuf = malloc(USART_RX_BUF_SIZE);
+
+	if (cbuf == NULL)
+		return NULL;
 
 	// Receive loop
 	while (1) {
-		length = read(fd, cbuf, 300);
-		if (length <= 0) {
+		int count = epoll_wait(usart_epoll_fd, events, USART_MAX_EVENTS, -1);
+		if (count < 0) {
+			if (errno == EINTR)
+				continue;
 			perror("Error: ");
 			exit(1);
 		}
-		if (usart_callback)
-			usart_callback(cbuf, length, NULL);
+		for (int i = 0; i < count; i++) {
+			usart_handle_t * handle = events[i].data.ptr;
+			ssize_t length = read(handle->fd, cbuf, USART_RX_BUF_SIZE);
+			if (length <= 0) {
+				if (length < 0 && errno == EINTR)
+					continue;
+				/* Port is gone, stop servicing it but keep the others running */
+				perror("Error: ");
+				usart_release(handle);
+				continue;
+			}
+			if (handle->callback)
+				handle->callback(handle->arg, cbuf, length, NULL);
+		}
 	}
 	return NULL;
 }
@@ -31,8 +31,6 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <csp/arch/csp_semaphore.h>
 #include <csp/csp_crc32.h>
 
-#define KISS_MTU				256
-
 #define FEND  					0xC0
 #define FESC  					0xDB
 #define TFEND 					0xDC
@@ -42,8 +40,35 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #define TNC_SET_HARDWARE		0x06
 #define TNC_RETURN				0xFF
 
-static int kiss_lock_init = 0;
-static csp_bin_sem_handle_t kiss_lock;
+/* Escape a frame into the transmit buffer and hand it to putstr, flushing early if it fills up */
+static void csp_kiss_putstr_frame(csp_kiss_handle_t * driver, const unsigned char * data, unsigned int length) {
+
+	unsigned char * buf = driver->tx_buf;
+	unsigned int n = 0;
+
+	buf[n++] = FEND;
+	buf[n++] = TNC_DATA;
+	for (unsigned int i = 0; i < length; i++) {
+		/* Keep room for an escaped byte and the trailing FEND */
+		if (n + 3 > sizeof(driver->tx_buf)) {
+			driver->kiss_putstr(driver->driver_data, (char *) buf, n);
+			n = 0;
+		}
+		if (data[i] == FEND) {
+			buf[n++] = FESC;
+			buf[n++] = TFEND;
+		} else if (data[i] == FESC) {
+			buf[n++] = FESC;
+			buf[n++] = TFESC;
+		} else {
+			buf[n++] = data[i];
+		}
+	}
+	buf[n++] = FEND;
+
+	driver->kiss_putstr(driver->driver_data, (char *) buf, n);
+
+}
 
 /* Send a CSP packet over the KISS RS232 protocol */
 static int csp_kiss_tx(csp_iface_t * interface, csp_packet_t * packet, uint32_t timeout) {
@@ -51,6 +76,8 @@ static int csp_kiss_tx(csp_iface_t * interface, csp_packet_t * packet, uint32_t
 	if (interface == NULL || interface->driver == NULL)
 		return CSP_ERR_DRIVER;
 
+	csp_kiss_handle_t * driver = interface->driver;
+
 	/* Add CRC32 checksum */
 	csp_crc32_append(packet, false);
 
@@ -59,46 +86,77 @@ static int csp_kiss_tx(csp_iface_t * interface, csp_packet_t * packet, uint32_t
 	packet->length += sizeof(packet->id.ext);
 
 	/* Lock */
-	csp_bin_sem_wait(&kiss_lock, 1000);
+	csp_bin_sem_wait(&driver->tx_lock, 1000);
 
 	/* Transmit data */
-	csp_kiss_handle_t * driver = interface->driver;
-	driver->kiss_putc(FEND);
-	driver->kiss_putc(TNC_DATA);
-	for (unsigned int i = 0; i < packet->length; i++) {
-		if (((unsigned char *) &packet->id.ext)[i] == FEND) {
-			((unsigned char *) &packet->id.ext)[i] = TFEND;
-			driver->kiss_putc(FESC);
-		} else if (((unsigned char *) &packet->id.ext)[i] == FESC) {
-			((unsigned char *) &packet->id.ext)[i] = TFESC;
-			driver->kiss_putc(FESC);
+	unsigned char * data = (unsigned char *) &packet->id.ext;
+	if (driver->kiss_putstr != NULL) {
+		csp_kiss_putstr_frame(driver, data, packet->length);
+	} else {
+		driver->kiss_putc(FEND);
+		driver->kiss_putc(TNC_DATA);
+		for (unsigned int i = 0; i < packet->length; i++) {
+			if (data[i] == FEND) {
+				data[i] = TFEND;
+				driver->kiss_putc(FESC);
+			} else if (data[i] == FESC) {
+				data[i] = TFESC;
+				driver->kiss_putc(FESC);
+			}
+			driver->kiss_putc(data[i]);
 		}
-		driver->kiss_putc(((unsigned char *) &packet->id.ext)[i]);
+		driver->kiss_putc(FEND);
 	}
-	driver->kiss_putc(FEND);
 
 	/* Free data */
 	csp_buffer_free(packet);
 
 	/* Unlock */
-	csp_bin_sem_post(&kiss_lock);
+	csp_bin_sem_post(&driver->tx_lock);
 
 	return CSP_ERR_NONE;
 }
 
+/* Byte-wise match on a 64-bit word: non-zero if any byte of v is zero */
+#define KISS_ONES				0x0101010101010101ULL
+#define KISS_HAS_ZERO(v)		(((v) - KISS_ONES) & ~(v) & (KISS_ONES * 0x80))
+
+/* Length of the leading run of buf that holds no FEND or FESC bytes */
+static unsigned int csp_kiss_run_length(const uint8_t * buf, unsigned int len) {
+
+	unsigned int i = 0;
+
+	/* Scan a word at a time until a word contains a special char */
+	while (i + sizeof(uint64_t) <= len) {
+		uint64_t word;
+		memcpy(&word, &buf[i], sizeof(word));
+		if (KISS_HAS_ZERO(word ^ (KISS_ONES * FEND)) || KISS_HAS_ZERO(word ^ (KISS_ONES * FESC)))
+			break;
+		i += sizeof(uint64_t);
+	}
+
+	/* Locate the exact byte */
+	while (i < len && buf[i] != FEND && buf[i] != FESC)
+		i++;
+
+	return i;
+
+}
+
 /**
  * When a frame is received, decode the kiss-stuff
  * and eventually send it directly to the CSP new packet function.
+ *
+ * Runs of unescaped data are located a word at a time and copied into the
+ * packet in bulk; only FEND, FESC and the byte after FESC are handled one
+ * at a time.
  */
 void csp_kiss_rx(csp_iface_t * interface, uint8_t * buf, int len, void * pxTaskWoken) {
 
 	/* Driver handle */
 	csp_kiss_handle_t * driver = interface->driver;
 
-	while (len--) {
-
-		/* Input */
-		unsigned char inputbyte = *buf++;
+	while (len > 0) {
 
 		/* If packet was too long */
 		if (driver->rx_length > interface->mtu) {
@@ -108,14 +166,40 @@ void csp_kiss_rx(csp_iface_t * interface, uint8_t * buf, int len, void * pxTaskW
 			driver->rx_length = 0;
 		}
 
+		/* Bulk copy of a data run, bounded so the overflow check above fires as before */
+		if (driver->rx_mode == KISS_MODE_STARTED && !driver->rx_first) {
+			unsigned int run = csp_kiss_run_length(buf, len);
+			unsigned int room = interface->mtu + 1 - driver->rx_length;
+			if (run > room)
+				run = room;
+			if (run > 0) {
+				memcpy(&((char *) &driver->rx_packet->id.ext)[driver->rx_length], buf, run);
+				driver->rx_length += run;
+				buf += run;
+				len -= run;
+				continue;
+			}
+		}
+
+		/* Input */
+		unsigned char inputbyte = *buf++;
+		len--;
+
 		switch (driver->rx_mode) {
 
 		case KISS_MODE_NOT_STARTED:
 
 			/* Send normal chars back to usart driver */
 			if (inputbyte != FEND) {
-				if (driver->kiss_discard != NULL)
+				if (driver->kiss_discard != NULL) {
 					driver->kiss_discard(inputbyte, pxTaskWoken);
+				} else {
+					/* Nobody wants the noise, jump to the next FEND */
+					uint8_t * fend = memchr(buf, FEND, len);
+					unsigned int skip = (fend != NULL) ? (unsigned int) (fend - buf) : (unsigned int) len;
+					buf += skip;
+					len -= skip;
+				}
 				break;
 			}
 
@@ -219,8 +303,14 @@ void csp_kiss_rx(csp_iface_t * interface, uint8_t * buf, int len, void * pxTaskW
 		case KISS_MODE_SKIP_FRAME:
 
 			/* Just wait for end char */
-			if (inputbyte == FEND)
+			if (inputbyte == FEND) {
 				driver->rx_mode = KISS_MODE_NOT_STARTED;
+			} else {
+				uint8_t * fend = memchr(buf, FEND, len);
+				unsigned int skip = (fend != NULL) ? (unsigned int) (fend - buf) : (unsigned int) len;
+				buf += skip;
+				len -= skip;
+			}
 
 			break;
 
@@ -232,16 +322,15 @@ void csp_kiss_rx(csp_iface_t * interface, uint8_t * buf, int len, void * pxTaskW
 
 void csp_kiss_init(csp_iface_t * csp_iface, csp_kiss_handle_t * csp_kiss_handle, csp_kiss_putc_f kiss_putc_f, csp_kiss_discard_f kiss_discard_f, const char * name) {
 
-	/* Init lock only once */
-	if (kiss_lock_init == 0) {
-		csp_bin_sem_create(&kiss_lock);
-		kiss_lock_init = 1;
-	}
+	/* Each interface has its own transmit lock */
+	csp_bin_sem_create(&csp_kiss_handle->tx_lock);
 
 	/* Register device handle as member of interface */
 	csp_iface->driver = csp_kiss_handle;
 	csp_kiss_handle->kiss_discard = kiss_discard_f;
 	csp_kiss_handle->kiss_putc = kiss_putc_f;
+	csp_kiss_handle->kiss_putstr = NULL;
+	csp_kiss_handle->driver_data = NULL;
 	csp_kiss_handle->rx_packet = NULL;
 	csp_kiss_handle->rx_mode = KISS_MODE_NOT_STARTED;
 
@@ -254,3 +343,10 @@ void csp_kiss_init(csp_iface_t * csp_iface, csp_kiss_handle_t * csp_kiss_handle,
 	csp_iflist_add(csp_iface);
 
 }
+
+void csp_kiss_set_putstr(csp_kiss_handle_t * csp_kiss_handle, csp_kiss_putstr_f kiss_putstr_f, void * driver_data) {
+
+	csp_kiss_handle->driver_data = driver_data;
+	csp_kiss_handle->kiss_putstr = kiss_putstr_f;
+
+}
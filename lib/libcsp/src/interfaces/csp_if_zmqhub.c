@@ -81,8 +81,9 @@ CSP_DEFINE_TASK(csp_zmqhub_task) {
 			continue;
 		}
 
-		/* Create new csp packet */
-		csp_packet_t * packet = csp_buffer_get(256);
+		/* Create new csp packet, sized for the frame after the satellite id
+		 * and CSP header. Frames larger than the largest buffer are dropped */
+		csp_packet_t * packet = csp_buffer_get(datalen - 4 - 1);
 		if (packet == NULL) {
 			zmq_msg_close(&msg);
 			continue;
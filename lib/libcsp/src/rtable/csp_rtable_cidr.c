@@ -23,8 +23,18 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <csp/csp.h>
 #include <alloca.h>
 #include <csp/arch/csp_malloc.h>
+#include <csp/arch/csp_semaphore.h>
+#include <csp/arch/csp_thread.h>
+#include <csp/arch/csp_time.h>
 #include <csp/interfaces/csp_if_lo.h>
 
+/* Compiled tables kept for readers that may still hold a replaced one */
+#define CSP_RTABLE_GENERATIONS	4
+
+/* A lookup holds a table for a few instructions, a replaced table is
+ * reused only after this long */
+#define CSP_RTABLE_GRACE_MS	100
+
 /* Local typedef for routing table */
 typedef struct __attribute__((__packed__)) csp_rtable_s {
 	uint8_t address;
@@ -34,61 +44,162 @@ typedef struct __attribute__((__packed__)) csp_rtable_s {
 	struct csp_rtable_s * next;
 } csp_rtable_t;
 
-/* Routing entries are stored in a linked list*/
+/* Result of the CIDR match for one destination */
+typedef struct {
+	csp_iface_t * interface;
+	uint8_t mac;
+} csp_rtable_route_t;
+
+/* Routing entries are stored in a linked list, only touched with rtable_lock held */
 static csp_rtable_t * rtable = NULL;
+static csp_mutex_t rtable_lock;
+static int rtable_lock_created = 0;
+
+/* The rules compiled into one route per address. Lookups read rtable_active
+ * without locking, writers fill an unused generation and swap the pointer */
+static csp_rtable_route_t rtable_gen[CSP_RTABLE_GENERATIONS][CSP_ID_HOST_MAX + 1];
+static csp_rtable_route_t * rtable_active = NULL;
+static uint8_t rtable_retired[CSP_RTABLE_GENERATIONS];
+static uint32_t rtable_retired_ms[CSP_RTABLE_GENERATIONS];
+
+static void csp_rtable_lock(void) {
+	/* First called when csp_init sets the loopback route, before other tasks run */
+	if (!rtable_lock_created) {
+		csp_mutex_create(&rtable_lock);
+		rtable_lock_created = 1;
+	}
+	csp_mutex_lock(&rtable_lock, CSP_MAX_DELAY);
+}
 
-static csp_rtable_t * csp_rtable_find(uint8_t addr, uint8_t netmask, uint8_t exact) {
+static void csp_rtable_unlock(void) {
+	csp_mutex_unlock(&rtable_lock);
+}
+
+static csp_rtable_t * csp_rtable_find(uint8_t addr, uint8_t netmask) {
 
-	/* Remember best result */
-	csp_rtable_t * best_result = NULL;
-	uint8_t best_result_mask = 0;
+	for (csp_rtable_t * i = rtable; (i); i = i->next)
+		if (i->address == addr && i->netmask == netmask)
+			return i;
 
-	/* Start search */
-	csp_rtable_t * i = rtable;
-	while(i) {
+	return NULL;
+
+}
 
-		/* Look for exact match */
-		if (i->address == addr && i->netmask == netmask) {
-			best_result = i;
-			break;
+/* Wait until a generation is not active and out of its grace period */
+static csp_rtable_route_t * csp_rtable_free_gen(void) {
+
+	while (1) {
+		uint32_t now = csp_get_ms();
+		uint32_t wait = CSP_RTABLE_GRACE_MS;
+
+		for (int gen = 0; gen < CSP_RTABLE_GENERATIONS; gen++) {
+			if (rtable_gen[gen] == rtable_active)
+				continue;
+			if (!rtable_retired[gen])
+				return rtable_gen[gen];
+			uint32_t age = now - rtable_retired_ms[gen];
+			if (age >= CSP_RTABLE_GRACE_MS)
+				return rtable_gen[gen];
+			if (CSP_RTABLE_GRACE_MS - age < wait)
+				wait = CSP_RTABLE_GRACE_MS - age;
 		}
 
-		/* Try a CIDR netmask match */
-		if (!exact) {
-			uint8_t hostbits = (1 << (CSP_ID_HOST_SIZE - i->netmask)) - 1;
-			uint8_t netbits = ~hostbits;
-			//printf("Netbits %x Hostbits %x\r\n", netbits, hostbits);
-
-			/* Match network addresses */
-			uint8_t net_a = i->address & netbits;
-			uint8_t net_b = addr & netbits;
-			//printf("A: %hhx, B: %hhx\r\n", net_a, net_b);
-
-			/* We have a match */
-			if (net_a == net_b) {
-				if (i->netmask >= best_result_mask) {
-					//printf("Match best result %u %u\r\n", best_result_mask, i->netmask);
-					best_result = i;
-					best_result_mask = i->netmask;
-				}
-			}
+		csp_sleep_ms(wait);
+	}
+
+}
+
+/* Rebuild the lookup table from the rules and publish it */
+static void csp_rtable_compile(void) {
 
+	csp_rtable_route_t * routes = csp_rtable_free_gen();
+
+	for (int addr = 0; addr <= CSP_ID_HOST_MAX; addr++) {
+		routes[addr].interface = NULL;
+		routes[addr].mac = CSP_NODE_MAC;
+	}
+
+	/* Shortest prefix first so longer ones override it. Of two rules with
+	 * the same prefix length covering an address the last one wins */
+	for (int netmask = 0; netmask <= CSP_ID_HOST_SIZE; netmask++) {
+		for (csp_rtable_t * i = rtable; (i); i = i->next) {
+			if (i->netmask != netmask)
+				continue;
+			uint8_t hostbits = (1 << (CSP_ID_HOST_SIZE - netmask)) - 1;
+			uint8_t first = i->address & ~hostbits;
+			for (int addr = first; addr <= first + hostbits; addr++) {
+				routes[addr].interface = i->interface;
+				routes[addr].mac = i->mac;
+			}
 		}
+	}
 
-		i = i->next;
+	csp_rtable_route_t * old = rtable_active;
+	__atomic_store_n(&rtable_active, routes, __ATOMIC_RELEASE);
+
+	if (old != NULL) {
+		int gen = (old - rtable_gen[0]) / (CSP_ID_HOST_MAX + 1);
+		rtable_retired[gen] = 1;
+		rtable_retired_ms[gen] = csp_get_ms();
+	}
+
+}
+
+static int csp_rtable_set_rule(uint8_t _address, uint8_t _netmask, csp_iface_t *ifc, uint8_t mac) {
+
+	if (ifc == NULL)
+		return CSP_ERR_INVAL;
 
+	/* Set default route in the old way */
+	int address, netmask;
+	if (_address == CSP_DEFAULT_ROUTE) {
+		netmask = 0;
+		address = 0;
+	} else {
+		netmask = _netmask;
+		address = _address;
 	}
 
-#if 0
-	if (best_result)
-		csp_debug(CSP_PACKET, "Using routing entry: %u/%u dev %s m:%u\r\n", best_result->address, best_result->netmask, best_result->interface->name, best_result->mac);
-#endif
+	if (address > CSP_ID_HOST_MAX || netmask > CSP_ID_HOST_SIZE)
+		return CSP_ERR_INVAL;
+
+	/* Fist see if the entry exists */
+	csp_rtable_t * entry = csp_rtable_find(address, netmask);
+
+	/* If not, create a new one */
+	if (!entry) {
+		entry = csp_malloc(sizeof(csp_rtable_t));
+		if (entry == NULL)
+			return CSP_ERR_NOMEM;
+
+		entry->next = NULL;
+		/* Add entry to linked-list */
+		if (rtable == NULL) {
+			/* This is the first interface to be added */
+			rtable = entry;
+		} else {
+			/* One or more interfaces were already added */
+			csp_rtable_t * i = rtable;
+			while (i->next)
+				i = i->next;
+			i->next = entry;
+		}
+	}
 
-	return best_result;
+	/* Fill in the data */
+	entry->address = address;
+	entry->netmask = netmask;
+	entry->interface = ifc;
+	entry->mac = mac;
 
+	return CSP_ERR_NONE;
 }
 
 void csp_rtable_clear(void) {
+
+	csp_rtable_lock();
+
+	/* Lookups never see the rules, they can be freed right away */
 	for (csp_rtable_t * i = rtable; (i);) {
 		void * freeme = i;
 		i = i->next;
@@ -97,12 +208,14 @@ void csp_rtable_clear(void) {
 	rtable = NULL;
 
 	/* Set loopback up again */
-	csp_rtable_set(csp_get_address(), CSP_ID_HOST_SIZE, &csp_if_lo, CSP_NODE_MAC);
+	csp_rtable_set_rule(csp_get_address(), CSP_ID_HOST_SIZE, &csp_if_lo, CSP_NODE_MAC);
+
+	csp_rtable_compile();
+	csp_rtable_unlock();
 
 }
 
 static int csp_rtable_parse(char * buffer, int dry_run) {
-
 	int valid_entries = 0;
 
 	/* Copy string before running strtok */
@@ -125,7 +238,7 @@ static int csp_rtable_parse(char * buffer, int dry_run) {
 		csp_iface_t * ifc = csp_iflist_get_by_name(name);
 		if (ifc) {
 			if (dry_run == 0)
-				csp_rtable_set(address, netmask, ifc, mac);
+				csp_rtable_set_rule(address, netmask, ifc, mac);
 		} else {
 			csp_log_error("Unknown interface %s", name);
 			return -1;
@@ -138,7 +251,11 @@ static int csp_rtable_parse(char * buffer, int dry_run) {
 }
 
 void csp_rtable_load(char * buffer) {
+	/* All rules of the string go live in one swap */
+	csp_rtable_lock();
 	csp_rtable_parse(buffer, 0);
+	csp_rtable_compile();
+	csp_rtable_unlock();
 }
 
 int csp_rtable_check(char * buffer) {
@@ -147,6 +264,7 @@ int csp_rtable_check(char * buffer) {
 
 int csp_rtable_save(char * buffer, int maxlen) {
 	int len = 0;
+	csp_rtable_lock();
 	for (csp_rtable_t * i = rtable; (i); i = i->next) {
 		if (i->mac != CSP_NODE_MAC) {
 			len += snprintf(buffer + len, maxlen - len, "%u/%u %s %u, ", i->address, i->netmask, i->interface->name, i->mac);
@@ -154,72 +272,38 @@ int csp_rtable_save(char * buffer, int maxlen) {
 			len += snprintf(buffer + len, maxlen - len, "%u/%u %s, ", i->address, i->netmask, i->interface->name);
 		}
 	}
+	csp_rtable_unlock();
 	return len;
 }
 
 csp_iface_t * csp_rtable_find_iface(uint8_t id) {
-	csp_rtable_t * entry = csp_rtable_find(id, CSP_ID_HOST_SIZE, 0);
-	if (entry == NULL)
+	csp_rtable_route_t * routes = __atomic_load_n(&rtable_active, __ATOMIC_ACQUIRE);
+	if (routes == NULL)
 		return NULL;
-	return entry->interface;
+	return routes[id & CSP_ID_HOST_MAX].interface;
 }
 
 uint8_t csp_rtable_find_mac(uint8_t id) {
-	csp_rtable_t * entry = csp_rtable_find(id, CSP_ID_HOST_SIZE, 0);
-	if (entry == NULL)
-		return 255;
-	return entry->mac;
+	csp_rtable_route_t * routes = __atomic_load_n(&rtable_active, __ATOMIC_ACQUIRE);
+	if (routes == NULL)
+		return CSP_NODE_MAC;
+	return routes[id & CSP_ID_HOST_MAX].mac;
 }
 
 int csp_rtable_set(uint8_t _address, uint8_t _netmask, csp_iface_t *ifc, uint8_t mac) {
 
-	if (ifc == NULL)
-		return CSP_ERR_INVAL;
-
-	/* Set default route in the old way */
-	int address, netmask;
-	if (_address == CSP_DEFAULT_ROUTE) {
-		netmask = 0;
-		address = 0;
-	} else {
-		netmask = _netmask;
-		address = _address;
-	}
-
-	/* Fist see if the entry exists */
-	csp_rtable_t * entry = csp_rtable_find(address, netmask, 1);
-
-	/* If not, create a new one */
-	if (!entry) {
-		entry = csp_malloc(sizeof(csp_rtable_t));
-		if (entry == NULL)
-			return CSP_ERR_NOMEM;
-
-		entry->next = NULL;
-		/* Add entry to linked-list */
-		if (rtable == NULL) {
-			/* This is the first interface to be added */
-			rtable = entry;
-		} else {
-			/* One or more interfaces were already added */
-			csp_rtable_t * i = rtable;
-			while (i->next)
-				i = i->next;
-			i->next = entry;
-		}
-	}
+	csp_rtable_lock();
+	int ret = csp_rtable_set_rule(_address, _netmask, ifc, mac);
+	if (ret == CSP_ERR_NONE)
+		csp_rtable_compile();
+	csp_rtable_unlock();
 
-	/* Fill in the data */
-	entry->address = address;
-	entry->netmask = netmask;
-	entry->interface = ifc;
-	entry->mac = mac;
-
-	return CSP_ERR_NONE;
+	return ret;
 }
 
 void csp_rtable_print(void) {
 
+	csp_rtable_lock();
 	for (csp_rtable_t * i = rtable; (i); i = i->next) {
 		if (i->mac == 255) {
 			printf("%u/%u %s\r\n", i->address, i->netmask, i->interface->name);
@@ -227,6 +311,7 @@ void csp_rtable_print(void) {
 			printf("%u/%u %s %u\r\n", i->address, i->netmask, i->interface->name, i->mac);
 		}
 	}
+	csp_rtable_unlock();
 
 }
 
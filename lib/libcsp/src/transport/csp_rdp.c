@@ -40,6 +40,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include "../csp_port.h"
 #include "../csp_conn.h"
 #include "../csp_io.h"
+#include "../csp_qfifo.h"
+#include "../csp_timer.h"
 #include "csp_transport.h"
 
 #ifdef CSP_USE_RDP
@@ -49,6 +51,10 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #define RDP_EAK 0x04
 #define RDP_RST	0x08
 
+/* Bounds of the retransmission timeout in ms, the packet timeout is the upper bound */
+#define RDP_RTO_MIN	100
+#define RDP_RTO_VAR_MIN	10
+
 static uint32_t csp_rdp_window_size = 4;
 static uint32_t csp_rdp_conn_timeout = 10000;
 static uint32_t csp_rdp_packet_timeout = 1000;
@@ -59,6 +65,9 @@ static uint32_t csp_rdp_ack_delay_count = 4 / 2;
 /* Used for queue calls */
 static CSP_BASE_TYPE pdTrue = 1;
 
+/* Connection timers, one wheel per router worker */
+static csp_timer_wheel_t rdp_timers[CSP_ROUTE_WORKERS_MAX];
+
 typedef struct __attribute__((__packed__)) {
 	/* The timestamp is placed in the padding bytes */
 	uint8_t padding[CSP_PADDING_BYTES - 2 * sizeof(uint32_t)];
@@ -149,6 +158,168 @@ static inline int csp_rdp_time_after(uint32_t time, uint32_t cmp) {
 	return csp_rdp_time_before(cmp, time);
 }
 
+/**
+ * TIMERS
+ * Each connection has one timer, armed at the earliest of its timeouts.
+ * It runs in the router worker that receives the packets of the connection,
+ * which is the only task touching the RDP state besides the user task.
+ */
+static inline void csp_rdp_timer_arm(csp_conn_t * conn, uint32_t expires) {
+	csp_timer_arm(&rdp_timers[csp_qfifo_shard(conn->idin.ext)], &conn->rdp.timer, expires);
+}
+
+/* Earliest of the connection, close-wait and ACK timeouts.
+ * Returns 0 if none of them are pending */
+static int csp_rdp_conn_deadline(csp_conn_t * conn, uint32_t time_now, uint32_t * deadline) {
+
+	int pending = 0;
+
+	/* Not yet accepted by userspace, or waiting to close */
+	if (conn->socket != NULL || conn->rdp.state == RDP_CLOSE_WAIT) {
+		*deadline = conn->timestamp + conn->rdp.conn_timeout;
+		pending = 1;
+	}
+
+	/* Received segments not yet acknowledged */
+	if (conn->rdp.state == RDP_OPEN && conn->rdp.rcv_lsa != conn->rdp.rcv_cur) {
+		uint32_t ack = conn->rdp.ack_timestamp + conn->rdp.ack_timeout;
+		/* If the ACK is overdue the RX buffer is full, poll until it drains */
+		if (!conn->rdp.delayed_acks || !csp_rdp_time_after(ack, time_now))
+			ack = time_now + conn->rdp.ack_timeout;
+		if (!pending || csp_rdp_time_before(ack, *deadline))
+			*deadline = ack;
+		pending = 1;
+	}
+
+	return pending;
+
+}
+
+/**
+ * ROUND TRIP TIME AND WINDOW
+ * The retransmission timeout follows the measured round trip time (RFC 6298),
+ * starting at the negotiated packet timeout which is also its upper bound.
+ * Only one segment is timed at a time, and never a retransmitted one. The
+ * window in use grows by one segment per window acknowledged and is halved
+ * on loss, within the negotiated window and CSP_RDP_MAX_WINDOW.
+ */
+static inline uint32_t csp_rdp_window_max(csp_conn_t * conn) {
+	return conn->rdp.window_size < CSP_RDP_MAX_WINDOW ? conn->rdp.window_size : CSP_RDP_MAX_WINDOW;
+}
+
+/* With delayed ACKs the receiver waits for ack_delay_count + 1 segments
+ * before it ACKs, fewer in flight would stall until the ACK timeout */
+static inline uint32_t csp_rdp_window_min(csp_conn_t * conn) {
+	uint32_t min = conn->rdp.delayed_acks ? conn->rdp.ack_delay_count + 1 : 1;
+	return min < csp_rdp_window_max(conn) ? min : csp_rdp_window_max(conn);
+}
+
+/* Called once the sequence numbers and options of a connection are set */
+static void csp_rdp_rtt_init(csp_conn_t * conn) {
+	conn->rdp.srtt = 0;
+	conn->rdp.rttvar = 0;
+	conn->rdp.rto = conn->rdp.packet_timeout;
+	conn->rdp.rtt_timing = 0;
+	conn->rdp.recover = conn->rdp.snd_nxt;
+	conn->rdp.cwnd = csp_rdp_window_max(conn);
+	conn->rdp.cwnd_acked = 0;
+}
+
+static inline void csp_rdp_rtt_start(csp_conn_t * conn, uint16_t seq_nr, uint32_t timestamp) {
+	if (conn->rdp.rtt_timing)
+		return;
+	conn->rdp.rtt_seq = seq_nr;
+	conn->rdp.rtt_timestamp = timestamp;
+	conn->rdp.rtt_timing = 1;
+}
+
+static void csp_rdp_rtt_sample(csp_conn_t * conn, uint32_t rtt) {
+
+	if (rtt == 0)
+		rtt = 1;
+
+	if (conn->rdp.srtt == 0) {
+		conn->rdp.srtt = rtt;
+		conn->rdp.rttvar = rtt / 2;
+	} else {
+		uint32_t delta = (rtt > conn->rdp.srtt) ? rtt - conn->rdp.srtt : conn->rdp.srtt - rtt;
+		conn->rdp.rttvar = (3 * conn->rdp.rttvar + delta) / 4;
+		conn->rdp.srtt = (7 * conn->rdp.srtt + rtt) / 8;
+	}
+
+	uint32_t var = 4 * conn->rdp.rttvar;
+	conn->rdp.rto = conn->rdp.srtt + (var > RDP_RTO_VAR_MIN ? var : RDP_RTO_VAR_MIN);
+	if (conn->rdp.rto < RDP_RTO_MIN)
+		conn->rdp.rto = RDP_RTO_MIN;
+	if (conn->rdp.rto > conn->rdp.packet_timeout)
+		conn->rdp.rto = conn->rdp.packet_timeout;
+
+	csp_log_protocol("RDP: RTT %"PRIu32", srtt %"PRIu32", rttvar %"PRIu32", rto %"PRIu32,
+			rtt, conn->rdp.srtt, conn->rdp.rttvar, conn->rdp.rto);
+
+}
+
+/* snd_una moved from snd_una to conn->rdp.snd_una */
+static void csp_rdp_acked(csp_conn_t * conn, uint16_t snd_una, uint32_t time_now) {
+
+	if (!csp_rdp_seq_after(conn->rdp.snd_una, snd_una))
+		return;
+
+	if (conn->rdp.rtt_timing && csp_rdp_seq_after(conn->rdp.snd_una, conn->rdp.rtt_seq)) {
+		conn->rdp.rtt_timing = 0;
+		csp_rdp_rtt_sample(conn, time_now - conn->rdp.rtt_timestamp);
+	}
+
+	conn->rdp.cwnd_acked += (uint16_t)(conn->rdp.snd_una - snd_una);
+	if (conn->rdp.cwnd_acked >= conn->rdp.cwnd) {
+		conn->rdp.cwnd_acked -= conn->rdp.cwnd;
+		if (conn->rdp.cwnd < csp_rdp_window_max(conn))
+			conn->rdp.cwnd++;
+	}
+
+}
+
+/* Segment seq_nr was lost, halve the window at most once per window sent */
+static void csp_rdp_loss(csp_conn_t * conn, uint16_t seq_nr) {
+
+	if (csp_rdp_seq_before(seq_nr, conn->rdp.recover))
+		return;
+
+	conn->rdp.cwnd /= 2;
+	if (conn->rdp.cwnd < csp_rdp_window_min(conn))
+		conn->rdp.cwnd = csp_rdp_window_min(conn);
+	conn->rdp.cwnd_acked = 0;
+	conn->rdp.recover = conn->rdp.snd_nxt;
+	csp_log_protocol("RDP: Loss of seq %u, window %"PRIu32, seq_nr, conn->rdp.cwnd);
+
+}
+
+/* Send a copy of a segment held in the TX queue again */
+static void csp_rdp_retransmit(csp_conn_t * conn, rdp_packet_t * packet) {
+
+	rdp_header_t * header = csp_rdp_header_ref((csp_packet_t *) packet);
+
+	/* Update to latest outgoing ACK */
+	header->ack_nr = csp_hton16(conn->rdp.rcv_cur);
+
+	/* An ACK may now be for either copy, so it is no RTT sample */
+	conn->rdp.rtt_timing = 0;
+
+	/* Send copy to tx_queue */
+	packet->timestamp = csp_get_ms();
+	csp_packet_t * new_packet = csp_buffer_clone(packet);
+	if (new_packet == NULL) {
+		csp_log_warn("Retransmission failed");
+		return;
+	}
+	csp_iface_t * ifout = csp_rtable_find_iface(conn->idout.dst);
+	if (csp_send_direct(conn->idout, new_packet, ifout, 0) != CSP_ERR_NONE) {
+		csp_log_warn("Retransmission failed");
+		csp_buffer_free(new_packet);
+	}
+
+}
+
 /**
  * CONTROL MESSAGES
  * The following function is used to send empty messages,
@@ -180,8 +351,16 @@ static int csp_rdp_send_cmp(csp_conn_t * conn, csp_packet_t * packet, int flags,
 		rdp_packet_t * rdp_packet = csp_buffer_clone(packet);
 		if (rdp_packet == NULL) return CSP_ERR_NOMEM;
 		rdp_packet->timestamp = csp_get_ms();
-		if (csp_queue_enqueue(conn->rdp.tx_queue, &rdp_packet, 0) != CSP_QUEUE_OK)
+		if (csp_queue_enqueue(conn->rdp.tx_queue, &rdp_packet, 0) != CSP_QUEUE_OK) {
 			csp_buffer_free(rdp_packet);
+		} else {
+			/* A SYN sent again for a duplicate SYN is no RTT sample */
+			if (conn->rdp.rtt_timing && conn->rdp.rtt_seq == seq_nr)
+				conn->rdp.rtt_timing = 0;
+			else
+				csp_rdp_rtt_start(conn, seq_nr, rdp_packet->timestamp);
+			csp_rdp_timer_arm(conn, rdp_packet->timestamp + conn->rdp.rto);
+		}
 	}
 
 	/* Send control messages with high priority */
@@ -217,26 +396,18 @@ static int csp_rdp_send_eack(csp_conn_t * conn) {
 	if (packet_eack == NULL) return CSP_ERR_NOMEM;
 	packet_eack->length = 0;
 
-	/* Loop through RX queue */
-	int i, count;
-	csp_packet_t * packet;
-	count = csp_queue_size(conn->rdp.rx_queue);
-	for (i = 0; i < count; i++) {
-
-		if (csp_queue_dequeue_isr(conn->rdp.rx_queue, &packet, &pdTrue) != CSP_QUEUE_OK) {
-			csp_log_error("Cannot dequeue from rx_queue in queue deliver");
-			break;
+	/* Add the seq nr of every segment held out of order */
+	unsigned int i;
+	for (i = 0; i < CSP_RDP_RX_RING / 32; i++) {
+		uint32_t map = conn->rdp.rx_map[i];
+		while (map) {
+			csp_packet_t * packet = conn->rdp.rx_ring[i * 32 + __builtin_ctz(map)];
+			map &= map - 1;
+			rdp_header_t * header = csp_rdp_header_ref(packet);
+			packet_eack->data16[packet_eack->length/sizeof(uint16_t)] = csp_hton16(header->seq_nr);
+			packet_eack->length += sizeof(uint16_t);
+			csp_log_protocol("Added EACK nr %u", header->seq_nr);
 		}
-
-		/* Add seq nr to EACK packet */
-		rdp_header_t * header = csp_rdp_header_ref(packet);
-		packet_eack->data16[packet_eack->length/sizeof(uint16_t)] = csp_hton16(header->seq_nr);
-		packet_eack->length += sizeof(uint16_t);
-		csp_log_protocol("Added EACK nr %u", header->seq_nr);
-
-		/* Requeue */
-		csp_queue_enqueue_isr(conn->rdp.rx_queue, &packet, &pdTrue);
-
 	}
 
 	return csp_rdp_send_cmp(conn, packet_eack, RDP_ACK | RDP_EAK, conn->rdp.snd_nxt, conn->rdp.rcv_cur);
@@ -298,76 +469,38 @@ static inline int csp_rdp_receive_data(csp_conn_t * conn, csp_packet_t * packet)
 
 }
 
-static inline void csp_rdp_rx_queue_flush(csp_conn_t * conn) {
-
-	/* Loop through RX queue */
-	int i, count;
-	csp_packet_t * packet;
-
-front:
-	count = csp_queue_size(conn->rdp.rx_queue);
-	for (i = 0; i < count; i++) {
-
-		if (csp_queue_dequeue_isr(conn->rdp.rx_queue, &packet, &pdTrue) != CSP_QUEUE_OK) {
-			csp_log_error("Cannot dequeue from rx_queue in queue deliver");
-			break;
-		}
-
-		rdp_header_t * header = csp_rdp_header_ref(packet);
-		csp_log_protocol("RX Queue deliver matching Element, seq %u", header->seq_nr);
-
-		/* If the matching packet was found: */
-		if (header->seq_nr == (uint16_t)(conn->rdp.rcv_cur + 1)) {
-			csp_log_protocol("Deliver seq %u", header->seq_nr);
-			csp_rdp_receive_data(conn, packet);
-			conn->rdp.rcv_cur++;
-			/* Loop from first element again */
-			goto front;
-
-		/* Otherwise, requeue */
-		} else {
-			csp_queue_enqueue_isr(conn->rdp.rx_queue, &packet, &pdTrue);
-		}
-
-	}
-
+static inline bool csp_rdp_rx_ring_test(csp_conn_t * conn, unsigned int slot) {
+	return conn->rdp.rx_map[slot / 32] & (1U << (slot % 32));
 }
 
-static inline bool csp_rdp_seq_in_rx_queue(csp_conn_t * conn, uint16_t seq_nr) {
-
-	/* Loop through RX queue */
-	int i, count;
-	rdp_packet_t * packet;
-	count = csp_queue_size(conn->rdp.rx_queue);
-	for (i = 0; i < count; i++) {
-
-		if (csp_queue_dequeue_isr(conn->rdp.rx_queue, &packet, &pdTrue) != CSP_QUEUE_OK) {
-			csp_log_error("Cannot dequeue from rx_queue in queue exists");
-			break;
-		}
-
-		csp_queue_enqueue_isr(conn->rdp.rx_queue, &packet, &pdTrue);
-
-		rdp_header_t * header = csp_rdp_header_ref((csp_packet_t *) packet);
-		csp_log_protocol("RX Queue exists matching Element, seq %u", header->seq_nr);
-
-		/* If the matching packet was found, deliver */
-		if (header->seq_nr == seq_nr) {
-			csp_log_protocol("We have a match");
-			return true;
-		}
+static inline void csp_rdp_rx_queue_flush(csp_conn_t * conn) {
 
+	/* Deliver segments held out of order, as long as they are in sequence */
+	unsigned int slot = (uint16_t)(conn->rdp.rcv_cur + 1) % CSP_RDP_RX_RING;
+	while (csp_rdp_rx_ring_test(conn, slot)) {
+		csp_packet_t * packet = conn->rdp.rx_ring[slot];
+		conn->rdp.rx_map[slot / 32] &= ~(1U << (slot % 32));
+		csp_log_protocol("Deliver seq %u", csp_rdp_header_ref(packet)->seq_nr);
+		csp_rdp_receive_data(conn, packet);
+		conn->rdp.rcv_cur++;
+		slot = (slot + 1) % CSP_RDP_RX_RING;
 	}
 
-	return false;
-
 }
 
 static inline int csp_rdp_rx_queue_add(csp_conn_t * conn, csp_packet_t * packet, uint16_t seq_nr) {
 
-	if (csp_rdp_seq_in_rx_queue(conn, seq_nr))
+	/* Beyond the ring if the peer asked for a window larger than ours */
+	if ((uint16_t)(seq_nr - conn->rdp.rcv_cur) >= CSP_RDP_RX_RING)
+		return CSP_QUEUE_FULL;
+
+	unsigned int slot = seq_nr % CSP_RDP_RX_RING;
+	if (csp_rdp_rx_ring_test(conn, slot))
 		return CSP_QUEUE_ERROR;
-	return csp_queue_enqueue_isr(conn->rdp.rx_queue, &packet, &pdTrue);
+
+	conn->rdp.rx_ring[slot] = packet;
+	conn->rdp.rx_map[slot / 32] |= 1U << (slot % 32);
+	return CSP_QUEUE_OK;
 
 }
 
@@ -376,6 +509,7 @@ static void csp_rdp_flush_eack(csp_conn_t * conn, csp_packet_t * eack_packet) {
 	/* Loop through TX queue */
 	int i, j, count;
 	rdp_packet_t * packet;
+	uint32_t time_now = csp_get_ms();
 	count = csp_queue_size(conn->rdp.tx_queue);
 	for (i = 0; i < count; i++) {
 
@@ -385,30 +519,33 @@ static void csp_rdp_flush_eack(csp_conn_t * conn, csp_packet_t * eack_packet) {
 		}
 
 		rdp_header_t * header = csp_rdp_header_ref((csp_packet_t *) packet);
-		csp_log_protocol("EACK compare element, time %u, seq %u", packet->timestamp, csp_ntoh16(header->seq_nr));
+		uint16_t seq_nr = csp_ntoh16(header->seq_nr);
+		csp_log_protocol("EACK compare element, time %u, seq %u", packet->timestamp, seq_nr);
 
-		/* Look for this element in EACKs */
-		int match = 0;
+		/* Look for this element in EACKs, an unacknowledged segment
+		 * before an EACKed one is missing at the receiver */
+		int match = 0, missing = 0;
 		for (j = 0; j < (int)((eack_packet->length - sizeof(rdp_header_t)) / sizeof(uint16_t)); j++) {
-			if (csp_ntoh16(eack_packet->data16[j]) == csp_ntoh16(header->seq_nr))
+			uint16_t eack = csp_ntoh16(eack_packet->data16[j]);
+			if (eack == seq_nr)
 				match = 1;
-
-			/* Enable this if you want EACK's to trigger retransmission */
-			if (csp_ntoh16(eack_packet->data16[j]) > csp_ntoh16(header->seq_nr)) {
-				uint32_t time_now = csp_get_ms();
-				if (csp_rdp_time_after(time_now, packet->quarantine)) {
-					packet->timestamp = time_now - conn->rdp.packet_timeout - 1;
-					packet->quarantine = time_now +	conn->rdp.packet_timeout / 2;
-				}
-			}
+			else if (csp_rdp_seq_after(eack, seq_nr) && !csp_rdp_seq_before(seq_nr, conn->rdp.snd_una))
+				missing = 1;
 		}
 
 		if (match == 0) {
-			/* If not found, put back on tx queue */
+			/* Fast retransmit, unless already done for a recent EACK */
+			if (missing && csp_rdp_time_after(time_now, packet->quarantine)) {
+				csp_log_protocol("EACK fast retransmit seq %u", seq_nr);
+				csp_rdp_loss(conn, seq_nr);
+				csp_rdp_retransmit(conn, packet);
+				packet->quarantine = time_now + conn->rdp.rto;
+			}
+			/* Put back on tx queue */
 			csp_queue_enqueue(conn->rdp.tx_queue, &packet, 0);
 		} else {
 			/* Found, free */
-			csp_log_protocol("TX Element %u freed", csp_ntoh16(header->seq_nr));
+			csp_log_protocol("TX Element %u freed", seq_nr);
 			csp_buffer_free(packet);
 		}
 
@@ -449,6 +586,8 @@ void csp_rdp_flush_all(csp_conn_t * conn) {
 
 	rdp_packet_t * packet;
 
+	csp_timer_cancel(&rdp_timers[csp_qfifo_shard(conn->idin.ext)], &conn->rdp.timer);
+
 	/* Empty TX queue */
 	while (csp_queue_dequeue_isr(conn->rdp.tx_queue, &packet, &pdTrue) == CSP_QUEUE_OK) {
 		if (packet != NULL) {
@@ -457,10 +596,15 @@ void csp_rdp_flush_all(csp_conn_t * conn) {
 		}
 	}
 
-	/* Empty RX queue */
-	while (csp_queue_dequeue_isr(conn->rdp.rx_queue, &packet, &pdTrue) == CSP_QUEUE_OK) {
-		if (packet != NULL) {
-			csp_log_protocol("Flush RX Element, time %u, seq %u", packet->timestamp, csp_ntoh16(csp_rdp_header_ref((csp_packet_t *) packet)->seq_nr));
+	/* Empty RX ring */
+	unsigned int i;
+	for (i = 0; i < CSP_RDP_RX_RING / 32; i++) {
+		uint32_t map = conn->rdp.rx_map[i];
+		conn->rdp.rx_map[i] = 0;
+		while (map) {
+			packet = (rdp_packet_t *) conn->rdp.rx_ring[i * 32 + __builtin_ctz(map)];
+			map &= map - 1;
+			csp_log_protocol("Flush RX Element, seq %u", csp_rdp_header_ref((csp_packet_t *) packet)->seq_nr);
 			csp_buffer_free(packet);
 		}
 	}
@@ -487,14 +631,16 @@ int csp_rdp_check_ack(csp_conn_t * conn) {
 }
 
 /**
- * This function must be called with regular intervals for the
- * RDP protocol to work as expected. This takes care of closing
- * stale connections and retransmitting traffic. A good place to
- * call this function is from the CSP router task.
+ * Called from the connection timer when a timeout is due. This takes care
+ * of closing stale connections, retransmitting traffic and delayed ACKs,
+ * then arms the timer for the next timeout.
  */
 void csp_rdp_check_timeouts(csp_conn_t * conn) {
 
 	rdp_packet_t * packet;
+	uint32_t deadline = 0;
+	int pending = 0;
+	bool backoff = false;
 
 	/**
 	 * CONNECTION TIMEOUT:
@@ -517,6 +663,8 @@ void csp_rdp_check_timeouts(csp_conn_t * conn) {
 		if (csp_rdp_time_after(time_now, conn->timestamp + conn->rdp.conn_timeout)) {
 			csp_log_protocol("CLOSE_WAIT timeout");
 			csp_close(conn);
+		} else {
+			csp_rdp_timer_arm(conn, conn->timestamp + conn->rdp.conn_timeout);
 		}
 		return;
 	}
@@ -545,23 +693,26 @@ void csp_rdp_check_timeouts(csp_conn_t * conn) {
 		}
 
 		/* Check timestamp and retransmit if needed */
-		if (csp_rdp_time_after(time_now, packet->timestamp + conn->rdp.packet_timeout)) {
+		if (csp_rdp_time_after(time_now, packet->timestamp + conn->rdp.rto)) {
 			csp_log_protocol("TX Element timed out, retransmitting seq %u", csp_ntoh16(header->seq_nr));
 
-			/* Update to latest outgoing ACK */
-			header->ack_nr = csp_hton16(conn->rdp.rcv_cur);
-
-			/* Send copy to tx_queue */
-			packet->timestamp = csp_get_ms();
-			csp_packet_t * new_packet = csp_buffer_clone(packet);
-			csp_iface_t * ifout = csp_rtable_find_iface(conn->idout.dst);
-			if (csp_send_direct(conn->idout, new_packet, ifout, 0) != CSP_ERR_NONE) {
-				csp_log_warn("Retransmission failed");
-				csp_buffer_free(new_packet);
+			/* Back off once for all segments timing out together */
+			if (!backoff) {
+				backoff = true;
+				conn->rdp.rto = (conn->rdp.rto < conn->rdp.packet_timeout / 2) ? conn->rdp.rto * 2 : conn->rdp.packet_timeout;
+				csp_rdp_loss(conn, csp_ntoh16(header->seq_nr));
 			}
 
+			csp_rdp_retransmit(conn, packet);
+
 		}
 
+		/* Earliest retransmission */
+		uint32_t expires = packet->timestamp + conn->rdp.rto;
+		if (!pending || csp_rdp_time_before(expires, deadline))
+			deadline = expires;
+		pending = 1;
+
 		/* Requeue the TX element */
 		csp_queue_enqueue_isr(conn->rdp.tx_queue, &packet, &pdTrue);
 
@@ -575,14 +726,65 @@ void csp_rdp_check_timeouts(csp_conn_t * conn) {
 
 	/* Wake user task if TX queue is ready for more data */
 	if (conn->rdp.state == RDP_OPEN)
-		if (csp_queue_size(conn->rdp.tx_queue) < (int)conn->rdp.window_size)
+		if (csp_queue_size(conn->rdp.tx_queue) < (int)conn->rdp.cwnd)
 			if (csp_rdp_seq_before(conn->rdp.snd_nxt - conn->rdp.snd_una, conn->rdp.window_size * 2))
 				csp_bin_sem_post(&conn->rdp.tx_wait);
 
+	/* Arm for the next timeout. The timer only moves earlier, so a segment
+	 * queued by the user task meanwhile keeps its own deadline */
+	uint32_t conn_deadline;
+	if (csp_rdp_conn_deadline(conn, time_now, &conn_deadline))
+		if (!pending || csp_rdp_time_before(conn_deadline, deadline)) {
+			deadline = conn_deadline;
+			pending = 1;
+		}
+	if (pending)
+		csp_rdp_timer_arm(conn, deadline);
+
+}
+
+static void csp_rdp_timer_expired(void * arg) {
+
+	csp_conn_t * conn = arg;
+
+	/* The connection may have been closed while the timer was due */
+	if (conn->state == CONN_OPEN && (conn->idin.flags & CSP_FRDP))
+		csp_rdp_check_timeouts(conn);
+
+}
+
+void csp_rdp_check_timers(int worker) {
+
+	csp_timer_run(&rdp_timers[worker], csp_get_ms());
+
+}
+
+/* Arm the timer for whatever a received packet left pending */
+static void csp_rdp_timer_rx(csp_conn_t * conn, uint16_t snd_una) {
+
+	uint32_t time_now, deadline;
+
+	if (conn->state != CONN_OPEN)
+		return;
+
+	/* Free acknowledged segments and wake the sender right away, this
+	 * also re-arms the timer */
+	time_now = csp_get_ms();
+	if (conn->rdp.snd_una != snd_una) {
+		csp_rdp_acked(conn, snd_una, time_now);
+		csp_rdp_check_timeouts(conn);
+		return;
+	}
+
+	if (csp_rdp_conn_deadline(conn, time_now, &deadline))
+		csp_rdp_timer_arm(conn, deadline);
+
 }
 
 void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 
+	uint16_t snd_una = conn->rdp.snd_una;
+
 	/* Get RX header and convert to host byte-order */
 	rdp_header_t * rx_header = csp_rdp_header_ref(packet);
 	rx_header->ack_nr = csp_ntoh16(rx_header->ack_nr);
@@ -662,6 +864,7 @@ void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 				conn->rdp.window_size, conn->rdp.conn_timeout, conn->rdp.packet_timeout);
 		csp_log_protocol("RDP: Delayed acks: %u, ack timeout %u, ack each %u packet",
 				conn->rdp.delayed_acks, conn->rdp.ack_timeout, conn->rdp.ack_delay_count);
+		csp_rdp_rtt_init(conn);
 
 		/* Connection accepted */
 		conn->rdp.state = RDP_SYN_RCVD;
@@ -790,7 +993,7 @@ void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 		/* If message is not in sequence, send EACK and store packet */
 		if (rx_header->seq_nr != (uint16_t)(conn->rdp.rcv_cur + 1)) {
 			if (csp_rdp_rx_queue_add(conn, packet, rx_header->seq_nr) != CSP_QUEUE_OK) {
-				csp_log_protocol("Duplicate sequence number");
+				csp_log_protocol("Duplicate or out of range sequence number");
 				goto discard_open;
 			}
 			csp_rdp_send_eack(conn);
@@ -861,7 +1064,7 @@ discard_close:
 discard_open:
 	csp_buffer_free(packet);
 accepted_open:
-	return;
+	csp_rdp_timer_rx(conn, snd_una);
 
 }
 
@@ -891,6 +1094,7 @@ retry:
 
 	conn->rdp.snd_nxt = conn->rdp.snd_iss + 1;
 	conn->rdp.snd_una = conn->rdp.snd_iss;
+	csp_rdp_rtt_init(conn);
 
 	csp_log_protocol("RDP: AC: Sending SYN");
 
@@ -940,7 +1144,7 @@ int csp_rdp_send(csp_conn_t * conn, csp_packet_t * packet, uint32_t timeout) {
 	}
 
 	/* If TX window is full, wait here */
-	while (csp_rdp_seq_after(conn->rdp.snd_nxt, conn->rdp.snd_una + (uint16_t)conn->rdp.window_size)) {
+	while (csp_rdp_seq_after(conn->rdp.snd_nxt, conn->rdp.snd_una + (uint16_t)conn->rdp.cwnd)) {
 		csp_log_protocol("RDP: Waiting for window update before sending seq %u", conn->rdp.snd_nxt);
 		csp_bin_sem_wait(&conn->rdp.tx_wait, 0);
 		if ((csp_bin_sem_wait(&conn->rdp.tx_wait, conn->rdp.conn_timeout)) != CSP_SEMAPHORE_OK) {
@@ -974,6 +1178,8 @@ int csp_rdp_send(csp_conn_t * conn, csp_packet_t * packet, uint32_t timeout) {
 		csp_buffer_free(rdp_packet);
 		return CSP_ERR_NOBUFS;
 	}
+	csp_rdp_rtt_start(conn, conn->rdp.snd_nxt, rdp_packet->timestamp);
+	csp_rdp_timer_arm(conn, rdp_packet->timestamp + conn->rdp.rto);
 
 	csp_log_protocol("RDP: Sending  in S %u: syn %u, ack %u, eack %u, "
 				"rst %u, seq_nr %5u, ack_nr %5u, packet_len %u (%u)",
@@ -986,6 +1192,17 @@ int csp_rdp_send(csp_conn_t * conn, csp_packet_t * packet, uint32_t timeout) {
 
 }
 
+int csp_rdp_init(void) {
+
+	int i;
+	for (i = 0; i < CSP_ROUTE_WORKERS_MAX; i++)
+		if (csp_timer_wheel_init(&rdp_timers[i], csp_get_ms()) != CSP_ERR_NONE)
+			return CSP_ERR_NOMEM;
+
+	return CSP_ERR_NONE;
+
+}
+
 int csp_rdp_allocate(csp_conn_t * conn) {
 
 	csp_log_buffer("RDP: Creating RDP queues for conn %p", conn);
@@ -994,6 +1211,8 @@ int csp_rdp_allocate(csp_conn_t * conn) {
 	conn->rdp.state = RDP_CLOSED;
 	conn->rdp.conn_timeout = csp_rdp_conn_timeout;
 	conn->rdp.packet_timeout = csp_rdp_packet_timeout;
+	conn->rdp.rto = csp_rdp_packet_timeout;
+	csp_timer_init(&conn->rdp.timer, csp_rdp_timer_expired, conn);
 
 	/* Create a binary semaphore to wait on for tasks */
 	if (csp_bin_sem_create(&conn->rdp.tx_wait) != CSP_SEMAPHORE_OK) {
@@ -1009,14 +1228,8 @@ int csp_rdp_allocate(csp_conn_t * conn) {
 		return CSP_ERR_NOMEM;
 	}
 
-	/* Create RX queue */
-	conn->rdp.rx_queue = csp_queue_create(CSP_RDP_MAX_WINDOW * 2, sizeof(csp_packet_t *));
-	if (conn->rdp.rx_queue == NULL) {
-		csp_log_error("Failed to create RX queue for conn");
-		csp_bin_sem_remove(&conn->rdp.tx_wait);
-		csp_queue_remove(conn->rdp.tx_queue);
-		return CSP_ERR_NOMEM;
-	}
+	/* Out of order segments are kept in rx_ring */
+	memset(conn->rdp.rx_map, 0, sizeof(conn->rdp.rx_map));
 
 	return CSP_ERR_NONE;
 
@@ -1036,6 +1249,7 @@ int csp_rdp_close(csp_conn_t * conn) {
 		conn->rdp.state = RDP_CLOSE_WAIT;
 		conn->timestamp = csp_get_ms();
 		csp_rdp_send_cmp(conn, NULL, RDP_ACK | RDP_RST, conn->rdp.snd_nxt, conn->rdp.rcv_cur);
+		csp_rdp_timer_arm(conn, conn->timestamp + conn->rdp.conn_timeout);
 		csp_log_protocol("RDP Close, sent RST on conn %p", conn);
 		return CSP_ERR_AGAIN;
 	}
@@ -1087,8 +1301,9 @@ void csp_rdp_conn_print(csp_conn_t * conn) {
 	if (conn == NULL)
 		return;
 
-	printf("\tRDP: State %"PRIu16", rcv %"PRIu16", snd %"PRIu16", win %"PRIu32"\r\n",
-			conn->rdp.state, conn->rdp.rcv_cur, conn->rdp.snd_una, conn->rdp.window_size);
+	printf("\tRDP: State %"PRIu16", rcv %"PRIu16", snd %"PRIu16", win %"PRIu32"/%"PRIu32", srtt %"PRIu32", rto %"PRIu32"\r\n",
+			conn->rdp.state, conn->rdp.rcv_cur, conn->rdp.snd_una, conn->rdp.cwnd, conn->rdp.window_size,
+			conn->rdp.srtt, conn->rdp.rto);
 
 }
 #endif
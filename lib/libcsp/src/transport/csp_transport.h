@@ -37,6 +37,8 @@ void csp_rdp_conn_print(csp_conn_t * conn);
 int csp_rdp_send(csp_conn_t * conn, csp_packet_t * packet, uint32_t timeout);
 int csp_rdp_check_ack(csp_conn_t * conn);
 void csp_rdp_check_timeouts(csp_conn_t * conn);
+int csp_rdp_init(void);
+void csp_rdp_check_timers(int worker);
 void csp_rdp_flush_all(csp_conn_t * conn);
 
 #ifdef __cplusplus
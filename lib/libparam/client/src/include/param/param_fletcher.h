@@ -1,6 +1,8 @@
 #ifndef PARAM_PARAM_FLETCHER_H_
 #define PARAM_PARAM_FLETCHER_H_
 
+#include <csp/csp_checksum.h>
+
 uint16_t fletcher16_memcpy(uint8_t *data, int count, void * (*memcpyfcn)(void *, const void *, size_t));
 
 #ifdef __AVR__
@@ -18,7 +20,7 @@ static inline uint16_t fletcher16_P(uint8_t* data, int count) {
 #endif
 
 static inline uint16_t fletcher16(uint8_t* data, int count) {
-	return fletcher16_memcpy(data, count, NULL);
+	return csp_fletcher16(data, count);
 }
 
 #endif /* PARAM_FLETCHER_H_ */
@@ -1,5 +1,6 @@
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
 
 #include <util/log.h>
 #include <csp/csp_cmp.h>
@@ -14,6 +15,9 @@
 #include "serial_rotator.h"
 #include "doppler_freq_correction.h"
 #include "gui_backend.h"
+#include "pass_calendar.h"
+#include "pass_ephem.h"
+#include "rparam_async.h"
 
 /* GS100/AX100 configuration parameter*/
 #define AX100_PORT_RPARAM	7	/* task_server remote param port */
@@ -49,8 +53,15 @@
 #define CUBESAT_TLE_URL "https://celestrak.org/NORAD/elements/gp.php?INTDES=2023-057&FORMAT=tle"
 #define TLE_LINE_SIZE 		120	/* Length of TLE line */
 #define TLE_UPDATE_INTERVAL 	86400	/* Update TLE 24 hrs */
-#define DOPPLER_UPDATE_INTERVAL	2	/* Update doppler shift correction interval */
+#define DOPPLER_UPDATE_INTERVAL	2	/* Auto ping interval during a pass */
+#define DOPPLER_STEP_RATE	5	/* Default frequency steps per second in a pass */
+#define DOPPLER_STEP_RATE_MAX	20
+#define DOPPLER_STEP_MIN_HZ	50	/* Skip a step smaller than this */
 #define TNOW_OFFSET		1200	/* Time offset 20 mins for pre-AOS time tracking*/
+#define DOPPLER_POSITION_INTERVAL	10	/* Full propagation for the GUI position */
+#define PASS_EPHEM_FILE		"pass_ephem.bin"	/* Stored next to tle.txt */
+#define PASS_CALENDAR_INTERVAL	60	/* Publish the pass schedule every minute */
+#define PASS_CALENDAR_RELOAD	3600	/* Re-read tle.txt into the calendar hourly */
 
 /* UHF Ground Station Position*/
 /* Reference location: https://inetapps.nus.edu.sg/fas/geog/stationInfo.aspx */
@@ -68,8 +79,25 @@ static char TLE2[TLE_LINE_SIZE] = "";
 static int TXfreq = 0;
 static int RXfreq = 0;
 static uint32_t sat_no = 1;	// Initialisation tracking Lumelite 1
-
-static void doppler_tracking(int txfreq, int rxfreq, uint32_t tnow);
+static uint32_t track_element_id = 0;	/* Norad id of the tracked satellite */
+static pass_ephem_t pass_ephem;		/* Look angles of the pass being tracked */
+static int doppler_step_rate = DOPPLER_STEP_RATE;
+
+/* Frequency step scheduling statistics of the current pass */
+static struct {
+	uint32_t tx_freq;	/* last frequency sent */
+	uint32_t rx_freq;
+	double ping_time;
+	unsigned int steps;
+	unsigned int skipped;	/* change below DOPPLER_STEP_MIN_HZ */
+	unsigned int missed;	/* deadlines passed while busy */
+	unsigned int failed;	/* sets not acknowledged by the AX100 */
+	double jitter_sum;	/* wake up delay after deadline, ms */
+	double jitter_max;
+} doppler_stats;
+
+static void doppler_tracking(int txfreq, int rxfreq, double tnow);
+static void pass_ephem_prepare(long time_aos, long time_los);
 int mcs_sat_sel(uint32_t sat_no_sel);
 int ping_sat_func(void);
 
@@ -153,6 +181,80 @@ int ax100_set_rx_freq(uint8_t node, uint32_t timeout, uint32_t freq)
 }
 
 
+/* Search an open TLE file for a satellite. The two lines are copied to
+ * tle1 and tle2 (TLE_LINE_SIZE), the satellite name to name if given. */
+static int tle_find(FILE * tlefile, uint32_t elementid, char * tle1, char * tle2, char * name)
+{
+	char match0[20];
+	char match1[20];
+	char prev[TLE_LINE_SIZE] = "";
+	int found = 0;
+	sprintf(match0, "%"PRIu32"U ", elementid);
+	sprintf(match1, "%"PRIu32" ", elementid);
+
+	/* Reset to first line */
+	rewind(tlefile);
+
+	/* For each line */
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t read;
+
+	while ((read = getline(&line, &len, tlefile)) != -1) 
+	{
+		strtok(line, "\r\n");
+		if (strstr(line, match0)) 
+		{
+			log_info("TLE1: %s", line);
+			strncpy(tle1, line, TLE_LINE_SIZE - 1);
+			if (name) {
+				strncpy(name, prev, 31);
+				name[31] = '\0';
+				/* Trim padding after the name */
+				for (int i = strlen(name) - 1; i >= 0 && name[i] == ' '; i--)
+					name[i] = '\0';
+			}
+			found |= 1;
+		}
+		if (strstr(line, match1)) 
+		{
+			log_info("TLE2: %s", line);
+			strncpy(tle2, line, TLE_LINE_SIZE - 1);
+			found |= 2;
+		}
+		strncpy(prev, line, TLE_LINE_SIZE - 1);
+	}
+	free(line);
+
+	return found == 3;
+}
+
+/* Load all configured satellites from tle.txt into the pass calendar */
+static void pass_calendar_load(void)
+{
+	static const uint32_t element_ids[MAX_SAT_SIZE] = { Lumelite_1, Lumelite_2, Lumelite_3 };
+	char name[32];
+	char tle1[TLE_LINE_SIZE] = "";
+	char tle2[TLE_LINE_SIZE] = "";
+
+	FILE * tlefile = fopen("tle.txt", "rb");
+	if (!tlefile)
+	{
+		log_error("Error opening TLE file tle.txt");
+		return;
+	}
+
+	for (int i = 0; i < MAX_SAT_SIZE; i++)
+	{
+		if (tle_find(tlefile, element_ids[i], tle1, tle2, name))
+			pass_calendar_set_sat(element_ids[i], name, tle1, tle2);
+		else
+			log_debug("Satellite %"PRIu32" not in tle.txt", element_ids[i]);
+	}
+
+	fclose(tlefile);
+}
+
 static void * tleupdate(int element_id)
 {
 	/* Two options are proposed: First one is to get all TLE file from Celetrak and
@@ -206,34 +308,7 @@ static void * tleupdate(int element_id)
 	}
 
 	/* Searching for target satellite TLE */
-	char match0[20];
-	char match1[20];
-	sprintf(match0, "%"PRIu32"U ", elementid);
-	sprintf(match1, "%"PRIu32" ", elementid);
-
-	/* Reset to first line */
-	rewind(tlefile);
-
-	/* For each line */
-	char *line = NULL;
-	size_t len = 0;
-	ssize_t read;
-
-	while ((read = getline(&line, &len, tlefile)) != -1) 
-	{
-		strtok(line, "\r\n");
-		if (strstr(line, match0)) 
-		{
-			log_info("TLE1: %s", line);
-			strncpy(TLE1, line, len);
-		}
-		if (strstr(line, match1)) 
-		{
-			log_info("TLE2: %s", line);
-			strncpy(TLE2, line, len);
-		}
-	}
-	free(line);
+	tle_find(tlefile, elementid, TLE1, TLE2, NULL);
 	fclose(tlefile);
 
 	if (strlen(TLE1) == 0)
@@ -247,6 +322,9 @@ static void * tleupdate(int element_id)
 		log_error("Track satellite: Invalid TLE");
 		log_error("TLE1: '%s'", TLE1 );
 		log_error("TLE2: '%s'", TLE2 );
+	} else {
+		/* Passes are recomputed only if the TLE epoch changed */
+		pass_calendar_set_sat(elementid, NULL, TLE1, TLE2);
 	}
 
 	log_warning("TLE update done");
@@ -258,6 +336,27 @@ int updatetle(void) {
 	return 1;
 }
 
+static double doppler_time_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double doppler_timespec_ms(const struct timespec *ts)
+{
+	return ts->tv_sec * 1e3 + ts->tv_nsec / 1e6;
+}
+
+static void doppler_timespec_add(struct timespec *ts, long ns)
+{
+	ts->tv_nsec += ns;
+	while (ts->tv_nsec >= 1000000000L) {
+		ts->tv_nsec -= 1000000000L;
+		ts->tv_sec++;
+	}
+}
+
 //static void ground_pass_in_progress(long time_aos,long time_los, int azi_offset)
 static void ground_pass_in_progress(long time_aos,long time_los)
 {
@@ -267,31 +366,58 @@ static void ground_pass_in_progress(long time_aos,long time_los)
 		return;
 	}
 	
-	/* Get current time in CSP_timestamp*/
-	csp_timestamp_t clock;
-	clock_get_time(&clock);
-	uint32_t tnow = clock.tv_sec;
+	/* Wall clock time with sub-second resolution */
+	double tnow = doppler_time_now();
 	long tnowl = tnow;
 
-	if (tnowl >= time_aos && tnowl <= time_los)
+	if (tnow >= time_aos && tnow <= time_los)
 	{
 		log_warning("Ground pass begin: %.24s", ctime((time_t *) &tnowl));
-		
-		while (tnowl < time_los)
-		{
-			clock_get_time(&clock);
-			tnow = clock.tv_sec;
-			tnowl = tnow;
 
+		pass_ephem_prepare(time_aos, time_los);
+		memset(&doppler_stats, 0, sizeof(doppler_stats));
+
+		/* Steps run on absolute deadlines of a monotonic clock, so time
+		 * spent in the radio and rotator calls does not add up as drift */
+		long period = 1000000000L / doppler_step_rate;
+		struct timespec deadline, wake;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+		while (tnow < time_los)
+		{
 			/* Command GS100 with doppler shift correction freq */
 			doppler_tracking(TXfreq, RXfreq, tnow);
-			sleep(DOPPLER_UPDATE_INTERVAL);
+
+			/* Next deadline, deadlines already passed are dropped */
+			doppler_timespec_add(&deadline, period);
+			clock_gettime(CLOCK_MONOTONIC, &wake);
+			while (doppler_timespec_ms(&wake) > doppler_timespec_ms(&deadline)) {
+				doppler_timespec_add(&deadline, period);
+				doppler_stats.missed++;
+			}
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+				;
+
+			clock_gettime(CLOCK_MONOTONIC, &wake);
+			double jitter = doppler_timespec_ms(&wake) - doppler_timespec_ms(&deadline);
+			doppler_stats.jitter_sum += jitter;
+			if (jitter > doppler_stats.jitter_max)
+				doppler_stats.jitter_max = jitter;
+
+			tnow = doppler_time_now();
 		}
+		tnowl = tnow;
+
 		// Reset to idle pointing orientation (STAR centre) after ground pass
 		//if(serial_set_az_el(70,0,0) < 1)
 		if(serial_set_az_el(70,0) < 1)
 			log_debug("AZEL reset AZ: 150 EL: 0 failed");
 		log_warning("Ground pass ended: %.24s", ctime((time_t *) &tnowl));
+		log_info("Doppler steps: %u at %d Hz, %u skipped, %u failed, %u deadlines missed, jitter avg %.2f ms max %.2f ms",
+				doppler_stats.steps, doppler_step_rate, doppler_stats.skipped, doppler_stats.failed,
+				doppler_stats.missed,
+				doppler_stats.steps ? doppler_stats.jitter_sum / doppler_stats.steps : 0.0,
+				doppler_stats.jitter_max);
 	}
 	return;
 }
@@ -299,9 +425,17 @@ static void ground_pass_in_progress(long time_aos,long time_los)
 void doppler_init()
 {
 	//Exit auto tracking sequence
+	//Rotator pointing and the doppler frequency stepping of a pass are
+	//disabled with it, remove this return to enable both
 	return;
 	
 	log_warning("Initialising doppler shift correction operation...");
+
+	/* Radio retuning during passes is sent from the rparam worker task.
+	 * Its only user is pass tracking, so it is started here and not
+	 * while tracking is disabled */
+	if (rparam_async_init() != 0)
+		log_error("Failed to start async rparam client, using blocking sets");
 	
 	/* Get current time in CSP_timestamp*/
 	csp_timestamp_t clock;
@@ -314,25 +448,11 @@ void doppler_init()
 
 	/* Update TLE for the target satellite.  */
 	mcs_sat_sel(sat_no); 
-	
+
 	long time_aos_prev = 0;
 
 	while (1)
 	{			
-		#define GUI_BACKEND_MAX_PASSES 10
-		gui_backend_pass_t passes[GUI_BACKEND_MAX_PASSES];
-		int idx = 0;
-		const char *sat_name = "Lumelite 4"; // Replace with actual satellite name if available
-		passes[idx++] = (gui_backend_pass_t){
-			.name = sat_name,
-			.aos_utc = time_aos,
-			.los_utc = time_los,
-			.duration_sec = (uint16_t)(time_los - time_aos),
-			.peak_elevation_deg = (uint16_t)ele_m,
-		};
-		gui_backend_update_pass_schedule(passes, idx);
-
-
 		/* Estimate next ground pass AOS and LOS time*/
 		set_calc_time(tnow - (TNOW_OFFSET));
 		PreCalc();
@@ -342,25 +462,15 @@ void doppler_init()
 		long time_aos = floor(86400.0 * (3651.0 + NextAOS()));
 		long time_los = floor(86400.0 * (3651.0 + FindLOS2()));
 
-		/* Find AZ at AOS */
-		set_calc_time(time_aos);
-		PreCalc();
-		Calc();
-		int azi_aos = get_azi();
-
-		/* Find AZ at LOS */
-		set_calc_time(time_los);
-		PreCalc();
-		Calc();
-		int azi_los = get_azi();
-		
-		/* Find Max Elevation */
+		/* Find AZ at AOS and LOS and the max elevation, in one batch */
 		long time_maxele = (time_aos+time_los)/2;
-		set_calc_time(time_maxele);
-		PreCalc();
-		Calc();
-		int azi_m = get_azi();
-		int ele_m = get_ele();
+		double look_time[3] = { time_aos, time_los, time_maxele };
+		double look_azi[3], look_ele[3];
+		CalcBatch(look_time, 3, look_azi, look_ele, NULL, NULL);
+		int azi_aos = look_azi[0];
+		int azi_los = look_azi[1];
+		int azi_m = look_azi[2];
+		int ele_m = look_ele[2];
 		// Offset for azimuth rotation range
 		//int azi_offset;
 		if(time_aos != time_aos_prev)
@@ -407,50 +517,107 @@ void doppler_init()
 	return;	
 }
 
-static void doppler_tracking(int txfreq, int rxfreq, uint32_t tnow)
+static void doppler_set_freq_done(int result, void * arg)
 {
-	
+	if (result == RPARAM_ASYNC_ERROR) {
+		__sync_fetch_and_add(&doppler_stats.failed, 1);
+		log_error("Failed to set Doppler Correction %s Freq. Please check GS100 avaliability", (const char *) arg);
+	}
+}
 
-	/* Update predicted timestamp */
-	set_calc_time(tnow);
+/* Queue a frequency set for the next rparam_async_submit() */
+static int doppler_set_freq_async(uint32_t freq, uint8_t table, const char * name)
+{
+	return rparam_async_set_uint32(freq, AX100_V3_RXTX_FREQ, table, AX100_V3_ADDRESS,
+			AX100_PORT_RPARAM, AX100_V3_TIMEOUT, doppler_set_freq_done, (void *) name);
+}
 
-	/**	This function copies TLE data from PREDICT's sat structure
-	*	to the SGP4 single dimensioned tle structure.
-	*	Must be run once before doing calc.	*/
-	PreCalc();
+/* Fit the look angles of the coming pass once, or reuse the stored fit
+ * when restarting during the same pass */
+static void pass_ephem_prepare(long time_aos, long time_los)
+{
+	if (pass_ephem_match(&pass_ephem, track_element_id, TLE1, time_aos, time_los))
+		return;
 
-	/* Repetively calculate and update the sat info */	
-	Calc();
+	if (pass_ephem_load(&pass_ephem, PASS_EPHEM_FILE)
+			&& pass_ephem_match(&pass_ephem, track_element_id, TLE1, time_aos, time_los)) {
+		log_info("Pass ephemeris restored from %s", PASS_EPHEM_FILE);
+		return;
+	}
 
-sat_info_t info = {};
-getSatInfo(&info);
+	memset(&pass_ephem, 0, sizeof(pass_ephem));
+	predict_ctx_t *ctx = predict_ctx_create();
+	if (ctx == NULL)
+		return;
 
-// Define and assign tle_epoch_time from sat_info or set to 0 if unavailable
-uint32_t tle_epoch_time = 0;
+	predict_set_station(ctx, LAT, LON, ALT);
+	if (predict_set_tle(ctx, TLE1, TLE2)) {
+		predict_precalc(ctx);
+		if (pass_ephem_build(&pass_ephem, ctx, track_element_id, TLE1, time_aos, time_los)) {
+			log_debug("Pass ephemeris: %d segments", pass_ephem.segments);
+			pass_ephem_save(&pass_ephem, PASS_EPHEM_FILE);
+		}
+	}
+	predict_ctx_destroy(ctx);
+}
+
+static void doppler_tracking(int txfreq, int rxfreq, double tnow)
+{
+	static double position_time;
+	pass_ephem_look_t look;
+
+	/* Look angles from the pass ephemeris, full propagation without one */
+	int fitted = pass_ephem_eval(&pass_ephem, tnow, &look);
+
+	if (!fitted || tnow - position_time >= DOPPLER_POSITION_INTERVAL) {
+		position_time = tnow;
+
+		/* Update predicted timestamp */
+		set_calc_time((long) tnow);
+
+		/**	This function copies TLE data from PREDICT's sat structure
+		*	to the SGP4 single dimensioned tle structure.
+		*	Must be run once before doing calc.	*/
+		PreCalc();
+
+		/* Repetively calculate and update the sat info */	
+		Calc();
+
+		sat_info_t info = {};
+		getSatInfo(&info);
+
+		// Define and assign tle_epoch_time from sat_info or set to 0 if unavailable
+		uint32_t tle_epoch_time = 0;
 #ifdef HAVE_TLE_EPOCH_IN_SAT_INFO
-tle_epoch_time = info.tle_epoch;
+		tle_epoch_time = info.tle_epoch;
 #endif
 
-gui_backend_satellite_t sat_info_struct = {
-	.norad_id = sat_no, // Use sat_no or the correct NORAD ID variable
-	.lat_deg = info.sat_lat,
-	.lon_deg = info.sat_lon,
-	.alt_km = info.sat_alt,
-	.velocity_km_s = info.sat_vel,
-	.range_km = info.sat_range,
-	.range_rate_km_s = info.sat_range_rate,
-	.tle_epoch = tle_epoch_time
-};
-gui_backend_update_satellite(&sat_info_struct);
+		gui_backend_satellite_t sat_info_struct = {
+			.norad_id = sat_no, // Use sat_no or the correct NORAD ID variable
+			.lat_deg = info.sat_lat,
+			.lon_deg = info.sat_lon,
+			.alt_km = info.sat_alt,
+			.velocity_km_s = info.sat_vel,
+			.range_km = info.sat_range,
+			.range_rate_km_s = info.sat_range_rate,
+			.tle_epoch = tle_epoch_time
+		};
+		gui_backend_update_satellite(&sat_info_struct);
+
+		log_info("Sat Latitude: %f, Longitude: %f, Altitude: %f km, Velocity: %f km/s",
+				info.sat_lat, info.sat_lon, info.sat_alt, info.sat_vel);
+
+		if (!fitted) {
+			look.azi = info.sat_azi;
+			look.ele = info.sat_ele;
+			look.range = info.sat_range;
+			look.range_rate = info.sat_range_rate;
+		}
+	}
 
-	
 	/* Get ground pass parameter */
-	double az = get_azi();
-	double el = get_ele();
-	double satlat = get_satlat();
-	double satlon = get_satlon();
-	double satalt = get_satalt();
-	double satvel = get_satvel();
+	double az = look.azi;
+	double el = look.ele;
 
 	/* Track satellite with AZ and EL */
 	int azi = az;
@@ -465,26 +632,47 @@ gui_backend_update_satellite(&sat_info_struct);
 	
 	/* Compute doppler frequency shift */
 	uint32_t rx_freq = 0;
-	rx_freq = comp_dopp_frq(rxfreq,0);
+	rx_freq = predict_dopp_frq(look.range_rate, rxfreq, 0);
 
 	uint32_t tx_freq = 0;
-	tx_freq = comp_dopp_frq(txfreq,1);
+	tx_freq = predict_dopp_frq(look.range_rate, txfreq, 1);
 
-	log_info("AZ: %f, EL: %f, RX: %"PRIu32" TX: %"PRIu32, az, el, rx_freq, tx_freq);
-	log_info("Sat Latitude: %f, Longitude: %f, Altitude: %f km, Velocity: %f km/s", satlat, satlon, satalt, satvel);
+	log_debug("AZ: %f, EL: %f, RX: %"PRIu32" TX: %"PRIu32, az, el, rx_freq, tx_freq);
+	doppler_stats.steps++;
 	
 	/* Impose minimum elevation -> start of Ground pass */
 	if (el < MIN_ELEVATION){
 		log_debug("Not avalible for ground pass tracking (Min_elevation %d deg)", MIN_ELEVATION);
 	} else {
-		/* Configure the GS100 TXRX frequency */
-		if (!ax100_set_tx_freq(AX100_V3_ADDRESS, AX100_V3_TIMEOUT, tx_freq))
+		/* Configure the GS100 TXRX frequency, small changes are not worth a command.
+		 * Both sets are queued and sent together without blocking this thread */
+		int queued = 0;
+		if (labs((long) tx_freq - (long) doppler_stats.tx_freq) < DOPPLER_STEP_MIN_HZ) {
+			doppler_stats.skipped++;
+		} else if (doppler_set_freq_async(tx_freq, AX100_V3_PARAM_TX, "TX") == 0) {
+			doppler_stats.tx_freq = tx_freq;
+			queued = 1;
+		} else if (!ax100_set_tx_freq(AX100_V3_ADDRESS, AX100_V3_TIMEOUT, tx_freq)) {
 			log_error("Failed to set Doppler Correction TX Freq. Please check GS100 avaliability");
-		if (!ax100_set_rx_freq(AX100_V3_ADDRESS, AX100_V3_TIMEOUT, rx_freq))
+		} else {
+			doppler_stats.tx_freq = tx_freq;
+		}
+		if (labs((long) rx_freq - (long) doppler_stats.rx_freq) < DOPPLER_STEP_MIN_HZ) {
+			doppler_stats.skipped++;
+		} else if (doppler_set_freq_async(rx_freq, AX100_V3_PARAM_RX, "RX") == 0) {
+			doppler_stats.rx_freq = rx_freq;
+			queued = 1;
+		} else if (!ax100_set_rx_freq(AX100_V3_ADDRESS, AX100_V3_TIMEOUT, rx_freq)) {
 			log_error("Failed to set Doppler Correction RX Freq. Please check GS100 avaliability");
+		} else {
+			doppler_stats.rx_freq = rx_freq;
+		}
+		if (queued)
+			rparam_async_submit();
 	}
 	/* Auto ping satellite when elevation > MIN_PING_ELE*/
-	if(el > MIN_PING_ELE) {
+	if(el > MIN_PING_ELE && tnow - doppler_stats.ping_time >= DOPPLER_UPDATE_INTERVAL) {
+		doppler_stats.ping_time = tnow;
 		ping_sat_func();
 	}
 
@@ -493,7 +681,9 @@ gui_backend_update_satellite(&sat_info_struct);
 
 int ping_sat_func(void){
 	log_debug("Ping satellite at node address 25 ...");
-	csp_packet_t *packet = csp_buffer_get(SIZE_MAX);
+	csp_packet_t *packet = csp_buffer_get(1);
+	if (packet == NULL)
+		return -1;
 	packet->length = 1;
 	packet->data[0] = 0x00;
 	//csp_sendto(pri, dst_node, dst_port, src_port, flag, packet, timeout)
@@ -537,6 +727,7 @@ int mcs_sat_sel(uint32_t sat_no_sel)
 
 	/* Get latest TLE of the selected satellite */
 	log_info("Satellite Element ID: %d",element_id);
+	track_element_id = element_id;
 	tleupdate(element_id);
 
 	if (!ax100_set_tx_freq(node, timeout, TXfreq))
@@ -572,6 +763,37 @@ int lna_conf(int code)
 		return 1;
 }
 
+/* Pass calendar thread, runs whether or not auto tracking is enabled */
+void * pass_calendar_init()
+{
+	time_t loaded = 0;
+
+	/* Pass calendar for all satellites in the downloaded tle.txt */
+	pass_calendar_set_station(LAT, LON, ALT);
+
+	while (1)
+	{
+		csp_timestamp_t clock;
+		clock_get_time(&clock);
+		time_t tnow = clock.tv_sec;
+
+		/* Cached passes are kept while the TLE epochs are unchanged */
+		if (loaded == 0 || tnow - loaded >= PASS_CALENDAR_RELOAD)
+		{
+			pass_calendar_load();
+			loaded = tnow;
+		}
+
+		/* Publish upcoming passes of all configured satellites */
+		pass_calendar_refresh(tnow);
+		pass_calendar_publish(tnow);
+
+		sleep(PASS_CALENDAR_INTERVAL);
+	}
+
+	return NULL;
+}
+
 void tleupdate_init()
 {
 	//Exit tle update
@@ -633,6 +855,21 @@ int rx_freq_set(struct command_context *ctx)
 	return CMD_ERROR_NONE;
 }
 
+int doppler_rate(struct command_context *ctx)
+{
+	if (ctx -> argc != 2)
+		return CMD_ERROR_SYNTAX;
+
+	int rate = atoi(ctx->argv[1]);
+	if (rate < 1 || rate > DOPPLER_STEP_RATE_MAX)
+		return CMD_ERROR_SYNTAX;
+
+	doppler_step_rate = rate;
+	log_info("Doppler step rate %d Hz", doppler_step_rate);
+
+	return CMD_ERROR_NONE;
+}
+
 int dop_test(struct command_context *ctx)
 {
 	/* Initiallising dopper ground pass operation */
@@ -719,6 +956,14 @@ command_t __root_command dopp_command[] = {
 		.handler = dop_test,
 	},
 };
+command_t __root_command dopp_rate_command[] = {
+	{
+		.name = "doppler_rate",
+		.help = "Set doppler correction steps per second",
+		.usage = "<hz>",
+		.handler = doppler_rate,
+	},
+};
 /* Command to send a customed Ping comamnd to satellite*/
 command_t __root_command pingsat_command[] = {
 	{
@@ -83,11 +83,11 @@ void gui_backend_notify_uplink(const char *origin, const char *file_path, size_t
 void gui_backend_notify_downlink(const char *origin, const char *file_path, size_t bytes, uint8_t src, uint8_t dst);
 
 /**
- * Track the last requested rotator target.
+ * Track the rotator position reported by the GS-232B controller.
  *
- * @param azimuth Azimuth command in degrees.
- * @param elevation Elevation command in degrees.
- * @param success 1 if the command was accepted, 0 otherwise.
+ * @param azimuth Measured azimuth in degrees (or the target if the command failed).
+ * @param elevation Measured elevation in degrees (or the target if the command failed).
+ * @param success 1 if the controller responded, 0 otherwise.
  */
 void gui_backend_notify_rotator(int azimuth, int elevation, int success);
 
@@ -30,6 +30,7 @@
 #include <csp/interfaces/csp_if_kiss.h>
 #include <csp/interfaces/csp_if_can.h>
 #include <csp/interfaces/csp_if_zmqhub.h>
+#include <csp/csp_diversity.h>
 #include <csp/drivers/usart.h>
 
 /* Drivers / Util */
@@ -48,16 +49,43 @@
 //---------------------------------------------------------------------------------------------
 const vmem_t vmem_map[] = {{0}};
 
+/* Number of radios that can be attached with -d */
+#define KISS_MAX_DEVICES 4
+
+static void kiss_usart_rx(void * arg, uint8_t * buf, int len, void * pxTaskWoken) {
+	csp_kiss_rx(arg, buf, len, pxTaskWoken);
+}
+
+static void kiss_usart_putstr(void * driver_data, char * buf, int len) {
+	usart_handle_putstr(driver_data, buf, len);
+}
+
 static void print_help(void) {
 	printf(" usage: csp-term <-d|-c|-z> [optargs]\r\n");
-	printf("  -d DEVICE,\tSet device (default: /dev/ttyUSB0)\r\n");
+	printf("  -d DEVICE,\tSet device (default: /dev/ttyUSB0), repeat for more radios\r\n");
 	printf("  -c DEVICE,\tSet can device (default: can0)\r\n");
-	printf("  -z SERVER,\tSet ZMQ server (default: localhost)\r\n");
+	printf("  -z SERVER,\tSet ZMQ server (default: localhost), receive only with -d\r\n");
 	printf("  -a ADDRESS,\tSet address (default: 8)\r\n");
 	printf("  -b BAUD,\tSet baud rate (default: 500000)\r\n");
+	printf("  -r WORKERS,\tSet number of router tasks (default: 1)\r\n");
 	printf("  -h,\t\tPrint help and exit\r\n");
 }
 
+#ifdef CSP_USE_DEDUP
+static int cmd_diversity(struct command_context *ctx) {
+	csp_diversity_print();
+	return CMD_ERROR_NONE;
+}
+
+command_t __root_command diversity_command[] = {
+	{
+		.name = "diversity",
+		.help = "Show which receiver delivered downlink packets first",
+		.handler = cmd_diversity,
+	},
+};
+#endif
+
 static void exithandler(void) {
 	console_exit();
 }
@@ -79,9 +107,11 @@ int main(int argc, char * argv[]) {
 
 	/* Config */
 	uint8_t addr = 8;
+	unsigned int route_workers = 1;
 
 	/* KISS STUFF */
-	char * device = "/dev/ttyUSB0";
+	char * devices[KISS_MAX_DEVICES] = {"/dev/ttyUSB0"};
+	int kiss_count = 0;
 	uint32_t baud = 500000;
 	uint8_t use_kiss = 0;
 
@@ -108,7 +138,7 @@ int main(int argc, char * argv[]) {
 	 * Parser
 	 **/
 	int c;
-	while ((c = getopt(argc, argv, "a:b:c:d:hz:")) != -1) {
+	while ((c = getopt(argc, argv, "a:b:c:d:hr:z:")) != -1) {
 		switch (c) {
 		case 'a':
 			addr = atoi(optarg);
@@ -121,12 +151,19 @@ int main(int argc, char * argv[]) {
 			ifc = optarg;
 			break;
 		case 'd':
-			device = optarg;
+			if (kiss_count >= KISS_MAX_DEVICES) {
+				printf("At most %d devices supported\r\n", KISS_MAX_DEVICES);
+				exit(EXIT_FAILURE);
+			}
+			devices[kiss_count++] = optarg;
 			use_kiss = 1;
 			break;
 		case 'h':
 			print_help();
 			exit(0);
+		case 'r':
+			route_workers = atoi(optarg);
+			break;
 		case 'z':
 			strcpy(zmqhost, optarg);
 			use_zmq = 1;
@@ -144,36 +181,69 @@ int main(int argc, char * argv[]) {
 	csp_set_hostname("csp-term");
 	csp_set_model("CSP Term");
 	csp_set_revision(CSPTERM_VERSION);
-	//csp_buffer_init(400, 512);
-	csp_buffer_init(1024, 1024);
+	/* Pings and telecommands, full 256 byte KISS/CAN frames with room for
+	 * trailers, and large uplink files. Classes grow under downlink bursts
+	 * and are trimmed back by the router task */
+	static const csp_buffer_class_t buffer_classes[] = {
+		{ .size = 64,   .count = 128, .max = 512 },
+		{ .size = 320,  .count = 256, .max = 1024 },
+		{ .size = 1024, .count = 64,  .max = 1024 },
+	};
+	csp_buffer_init_classes(buffer_classes, sizeof(buffer_classes) / sizeof(buffer_classes[0]));
 	csp_init(addr);
 	log_csp_init();
 	csp_rdp_set_opt(6, 30000, 16000, 1, 8000, 3);
 
 	/**
 	 * KISS interface
+	 * The first device that opens carries the default route, further devices
+	 * are registered as KISS1, KISS2, ... and can be routed to from the console.
+	 * The interface is set up before the port is opened so received bytes
+	 * always find it, usart_putc drops frames for a port that failed to open.
 	 */
 	if (use_kiss == 1) {
-		static csp_iface_t csp_if_kiss;
-		static csp_kiss_handle_t csp_kiss_driver;
-		static const char * kiss_name = "KISS";
-		csp_route_set(CSP_DEFAULT_ROUTE, &csp_if_kiss, CSP_NODE_MAC);
-
-		csp_kiss_init(&csp_if_kiss, &csp_kiss_driver, usart_putc, usart_insert, kiss_name);
-		struct usart_conf conf = {.device = device, .baudrate = baud};
-		usart_init(&conf);
-		void my_usart_rx(uint8_t * buf, int len, void * pxTaskWoken) {
-			csp_kiss_rx(&csp_if_kiss, buf, len, pxTaskWoken);
+		static csp_iface_t csp_if_kiss[KISS_MAX_DEVICES];
+		static csp_kiss_handle_t csp_kiss_driver[KISS_MAX_DEVICES];
+		static char kiss_name[KISS_MAX_DEVICES][10];
+		int kiss_open = 0;
+
+		for (int i = 0; i < kiss_count; i++) {
+			if (i == 0) {
+				strcpy(kiss_name[i], "KISS");
+			} else {
+				snprintf(kiss_name[i], sizeof(kiss_name[i]), "KISS%d", i);
+			}
+			csp_kiss_init(&csp_if_kiss[i], &csp_kiss_driver[i], usart_putc, usart_insert, kiss_name[i]);
+			struct usart_conf conf = {.device = devices[i], .baudrate = baud};
+			usart_handle_t * usart = usart_open(&conf, kiss_usart_rx, &csp_if_kiss[i]);
+			if (usart == NULL) {
+				printf("Failed to open %s, %s is not routed\r\n", devices[i], kiss_name[i]);
+				continue;
+			}
+			csp_kiss_set_putstr(&csp_kiss_driver[i], kiss_usart_putstr, usart);
+			if (kiss_open++ == 0)
+				csp_route_set(CSP_DEFAULT_ROUTE, &csp_if_kiss[i], CSP_NODE_MAC);
+#ifdef CSP_USE_DEDUP
+			/* Every receiver of the downlink, the first copy of a packet wins */
+			if (kiss_count + use_zmq > 1)
+				csp_diversity_add(&csp_if_kiss[i]);
+#endif
 		}
-		usart_set_callback(my_usart_rx);
 	}
 
 	/**
 	 * ZMQ interface
+	 * Together with KISS the hub is a second receiver for the same downlink,
+	 * e.g. a remote station. Uplink stays on the local radio.
 	 */
 	if (use_zmq == 1) {
 		csp_zmqhub_init(addr, zmqhost);
-		csp_route_set(CSP_DEFAULT_ROUTE, &csp_if_zmqhub, CSP_NODE_MAC);
+		if (use_kiss == 0)
+			csp_route_set(CSP_DEFAULT_ROUTE, &csp_if_zmqhub, CSP_NODE_MAC);
+#ifdef CSP_USE_DEDUP
+		else
+			csp_diversity_add(&csp_if_zmqhub);
+#endif
 	}
 
 	/**
@@ -201,8 +271,11 @@ int main(int argc, char * argv[]) {
 	 * Tasks
 	 */
 
-	/* Router */
-	csp_route_start_task(1000, 0);
+	/* Router, one task per worker with packets spread by connection */
+	if (csp_route_start_workers(route_workers, 1000, 0) != CSP_ERR_NONE) {
+		printf("Failed to start %u router tasks\r\n", route_workers);
+		exit(EXIT_FAILURE);
+	}
 
 	/* CSP task server thread*/
 	printf("Running modified csp-term\r\n");
@@ -215,6 +288,11 @@ int main(int argc, char * argv[]) {
 	static pthread_t handle_tleupdate;
 	pthread_create(&handle_tleupdate, NULL, tleupdate_init, NULL);		// (Comment out to disable antenna tracking)
 	
+	/* Pass calendar thread, publishes the pass schedule to the GUI */
+	void * pass_calendar_init();
+	static pthread_t handle_pass_calendar;
+	pthread_create(&handle_pass_calendar, NULL, pass_calendar_init, NULL);
+
 	/* Doppler shift compensation thread */
 	void * doppler_init();
 	static pthread_t handle_doppler;
@@ -247,6 +325,7 @@ int main(int argc, char * argv[]) {
 	pthread_join(handle_doppler, NULL);					// (Disable antenna tracking)
 	pthread_join(handle_tleupdate, NULL);					// (Disable antenna tracking)
 	pthread_join(handle_tcp, NULL);
+	pthread_join(handle_pass_calendar, NULL);
 	if (gui_backend_started) {
 		pthread_join(handle_gui_backend, NULL);
 	}
@@ -0,0 +1,382 @@
+/* Multi-satellite pass calendar
+ *
+ * Passes are found with a coarse elevation scan using the batch
+ * propagator, then the horizon crossings and the culmination are refined
+ * to one second. Results are cached per satellite together with the TLE
+ * epoch and the time window they cover, so queries never propagate.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <util/log.h>
+
+#include "predict.h"
+#include "pass_calendar.h"
+#include "gui_backend.h"
+
+#define CALENDAR_HORIZON_DEFAULT	(7 * 86400)	/* Seconds ahead to predict */
+#define CALENDAR_MARGIN			86400		/* Extra window, refresh period */
+#define CALENDAR_BACKLOG		1800		/* Include a pass in progress */
+#define CALENDAR_SCAN_STEP		60		/* Coarse scan step in seconds */
+#define CALENDAR_SCAN_CHUNK		720		/* Samples per batch call */
+
+typedef struct {
+	int used;
+	uint32_t norad_id;
+	char name[32];
+	char tle1[70];
+	char tle2[70];
+	char epoch[15];		/* TLE line 1 columns 19-32 */
+	int valid;		/* passes below match the TLE and station */
+	time_t start;		/* window covered by passes */
+	time_t end;
+	int count;
+	pass_calendar_pass_t passes[PASS_CALENDAR_MAX_PASSES];
+} calendar_sat_t;
+
+/* Work item for one satellite, computed without holding the lock */
+typedef struct {
+	int slot;
+	pthread_t thread;
+	int started;
+	calendar_sat_t sat;
+	double lat;
+	double lon;
+	int alt;
+} calendar_job_t;
+
+static struct {
+	pthread_mutex_t lock;
+	double lat;
+	double lon;
+	int alt;
+	long horizon;
+	calendar_sat_t sat[PASS_CALENDAR_MAX_SATS];
+} calendar = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.horizon = CALENDAR_HORIZON_DEFAULT,
+};
+
+void pass_calendar_set_station(double lat, double lon, int alt)
+{
+	pthread_mutex_lock(&calendar.lock);
+	if (lat != calendar.lat || lon != calendar.lon || alt != calendar.alt) {
+		calendar.lat = lat;
+		calendar.lon = lon;
+		calendar.alt = alt;
+		for (int i = 0; i < PASS_CALENDAR_MAX_SATS; i++)
+			calendar.sat[i].valid = 0;
+	}
+	pthread_mutex_unlock(&calendar.lock);
+}
+
+void pass_calendar_set_horizon(long seconds)
+{
+	if (seconds <= 0)
+		return;
+	pthread_mutex_lock(&calendar.lock);
+	calendar.horizon = seconds;
+	pthread_mutex_unlock(&calendar.lock);
+}
+
+int pass_calendar_set_sat(uint32_t norad_id, const char *name, char *tle1, char *tle2)
+{
+	char epoch[15];
+	calendar_sat_t *sat = NULL;
+
+	if (tle1 == NULL || tle2 == NULL || strlen(tle1) < 69 || strlen(tle2) < 69)
+		return 0;
+	if (!KepCheck(tle1, tle2))
+		return 0;
+
+	memcpy(epoch, &tle1[18], 14);
+	epoch[14] = '\0';
+
+	pthread_mutex_lock(&calendar.lock);
+	for (int i = 0; i < PASS_CALENDAR_MAX_SATS; i++) {
+		if (calendar.sat[i].used && calendar.sat[i].norad_id == norad_id) {
+			sat = &calendar.sat[i];
+			break;
+		}
+		if (!calendar.sat[i].used && sat == NULL)
+			sat = &calendar.sat[i];
+	}
+	if (sat == NULL) {
+		pthread_mutex_unlock(&calendar.lock);
+		log_error("Pass calendar full, satellite %"PRIu32" not added", norad_id);
+		return 0;
+	}
+
+	if (!sat->used || strcmp(sat->epoch, epoch) != 0) {
+		sat->used = 1;
+		sat->valid = 0;
+		sat->count = 0;
+		sat->norad_id = norad_id;
+		strncpy(sat->tle1, tle1, sizeof(sat->tle1) - 1);
+		strncpy(sat->tle2, tle2, sizeof(sat->tle2) - 1);
+		strcpy(sat->epoch, epoch);
+	}
+	if (name != NULL)
+		strncpy(sat->name, name, sizeof(sat->name) - 1);
+	else if (sat->name[0] == '\0')
+		snprintf(sat->name, sizeof(sat->name), "%"PRIu32, norad_id);
+	pthread_mutex_unlock(&calendar.lock);
+
+	return 1;
+}
+
+static void calendar_look(predict_ctx_t *ctx, time_t t, double *azi, double *ele)
+{
+	double time = t;
+	predict_calc_batch(ctx, &time, 1, azi, ele, NULL, NULL);
+}
+
+static double calendar_ele(predict_ctx_t *ctx, time_t t)
+{
+	double ele;
+	calendar_look(ctx, t, NULL, &ele);
+	return ele;
+}
+
+/* Bisect the horizon crossing between t0 and t1, returns the first second
+ * on the t1 side */
+static time_t calendar_crossing(predict_ctx_t *ctx, time_t t0, time_t t1, int rising)
+{
+	while (t1 - t0 > 1) {
+		time_t mid = t0 + (t1 - t0) / 2;
+		if ((calendar_ele(ctx, mid) < 0.0) == rising)
+			t0 = mid;
+		else
+			t1 = mid;
+	}
+	return t1;
+}
+
+/* Ternary search for the culmination inside [t0, t1] */
+static time_t calendar_culmination(predict_ctx_t *ctx, time_t t0, time_t t1, double *max_ele)
+{
+	while (t1 - t0 > 2) {
+		time_t m1 = t0 + (t1 - t0) / 3;
+		time_t m2 = t1 - (t1 - t0) / 3;
+		if (calendar_ele(ctx, m1) < calendar_ele(ctx, m2))
+			t0 = m1;
+		else
+			t1 = m2;
+	}
+
+	time_t best = t0;
+	*max_ele = calendar_ele(ctx, t0);
+	for (time_t t = t0 + 1; t <= t1; t++) {
+		double ele = calendar_ele(ctx, t);
+		if (ele > *max_ele) {
+			*max_ele = ele;
+			best = t;
+		}
+	}
+	return best;
+}
+
+static void calendar_compute(calendar_job_t *job)
+{
+	calendar_sat_t *sat = &job->sat;
+	double times[CALENDAR_SCAN_CHUNK];
+	double ele[CALENDAR_SCAN_CHUNK];
+	pass_calendar_pass_t *pass = NULL;
+	time_t coarse_max_time = 0;
+	double coarse_max = -90.0;
+	double prev_ele = 0.0;
+	time_t prev_t = 0;
+
+	sat->count = 0;
+	sat->valid = 0;
+
+	predict_ctx_t *ctx = predict_ctx_create();
+	if (ctx == NULL)
+		return;
+	predict_set_station(ctx, job->lat, job->lon, job->alt);
+	if (!predict_set_tle(ctx, sat->tle1, sat->tle2)) {
+		predict_ctx_destroy(ctx);
+		return;
+	}
+	predict_precalc(ctx);
+
+	for (time_t t0 = sat->start; t0 < sat->end; t0 += CALENDAR_SCAN_STEP * CALENDAR_SCAN_CHUNK) {
+		int n = 0;
+		for (time_t t = t0; t < sat->end && n < CALENDAR_SCAN_CHUNK; t += CALENDAR_SCAN_STEP)
+			times[n++] = t;
+		predict_calc_batch(ctx, times, n, NULL, ele, NULL, NULL);
+
+		for (int i = 0; i < n; i++) {
+			time_t t = times[i];
+
+			if (pass == NULL && ele[i] >= 0.0) {
+				if (sat->count >= PASS_CALENDAR_MAX_PASSES) {
+					/* Window only reaches the last complete pass */
+					sat->end = prev_t;
+					goto out;
+				}
+				pass = &sat->passes[sat->count];
+				memset(pass, 0, sizeof(*pass));
+				pass->norad_id = sat->norad_id;
+				strncpy(pass->name, sat->name, sizeof(pass->name) - 1);
+				pass->aos = (t == sat->start) ? t : calendar_crossing(ctx, prev_t, t, 1);
+				calendar_look(ctx, pass->aos, &pass->aos_azi, NULL);
+				coarse_max = ele[i];
+				coarse_max_time = t;
+			} else if (pass != NULL && ele[i] >= 0.0) {
+				if (ele[i] > coarse_max) {
+					coarse_max = ele[i];
+					coarse_max_time = t;
+				}
+			} else if (pass != NULL && prev_ele >= 0.0 && ele[i] < 0.0) {
+				pass->los = calendar_crossing(ctx, prev_t, t, 0) - 1;
+				calendar_look(ctx, pass->los, &pass->los_azi, NULL);
+				time_t lo = coarse_max_time - CALENDAR_SCAN_STEP;
+				time_t hi = coarse_max_time + CALENDAR_SCAN_STEP;
+				if (lo < pass->aos)
+					lo = pass->aos;
+				if (hi > pass->los)
+					hi = pass->los;
+				pass->max_ele_time = calendar_culmination(ctx, lo, hi, &pass->max_ele);
+				sat->count++;
+				pass = NULL;
+			}
+
+			prev_ele = ele[i];
+			prev_t = t;
+		}
+	}
+
+	/* A pass still in progress at the end of the window is dropped */
+	if (pass != NULL)
+		sat->end = pass->aos;
+
+out:
+	predict_ctx_destroy(ctx);
+	sat->valid = 1;
+}
+
+static void * calendar_worker(void *arg)
+{
+	calendar_compute(arg);
+	return NULL;
+}
+
+int pass_calendar_refresh(time_t now)
+{
+	calendar_job_t *jobs[PASS_CALENDAR_MAX_SATS];
+	int njobs = 0;
+
+	pthread_mutex_lock(&calendar.lock);
+	for (int i = 0; i < PASS_CALENDAR_MAX_SATS; i++) {
+		calendar_sat_t *sat = &calendar.sat[i];
+		if (!sat->used)
+			continue;
+		if (sat->valid && sat->start <= now - CALENDAR_BACKLOG
+				&& sat->end >= now + calendar.horizon)
+			continue;
+
+		calendar_job_t *job = calloc(1, sizeof(*job));
+		if (job == NULL)
+			break;
+		job->slot = i;
+		job->sat = *sat;
+		job->sat.start = now - CALENDAR_BACKLOG;
+		job->sat.end = now + calendar.horizon + CALENDAR_MARGIN;
+		job->lat = calendar.lat;
+		job->lon = calendar.lon;
+		job->alt = calendar.alt;
+		jobs[njobs++] = job;
+	}
+	pthread_mutex_unlock(&calendar.lock);
+
+	if (njobs == 0)
+		return 0;
+
+	/* Satellites are independent, propagate them in parallel */
+	for (int i = 0; i < njobs; i++)
+		jobs[i]->started = pthread_create(&jobs[i]->thread, NULL, calendar_worker, jobs[i]) == 0;
+
+	for (int i = 0; i < njobs; i++) {
+		if (jobs[i]->started)
+			pthread_join(jobs[i]->thread, NULL);
+		else
+			calendar_compute(jobs[i]);
+	}
+
+	pthread_mutex_lock(&calendar.lock);
+	for (int i = 0; i < njobs; i++) {
+		calendar_sat_t *sat = &calendar.sat[jobs[i]->slot];
+
+		/* Discard if the TLE or station changed while computing */
+		if (sat->used && sat->norad_id == jobs[i]->sat.norad_id
+				&& strcmp(sat->epoch, jobs[i]->sat.epoch) == 0
+				&& jobs[i]->lat == calendar.lat && jobs[i]->lon == calendar.lon
+				&& jobs[i]->alt == calendar.alt && jobs[i]->sat.valid) {
+			strcpy(jobs[i]->sat.name, sat->name);
+			*sat = jobs[i]->sat;
+			log_debug("Pass calendar: %s %d passes", sat->name, sat->count);
+		}
+		free(jobs[i]);
+	}
+	pthread_mutex_unlock(&calendar.lock);
+
+	return njobs;
+}
+
+int pass_calendar_get(time_t from, pass_calendar_pass_t *passes, int max)
+{
+	int next[PASS_CALENDAR_MAX_SATS];
+	int count = 0;
+
+	pthread_mutex_lock(&calendar.lock);
+
+	/* Skip passes that already ended */
+	for (int i = 0; i < PASS_CALENDAR_MAX_SATS; i++) {
+		calendar_sat_t *sat = &calendar.sat[i];
+		next[i] = 0;
+		while (sat->used && sat->valid && next[i] < sat->count
+				&& sat->passes[next[i]].los < from)
+			next[i]++;
+	}
+
+	/* Merge the per satellite lists, each already sorted by AOS */
+	while (count < max) {
+		int best = -1;
+		for (int i = 0; i < PASS_CALENDAR_MAX_SATS; i++) {
+			calendar_sat_t *sat = &calendar.sat[i];
+			if (!sat->used || !sat->valid || next[i] >= sat->count)
+				continue;
+			if (best < 0 || sat->passes[next[i]].aos
+					< calendar.sat[best].passes[next[best]].aos)
+				best = i;
+		}
+		if (best < 0)
+			break;
+		passes[count++] = calendar.sat[best].passes[next[best]++];
+	}
+
+	pthread_mutex_unlock(&calendar.lock);
+
+	return count;
+}
+
+void pass_calendar_publish(time_t from)
+{
+	pass_calendar_pass_t passes[GUI_BACKEND_MAX_PASSES];
+	gui_backend_pass_t gui[GUI_BACKEND_MAX_PASSES];
+
+	int count = pass_calendar_get(from, passes, GUI_BACKEND_MAX_PASSES);
+	for (int i = 0; i < count; i++) {
+		memset(&gui[i], 0, sizeof(gui[i]));
+		strncpy(gui[i].name, passes[i].name, sizeof(gui[i].name) - 1);
+		gui[i].aos_utc = passes[i].aos;
+		gui[i].los_utc = passes[i].los;
+		gui[i].duration_sec = (uint16_t) (passes[i].los - passes[i].aos);
+		gui[i].peak_elevation_deg = (uint16_t) (passes[i].max_ele + 0.5);
+	}
+	gui_backend_update_pass_schedule(gui, count);
+}
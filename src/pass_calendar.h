@@ -0,0 +1,42 @@
+/**
+ * @file pass_calendar.h
+ * Pass predictions for several satellites over a multi-day horizon.
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+#define PASS_CALENDAR_MAX_SATS		8	/* Satellites in the calendar */
+#define PASS_CALENDAR_MAX_PASSES	96	/* Passes kept per satellite */
+
+typedef struct {
+	uint32_t norad_id;
+	char name[32];
+	time_t aos;
+	time_t los;
+	time_t max_ele_time;
+	double max_ele;		/* degree */
+	double aos_azi;		/* degree */
+	double los_azi;		/* degree */
+} pass_calendar_pass_t;
+
+/* Set the ground station for all satellites, invalidates the cache */
+void pass_calendar_set_station(double lat, double lon, int alt);
+
+/* Set the prediction horizon in seconds (default 7 days) */
+void pass_calendar_set_horizon(long seconds);
+
+/* Add or update a satellite. Cached passes are kept while the TLE epoch
+ * is unchanged. Returns 1 on success, 0 on invalid TLE or full calendar */
+int pass_calendar_set_sat(uint32_t norad_id, const char *name, char *tle1, char *tle2);
+
+/* Recompute satellites with a new TLE or an expiring window, one thread
+ * per satellite. Returns the number of satellites recomputed */
+int pass_calendar_refresh(time_t now);
+
+/* Copy passes ending after 'from', all satellites sorted by AOS.
+ * Returns the number of passes copied */
+int pass_calendar_get(time_t from, pass_calendar_pass_t *passes, int max);
+
+/* Publish the upcoming passes to the GUI backend pass schedule */
+void pass_calendar_publish(time_t from);
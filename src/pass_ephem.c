@@ -0,0 +1,154 @@
+/* Pass ephemeris
+ *
+ * Before AOS the pass is propagated once at the Chebyshev nodes of short
+ * segments. During the pass the look angles at any time are then an
+ * evaluation of a low order polynomial instead of a full SGP4 run.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <util/log.h>
+
+#include "pass_ephem.h"
+
+#define PASS_EPHEM_MAGIC	0x48504550	/* "PEPH" */
+
+int pass_ephem_build(pass_ephem_t *ephem, predict_ctx_t *ctx, uint32_t norad_id,
+		const char *tle1, time_t start, time_t end)
+{
+	const int n = PASS_EPHEM_ORDER;
+	double times[PASS_EPHEM_ORDER];
+	double node[PASS_EPHEM_ORDER];
+	double value[PASS_EPHEM_CHANNELS][PASS_EPHEM_ORDER];
+
+	int segments = (end - start + PASS_EPHEM_SEGMENT_SEC - 1) / PASS_EPHEM_SEGMENT_SEC;
+	if (end < start || segments > PASS_EPHEM_MAX_SEGMENTS)
+		return 0;
+	if (segments == 0)
+		segments = 1;
+
+	memset(ephem, 0, sizeof(*ephem));
+
+	for (int k = 0; k < n; k++)
+		node[k] = cos(M_PI * (k + 0.5) / n);
+
+	for (int s = 0; s < segments; s++) {
+		double half = PASS_EPHEM_SEGMENT_SEC / 2.0;
+		double mid = start + s * PASS_EPHEM_SEGMENT_SEC + half;
+
+		for (int k = 0; k < n; k++)
+			times[k] = mid + half * node[k];
+		predict_calc_batch(ctx, times, n, value[PASS_EPHEM_AZI], value[PASS_EPHEM_ELE],
+				value[PASS_EPHEM_RANGE], value[PASS_EPHEM_RANGE_RATE]);
+
+		/* Nodes are ordered in time, make the azimuth continuous across north */
+		for (int k = 1; k < n; k++) {
+			double d = value[PASS_EPHEM_AZI][k] - value[PASS_EPHEM_AZI][k - 1];
+			if (d > 180.0)
+				value[PASS_EPHEM_AZI][k] -= 360.0;
+			else if (d < -180.0)
+				value[PASS_EPHEM_AZI][k] += 360.0;
+		}
+
+		for (int c = 0; c < PASS_EPHEM_CHANNELS; c++) {
+			for (int j = 0; j < n; j++) {
+				double sum = 0;
+				for (int k = 0; k < n; k++)
+					sum += value[c][k] * cos(M_PI * j * (k + 0.5) / n);
+				ephem->coef[s][c][j] = 2.0 * sum / n;
+			}
+			ephem->coef[s][c][0] /= 2.0;
+		}
+	}
+
+	ephem->norad_id = norad_id;
+	memcpy(ephem->epoch, &tle1[18], 14);
+	ephem->start = start;
+	ephem->end = end;
+	ephem->segments = segments;
+
+	return 1;
+}
+
+/* Clenshaw recurrence for sum c[j] T_j(x) */
+static double pass_ephem_clenshaw(const double *c, double x)
+{
+	double b1 = 0, b2 = 0;
+
+	for (int j = PASS_EPHEM_ORDER - 1; j >= 1; j--) {
+		double b0 = 2.0 * x * b1 - b2 + c[j];
+		b2 = b1;
+		b1 = b0;
+	}
+	return x * b1 - b2 + c[0];
+}
+
+int pass_ephem_eval(const pass_ephem_t *ephem, double time, pass_ephem_look_t *look)
+{
+	if (ephem->segments == 0 || time < ephem->start || time > ephem->end)
+		return 0;
+
+	int s = (time - ephem->start) / PASS_EPHEM_SEGMENT_SEC;
+	if (s >= ephem->segments)
+		s = ephem->segments - 1;
+
+	double half = PASS_EPHEM_SEGMENT_SEC / 2.0;
+	double x = (time - (ephem->start + s * PASS_EPHEM_SEGMENT_SEC + half)) / half;
+
+	double azi = fmod(pass_ephem_clenshaw(ephem->coef[s][PASS_EPHEM_AZI], x), 360.0);
+	look->azi = (azi < 0) ? azi + 360.0 : azi;
+	look->ele = pass_ephem_clenshaw(ephem->coef[s][PASS_EPHEM_ELE], x);
+	look->range = pass_ephem_clenshaw(ephem->coef[s][PASS_EPHEM_RANGE], x);
+	look->range_rate = pass_ephem_clenshaw(ephem->coef[s][PASS_EPHEM_RANGE_RATE], x);
+
+	return 1;
+}
+
+int pass_ephem_match(const pass_ephem_t *ephem, uint32_t norad_id,
+		const char *tle1, time_t start, time_t end)
+{
+	return ephem->segments > 0 && ephem->norad_id == norad_id
+			&& strncmp(ephem->epoch, &tle1[18], 14) == 0
+			&& ephem->start == start && ephem->end == end;
+}
+
+int pass_ephem_save(const pass_ephem_t *ephem, const char *path)
+{
+	char tmp[256];
+	uint32_t magic = PASS_EPHEM_MAGIC;
+
+	/* Write a new file and rename, a crash never leaves a partial fit */
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	FILE *f = fopen(tmp, "wb");
+	if (!f) {
+		log_error("Error opening %s", tmp);
+		return 0;
+	}
+	int ok = fwrite(&magic, sizeof(magic), 1, f) == 1
+			&& fwrite(ephem, sizeof(*ephem), 1, f) == 1;
+	if (fclose(f) != 0)
+		ok = 0;
+	if (!ok || rename(tmp, path) != 0) {
+		log_error("Error writing pass ephemeris %s", path);
+		remove(tmp);
+		return 0;
+	}
+	return 1;
+}
+
+int pass_ephem_load(pass_ephem_t *ephem, const char *path)
+{
+	uint32_t magic = 0;
+
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return 0;
+	int ok = fread(&magic, sizeof(magic), 1, f) == 1 && magic == PASS_EPHEM_MAGIC
+			&& fread(ephem, sizeof(*ephem), 1, f) == 1
+			&& ephem->segments > 0 && ephem->segments <= PASS_EPHEM_MAX_SEGMENTS;
+	fclose(f);
+	if (!ok)
+		memset(ephem, 0, sizeof(*ephem));
+	return ok;
+}
@@ -0,0 +1,55 @@
+/**
+ * @file pass_ephem.h
+ * Piecewise Chebyshev fit of the look angles over one pass.
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+#include "predict.h"
+
+#define PASS_EPHEM_SEGMENT_SEC	30	/* Time span of one segment */
+#define PASS_EPHEM_ORDER	10	/* Coefficients per channel and segment */
+#define PASS_EPHEM_MAX_SEGMENTS	80	/* 40 minutes */
+
+enum {
+	PASS_EPHEM_AZI,		/* degree, unwrapped */
+	PASS_EPHEM_ELE,		/* degree */
+	PASS_EPHEM_RANGE,	/* km */
+	PASS_EPHEM_RANGE_RATE,	/* km/s */
+	PASS_EPHEM_CHANNELS,
+};
+
+typedef struct {
+	double azi;
+	double ele;
+	double range;
+	double range_rate;
+} pass_ephem_look_t;
+
+typedef struct {
+	/* Key, the fit is reused only for the same pass */
+	uint32_t norad_id;
+	char epoch[15];		/* TLE line 1 columns 19-32 */
+	time_t start;
+	time_t end;
+	int segments;
+	double coef[PASS_EPHEM_MAX_SEGMENTS][PASS_EPHEM_CHANNELS][PASS_EPHEM_ORDER];
+} pass_ephem_t;
+
+/* Fit the pass [start, end] of the satellite in ctx (predict_precalc done).
+ * Returns 1 on success, 0 if the pass is too long */
+int pass_ephem_build(pass_ephem_t *ephem, predict_ctx_t *ctx, uint32_t norad_id,
+		const char *tle1, time_t start, time_t end);
+
+/* Evaluate at a unix time with fractional seconds.
+ * Returns 1 on success, 0 outside the fitted pass */
+int pass_ephem_eval(const pass_ephem_t *ephem, double time, pass_ephem_look_t *look);
+
+/* Check if the ephemeris belongs to this pass */
+int pass_ephem_match(const pass_ephem_t *ephem, uint32_t norad_id,
+		const char *tle1, time_t start, time_t end);
+
+/* Persist the ephemeris so a restart mid-pass can reuse it. Return 1 on success */
+int pass_ephem_save(const pass_ephem_t *ephem, const char *path);
+int pass_ephem_load(pass_ephem_t *ephem, const char *path);
@@ -4,14 +4,12 @@
  *
  * The Prediction file has been extracted from predict version 2.2.1.
  * However the prediction part for satellites in deep space (orbit period > 225 min)
- * has been removed so it only work with LEO satellites. Also instead of working with multiple satellites
- * it has been modified to work only with one satellite.
+ * has been removed so it only work with LEO satellites.
  *
- * If it should work with multiple satellites the structs sat and sat_db should be changed to
- * sat[24] and sat_db[24] and the functions where they are used should have added a int x in there deceleration
- * where x in the sat number wanted e.g setTLE(char* line1, char* line2, int x);
- * The functions to be changed are:
- * internalUpdate,AosHappens,Decayed,setTLE
+ * All state (TLE, SGP4 initialisation, observer and results) lives in a
+ * predict_ctx_t, so several satellites and stations can be propagated in
+ * parallel on different threads. The original single satellite functions
+ * (setTLE, PreCalc, Calc, get_azi, ...) operate on a default context.
  */
 
 #include <time.h>
@@ -22,6 +20,11 @@
 #include <fcntl.h>
 #include <math.h>
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#define PREDICT_X86
+#include <immintrin.h>
+#endif
+
 #include "predict.h"
 
 /* Constants used by SGP4 code */
@@ -80,6 +83,12 @@
 #define sr			6.96000E5				//! Solar radius - km (IAU 76)
 #define AU			1.49597870691E8			//! Astronomical unit - km (IAU 76)
 
+/* Time stamps converted per predict_look_batch() call */
+#define PREDICT_BATCH_CHUNK	64
+
+/* Coarse AOS/LOS search steps evaluated per batch */
+#define PREDICT_SCAN_STEPS	8
+
 /* Entry points of Deep() */
 #define dpinit   	1						//! Deep-space initialization code
 #define dpsec    	2						//! Deep-space secular code
@@ -103,8 +112,8 @@
 #define VISIBLE_FLAG           0x002000
 #define SAT_ECLIPSED_FLAG      0x004000
 
-/* Global Variables */
-static struct {
+/* Satellite data parsed from the TLE */
+typedef struct {
 	char line1[70];
 	char line2[70];
 	char name[25];
@@ -123,7 +132,7 @@ static struct {
 	double nddot6;
 	double bstar;
 	long orbitnum;
-} sat;
+} sat_t;
 
 typedef struct {
 	double stnlat;
@@ -131,7 +140,7 @@ typedef struct {
 	int stnalt;
 } QTH;
 
-static struct {
+typedef struct {
 	char name[25];
 	long catnum;
 	char squintflag;
@@ -146,20 +155,8 @@ static struct {
 	unsigned char dayofweek[10];
 	int phase_start[10];
 	int phase_end[10];
-} sat_db;
-
-/* Global variables for sharing data among functions... */
-
-static double tsince, jul_epoch, jul_utc, eclipse_depth = 0, sat_azi, sat_ele,
-		sat_range, sat_range_rate, sat_lat, sat_lon, sat_alt, sat_vel, phase,
-		sun_azi, sun_ele, daynum, fm, fk, age, aostime, lostime, ax, ay, az, rx,
-		ry, rz, squint, alat, alon;
+} sat_db_t;
 
-static char temp[80], sat_sun_status, findsun, calc_squint;
-
-static int iaz, iel, ma256, isplat, isplong, Flags = 0;
-
-static long rv, irk;
 
 static unsigned char val[256];
 
@@ -200,33 +197,64 @@ typedef struct {
 	double ds50;
 } deep_arg_t;
 
-/* Global structure used by SGP4/SDP4 code. */
+/* Values computed once per TLE by SGP4() */
+
+typedef struct {
+	double aodp, aycof, c1, c4, c5, cosio, d2, d3, d4, delmo, omgcof,
+			eta, omgdot, sinio, xnodp, sinmo, t2cof, t3cof, t4cof, t5cof,
+			x1mth2, x3thm1, x7thm1, xmcof, xmdot, xnodcf, xnodot, xlcof;
+} sgp4_state_t;
+
+/* Everything a prediction needs: formerly the global variables
+ for sharing data among functions. */
 
-static geodetic_t obs_geodetic;
+struct predict_ctx_s {
+	sat_t sat;
+	sat_db_t sat_db;
 
-/* Two-line Orbital Elements for the satellite used by SGP4/SDP4 code. */
+	/* Ground station */
+	QTH qth;
+	geodetic_t obs_geodetic;
 
-static tle_t tle;
+	/* Two-line Orbital Elements for the satellite used by SGP4/SDP4 code. */
+	tle_t tle;
+	sgp4_state_t sgp4;
+	int Flags;
+
+	double tsince, jul_epoch, jul_utc, eclipse_depth, sat_azi, sat_ele,
+			sat_range, sat_range_rate, sat_lat, sat_lon, sat_alt, sat_vel, phase,
+			sun_azi, sun_ele, daynum, fm, fk, age, aostime, lostime, ax, ay, az, rx,
+			ry, rz, squint, alat, alon;
+
+	char temp[80], sat_sun_status, findsun, calc_squint;
+
+	int iaz, iel, ma256, isplat, isplong;
+
+	long rv, irk;
+};
 
 /* init qth/groundstation data */
-static QTH qth = { .stnlat = 57.0131, .stnlong = 9.998, .stnalt = 5 };
+#define PREDICT_CTX_INIT { .qth = { .stnlat = 57.0131, .stnlong = 9.998, .stnalt = 5 } }
+
+/* Context used by the single satellite API */
+static predict_ctx_t predict_default = PREDICT_CTX_INIT;
 
 /* Functions for testing and setting/clearing flags used in SGP4/SDP4 code */
 
-int isFlagSet(int flag) {
-	return (Flags & flag);
+int isFlagSet(predict_ctx_t *ctx, int flag) {
+	return (ctx->Flags & flag);
 }
 
-int isFlagClear(int flag) {
-	return (~Flags & flag);
+int isFlagClear(predict_ctx_t *ctx, int flag) {
+	return (~ctx->Flags & flag);
 }
 
-void SetFlag(int flag) {
-	Flags |= flag;
+void SetFlag(predict_ctx_t *ctx, int flag) {
+	ctx->Flags |= flag;
 }
 
-void ClearFlag(int flag) {
-	Flags &= ~flag;
+void ClearFlag(predict_ctx_t *ctx, int flag) {
+	ctx->Flags &= ~flag;
 }
 
 /* Remaining SGP4/SDP4 code follows... */
@@ -666,7 +694,7 @@ void select_ephemeris(tle_t *tle) {
 
 }
 
-void SGP4(double tsince, tle_t * tle, vector_t * pos, vector_t * vel) {
+void SGP4(predict_ctx_t *ctx, double tsince, tle_t * tle, vector_t * pos, vector_t * vel) {
 	/* This function is used to calculate the position and velocity */
 	/* of near-earth (period < 225 minutes) satellites. tsince is   */
 	/* time since epoch in minutes, tle is a pointer to a tle_t     */
@@ -674,9 +702,7 @@ void SGP4(double tsince, tle_t * tle, vector_t * pos, vector_t * vel) {
 	/* are vector_t structures returning ECI satellite position and */
 	/* velocity. Use Convert_Sat_State() to convert to km and km/s. */
 
-	static double aodp, aycof, c1, c4, c5, cosio, d2, d3, d4, delmo, omgcof,
-			eta, omgdot, sinio, xnodp, sinmo, t2cof, t3cof, t4cof, t5cof,
-			x1mth2, x3thm1, x7thm1, xmcof, xmdot, xnodcf, xnodot, xlcof;
+	sgp4_state_t *st = &ctx->sgp4;
 
 	double cosuk, sinuk, rfdotk, vx, vy, vz, ux, uy, uz, xmy, xmx, cosnok,
 			sinnok, cosik, sinik, rdotk, xinck, xnodek, uk, rk, cos2u, sin2u, u,
@@ -692,28 +718,28 @@ void SGP4(double tsince, tle_t * tle, vector_t * pos, vector_t * vel) {
 
 	/* Initialization */
 
-	if (isFlagClear(SGP4_INITIALIZED_FLAG)) {
-		SetFlag(SGP4_INITIALIZED_FLAG);
+	if (isFlagClear(ctx, SGP4_INITIALIZED_FLAG)) {
+		SetFlag(ctx, SGP4_INITIALIZED_FLAG);
 
-		/* Recover original mean motion (xnodp) and   */
-		/* semimajor axis (aodp) from input elements. */
+		/* Recover original mean motion (st->xnodp) and   */
+		/* semimajor axis (st->aodp) from input elements. */
 
 		a1 = pow(xke / tle->xno, tothrd);
-		cosio = cos(tle->xincl);
-		theta2 = cosio * cosio;
-		x3thm1 = 3 * theta2 - 1.0;
+		st->cosio = cos(tle->xincl);
+		theta2 = st->cosio * st->cosio;
+		st->x3thm1 = 3 * theta2 - 1.0;
 		eosq = tle->eo * tle->eo;
 		betao2 = 1.0 - eosq;
 		betao = sqrt(betao2);
-		del1 = 1.5 * ck2 * x3thm1 / (a1 * a1 * betao * betao2);
+		del1 = 1.5 * ck2 * st->x3thm1 / (a1 * a1 * betao * betao2);
 		ao = a1
 				* (1.0
 						- del1
 								* (0.5 * tothrd
 										+ del1 * (1.0 + 134.0 / 81.0 * del1)));
-		delo = 1.5 * ck2 * x3thm1 / (ao * ao * betao * betao2);
-		xnodp = tle->xno / (1.0 + delo);
-		aodp = ao / (1.0 - delo);
+		delo = 1.5 * ck2 * st->x3thm1 / (ao * ao * betao * betao2);
+		st->xnodp = tle->xno / (1.0 + delo);
+		st->aodp = ao / (1.0 - delo);
 
 		/* For perigee less than 220 kilometers, the "simple"     */
 		/* flag is set and the equations are truncated to linear  */
@@ -721,18 +747,18 @@ void SGP4(double tsince, tle_t * tle, vector_t * pos, vector_t * vel) {
 		/* anomaly.  Also, the c3 term, the delta omega term, and */
 		/* the delta m term are dropped.                          */
 
-		if ((aodp * (1 - tle->eo) / ae) < (220 / xkmper + ae))
-			SetFlag(SIMPLE_FLAG);
+		if ((st->aodp * (1 - tle->eo) / ae) < (220 / xkmper + ae))
+			SetFlag(ctx, SIMPLE_FLAG);
 
 		else
-			ClearFlag(SIMPLE_FLAG);
+			ClearFlag(ctx, SIMPLE_FLAG);
 
 		/* For perigees below 156 km, the      */
 		/* values of s and qoms2t are altered. */
 
 		s4 = s;
 		qoms24 = qoms2t;
-		perigee = (aodp * (1 - tle->eo) - ae) * xkmper;
+		perigee = (st->aodp * (1 - tle->eo) - ae) * xkmper;
 
 		if (perigee < 156.0) {
 			if (perigee <= 98.0)
@@ -744,111 +770,111 @@ void SGP4(double tsince, tle_t * tle, vector_t * pos, vector_t * vel) {
 			s4 = s4 / xkmper + ae;
 		}
 
-		pinvsq = 1 / (aodp * aodp * betao2 * betao2);
-		tsi = 1 / (aodp - s4);
-		eta = aodp * tle->eo * tsi;
-		etasq = eta * eta;
-		eeta = tle->eo * eta;
+		pinvsq = 1 / (st->aodp * st->aodp * betao2 * betao2);
+		tsi = 1 / (st->aodp - s4);
+		st->eta = st->aodp * tle->eo * tsi;
+		etasq = st->eta * st->eta;
+		eeta = tle->eo * st->eta;
 		psisq = fabs(1 - etasq);
 		coef = qoms24 * pow(tsi, 4);
 		coef1 = coef / pow(psisq, 3.5);
-		c2 = coef1 * xnodp
-				* (aodp * (1 + 1.5 * etasq + eeta * (4 + etasq))
-						+ 0.75 * ck2 * tsi / psisq * x3thm1
+		c2 = coef1 * st->xnodp
+				* (st->aodp * (1 + 1.5 * etasq + eeta * (4 + etasq))
+						+ 0.75 * ck2 * tsi / psisq * st->x3thm1
 								* (8 + 3 * etasq * (8 + etasq)));
-		c1 = tle->bstar * c2;
-		sinio = sin(tle->xincl);
+		st->c1 = tle->bstar * c2;
+		st->sinio = sin(tle->xincl);
 		a3ovk2 = -xj3 / ck2 * pow(ae, 3);
-		c3 = coef * tsi * a3ovk2 * xnodp * ae * sinio / tle->eo;
-		x1mth2 = 1 - theta2;
+		c3 = coef * tsi * a3ovk2 * st->xnodp * ae * st->sinio / tle->eo;
+		st->x1mth2 = 1 - theta2;
 
-		c4 = 2 * xnodp * coef1 * aodp * betao2
-				* (eta * (2 + 0.5 * etasq) + tle->eo * (0.5 + 2 * etasq)
-						- 2 * ck2 * tsi / (aodp * psisq)
-								* (-3 * x3thm1
+		st->c4 = 2 * st->xnodp * coef1 * st->aodp * betao2
+				* (st->eta * (2 + 0.5 * etasq) + tle->eo * (0.5 + 2 * etasq)
+						- 2 * ck2 * tsi / (st->aodp * psisq)
+								* (-3 * st->x3thm1
 										* (1 - 2 * eeta
 												+ etasq * (1.5 - 0.5 * eeta))
-										+ 0.75 * x1mth2
+										+ 0.75 * st->x1mth2
 												* (2 * etasq
 														- eeta * (1 + etasq))
 												* cos(2 * tle->omegao)));
-		c5 = 2 * coef1 * aodp * betao2
+		st->c5 = 2 * coef1 * st->aodp * betao2
 				* (1 + 2.75 * (etasq + eeta) + eeta * etasq);
 
 		theta4 = theta2 * theta2;
-		temp1 = 3 * ck2 * pinvsq * xnodp;
+		temp1 = 3 * ck2 * pinvsq * st->xnodp;
 		temp2 = temp1 * ck2 * pinvsq;
-		temp3 = 1.25 * ck4 * pinvsq * pinvsq * xnodp;
-		xmdot = xnodp + 0.5 * temp1 * betao * x3thm1
+		temp3 = 1.25 * ck4 * pinvsq * pinvsq * st->xnodp;
+		st->xmdot = st->xnodp + 0.5 * temp1 * betao * st->x3thm1
 				+ 0.0625 * temp2 * betao * (13 - 78 * theta2 + 137 * theta4);
 		x1m5th = 1 - 5 * theta2;
-		omgdot = -0.5 * temp1 * x1m5th
+		st->omgdot = -0.5 * temp1 * x1m5th
 				+ 0.0625 * temp2 * (7 - 114 * theta2 + 395 * theta4)
 				+ temp3 * (3 - 36 * theta2 + 49 * theta4);
-		xhdot1 = -temp1 * cosio;
-		xnodot = xhdot1
+		xhdot1 = -temp1 * st->cosio;
+		st->xnodot = xhdot1
 				+ (0.5 * temp2 * (4 - 19 * theta2)
-						+ 2 * temp3 * (3 - 7 * theta2)) * cosio;
-		omgcof = tle->bstar * c3 * cos(tle->omegao);
-		xmcof = -tothrd * coef * tle->bstar * ae / eeta;
-		xnodcf = 3.5 * betao2 * xhdot1 * c1;
-		t2cof = 1.5 * c1;
-		xlcof = 0.125 * a3ovk2 * sinio * (3 + 5 * cosio) / (1 + cosio);
-		aycof = 0.25 * a3ovk2 * sinio;
-		delmo = pow(1 + eta * cos(tle->xmo), 3);
-		sinmo = sin(tle->xmo);
-		x7thm1 = 7 * theta2 - 1;
-
-		if (isFlagClear(SIMPLE_FLAG)) {
-			c1sq = c1 * c1;
-			d2 = 4 * aodp * tsi * c1sq;
-			temp = d2 * tsi * c1 / 3;
-			d3 = (17 * aodp + s4) * temp;
-			d4 = 0.5 * temp * aodp * tsi * (221 * aodp + 31 * s4) * c1;
-			t3cof = d2 + 2 * c1sq;
-			t4cof = 0.25 * (3 * d3 + c1 * (12 * d2 + 10 * c1sq));
-			t5cof = 0.2
-					* (3 * d4 + 12 * c1 * d3 + 6 * d2 * d2
-							+ 15 * c1sq * (2 * d2 + c1sq));
+						+ 2 * temp3 * (3 - 7 * theta2)) * st->cosio;
+		st->omgcof = tle->bstar * c3 * cos(tle->omegao);
+		st->xmcof = -tothrd * coef * tle->bstar * ae / eeta;
+		st->xnodcf = 3.5 * betao2 * xhdot1 * st->c1;
+		st->t2cof = 1.5 * st->c1;
+		st->xlcof = 0.125 * a3ovk2 * st->sinio * (3 + 5 * st->cosio) / (1 + st->cosio);
+		st->aycof = 0.25 * a3ovk2 * st->sinio;
+		st->delmo = pow(1 + st->eta * cos(tle->xmo), 3);
+		st->sinmo = sin(tle->xmo);
+		st->x7thm1 = 7 * theta2 - 1;
+
+		if (isFlagClear(ctx, SIMPLE_FLAG)) {
+			c1sq = st->c1 * st->c1;
+			st->d2 = 4 * st->aodp * tsi * c1sq;
+			temp = st->d2 * tsi * st->c1 / 3;
+			st->d3 = (17 * st->aodp + s4) * temp;
+			st->d4 = 0.5 * temp * st->aodp * tsi * (221 * st->aodp + 31 * s4) * st->c1;
+			st->t3cof = st->d2 + 2 * c1sq;
+			st->t4cof = 0.25 * (3 * st->d3 + st->c1 * (12 * st->d2 + 10 * c1sq));
+			st->t5cof = 0.2
+					* (3 * st->d4 + 12 * st->c1 * st->d3 + 6 * st->d2 * st->d2
+							+ 15 * c1sq * (2 * st->d2 + c1sq));
 		}
 	}
 
 	/* Update for secular gravity and atmospheric drag. */
-	xmdf = tle->xmo + xmdot * tsince;
-	omgadf = tle->omegao + omgdot * tsince;
-	xnoddf = tle->xnodeo + xnodot * tsince;
+	xmdf = tle->xmo + st->xmdot * tsince;
+	omgadf = tle->omegao + st->omgdot * tsince;
+	xnoddf = tle->xnodeo + st->xnodot * tsince;
 	omega = omgadf;
 	xmp = xmdf;
 	tsq = tsince * tsince;
-	xnode = xnoddf + xnodcf * tsq;
-	tempa = 1 - c1 * tsince;
-	tempe = tle->bstar * c4 * tsince;
-	templ = t2cof * tsq;
-
-	if (isFlagClear(SIMPLE_FLAG)) {
-		delomg = omgcof * tsince;
-		delm = xmcof * (pow(1 + eta * cos(xmdf), 3) - delmo);
+	xnode = xnoddf + st->xnodcf * tsq;
+	tempa = 1 - st->c1 * tsince;
+	tempe = tle->bstar * st->c4 * tsince;
+	templ = st->t2cof * tsq;
+
+	if (isFlagClear(ctx, SIMPLE_FLAG)) {
+		delomg = st->omgcof * tsince;
+		delm = st->xmcof * (pow(1 + st->eta * cos(xmdf), 3) - st->delmo);
 		temp = delomg + delm;
 		xmp = xmdf + temp;
 		omega = omgadf - temp;
 		tcube = tsq * tsince;
 		tfour = tsince * tcube;
-		tempa = tempa - d2 * tsq - d3 * tcube - d4 * tfour;
-		tempe = tempe + tle->bstar * c5 * (sin(xmp) - sinmo);
-		templ = templ + t3cof * tcube + tfour * (t4cof + tsince * t5cof);
+		tempa = tempa - st->d2 * tsq - st->d3 * tcube - st->d4 * tfour;
+		tempe = tempe + tle->bstar * st->c5 * (sin(xmp) - st->sinmo);
+		templ = templ + st->t3cof * tcube + tfour * (st->t4cof + tsince * st->t5cof);
 	}
 
-	a = aodp * pow(tempa, 2);
+	a = st->aodp * pow(tempa, 2);
 	e = tle->eo - tempe;
-	xl = xmp + omega + xnode + xnodp * templ;
+	xl = xmp + omega + xnode + st->xnodp * templ;
 	beta = sqrt(1 - e * e);
 	xn = xke / pow(a, 1.5);
 
 	/* Long period periodics */
 	axn = e * cos(omega);
 	temp = 1 / (a * beta * beta);
-	xll = temp * xlcof * axn;
-	aynl = temp * aycof;
+	xll = temp * st->xlcof * axn;
+	aynl = temp * st->aycof;
 	xlt = xl + xll;
 	ayn = e * sin(omega) + aynl;
 
@@ -896,12 +922,12 @@ void SGP4(double tsince, tle_t * tle, vector_t * pos, vector_t * vel) {
 	temp2 = temp1 * temp;
 
 	/* Update for short periodics */
-	rk = r * (1 - 1.5 * temp2 * betal * x3thm1) + 0.5 * temp1 * x1mth2 * cos2u;
-	uk = u - 0.25 * temp2 * x7thm1 * sin2u;
-	xnodek = xnode + 1.5 * temp2 * cosio * sin2u;
-	xinck = tle->xincl + 1.5 * temp2 * cosio * sinio * cos2u;
-	rdotk = rdot - xn * temp1 * x1mth2 * sin2u;
-	rfdotk = rfdot + xn * temp1 * (x1mth2 * cos2u + 1.5 * x3thm1);
+	rk = r * (1 - 1.5 * temp2 * betal * st->x3thm1) + 0.5 * temp1 * st->x1mth2 * cos2u;
+	uk = u - 0.25 * temp2 * st->x7thm1 * sin2u;
+	xnodek = xnode + 1.5 * temp2 * st->cosio * sin2u;
+	xinck = tle->xincl + 1.5 * temp2 * st->cosio * st->sinio * cos2u;
+	rdotk = rdot - xn * temp1 * st->x1mth2 * sin2u;
+	rfdotk = rfdot + xn * temp1 * (st->x1mth2 * cos2u + 1.5 * st->x3thm1);
 
 	/* Orientation vectors */
 	sinuk = sin(uk);
@@ -928,12 +954,12 @@ void SGP4(double tsince, tle_t * tle, vector_t * pos, vector_t * vel) {
 	vel->z = rdotk * uz + rfdotk * vz;
 
 	/* Phase in radians */
-	phase = xlt - xnode - omgadf + twopi;
+	ctx->phase = xlt - xnode - omgadf + twopi;
 
-	if (phase < 0.0)
-		phase += twopi;
+	if (ctx->phase < 0.0)
+		ctx->phase += twopi;
 
-	phase = FMod2p(phase);
+	ctx->phase = FMod2p(ctx->phase);
 }
 
 void Calculate_User_PosVel(double time, geodetic_t *geodetic, vector_t *obs_pos,
@@ -993,7 +1019,7 @@ void Calculate_LatLonAlt(double time, vector_t *pos, geodetic_t *geodetic) {
 		geodetic->lat -= twopi;
 }
 
-void Calculate_Obs(double time, vector_t *pos, vector_t *vel,
+void Calculate_Obs(predict_ctx_t *ctx, double time, vector_t *pos, vector_t *vel,
 		geodetic_t *geodetic, vector_t *obs_set) {
 	/* The procedures Calculate_Obs and Calculate_RADec calculate         */
 	/* the *topocentric* coordinates of the object with ECI position,     */
@@ -1022,11 +1048,11 @@ void Calculate_Obs(double time, vector_t *pos, vector_t *vel,
 	range.y = pos->y - obs_pos.y;
 	range.z = pos->z - obs_pos.z;
 
-	/* Save these values globally for calculating squint angles later... */
+	/* Save these values in the context for calculating squint angles later... */
 
-	rx = range.x;
-	ry = range.y;
-	rz = range.z;
+	ctx->rx = range.x;
+	ctx->ry = range.y;
+	ctx->rz = range.z;
 
 	rgvel.x = vel->x - obs_vel.x;
 	rgvel.y = vel->y - obs_vel.y;
@@ -1073,14 +1099,14 @@ void Calculate_Obs(double time, vector_t *pos, vector_t *vel,
 	/**** End bypass ****/
 
 	if (obs_set->y >= 0.0)
-		SetFlag(VISIBLE_FLAG);
+		SetFlag(ctx, VISIBLE_FLAG);
 	else {
 		obs_set->y = el; /* Reset to true elevation */
-		ClearFlag(VISIBLE_FLAG);
+		ClearFlag(ctx, VISIBLE_FLAG);
 	}
 }
 
-void Calculate_RADec(double time, vector_t *pos, vector_t *vel,
+void Calculate_RADec(predict_ctx_t *ctx, double time, vector_t *pos, vector_t *vel,
 		geodetic_t *geodetic, vector_t *obs_set) {
 	/* Reference:  Methods of Orbit Determination by  */
 	/*             Pedro Ramon Escobal, pp. 401-402   */
@@ -1089,9 +1115,9 @@ void Calculate_RADec(double time, vector_t *pos, vector_t *vel,
 			Lzh, Sx, Ex, Zx, Sy, Ey, Zy, Sz, Ez, Zz, Lx, Ly, Lz, cos_delta,
 			sin_alpha, cos_alpha;
 
-	Calculate_Obs(time, pos, vel, geodetic, obs_set);
+	Calculate_Obs(ctx, time, pos, vel, geodetic, obs_set);
 
-	if (isFlagSet(VISIBLE_FLAG)) {
+	if (isFlagSet(ctx, VISIBLE_FLAG)) {
 		az = obs_set->x;
 		el = obs_set->y;
 		phi = geodetic->lat;
@@ -1126,7 +1152,7 @@ void Calculate_RADec(double time, vector_t *pos, vector_t *vel,
 
 /* PREDICT functions follow... */
 
-char *SubString(char *string, unsigned char start, unsigned char end) {
+char *SubString(predict_ctx_t *ctx, char *string, unsigned char start, unsigned char end) {
 	/* This function returns a substring based on the starting
 	 and ending positions provided.  It is used heavily in the
 	 AutoUpdate function when parsing 2-line element data. */
@@ -1136,12 +1162,12 @@ char *SubString(char *string, unsigned char start, unsigned char end) {
 	if (end >= start) {
 		for (x = start, y = 0; x <= end && string[x] != 0; x++)
 			if (string[x] != ' ') {
-				temp[y] = string[x];
+				ctx->temp[y] = string[x];
 				y++;
 			}
 
-		temp[y] = 0;
-		return temp;
+		ctx->temp[y] = 0;
+		return ctx->temp;
 	} else
 		return NULL;
 }
@@ -1185,30 +1211,30 @@ char KepCheck(char *line1, char *line2) {
 	return (x ? 0 : 1);
 }
 
-void InternalUpdate() {
+static void InternalUpdate(predict_ctx_t *ctx) {
 	/* Updates data in TLE structure based on
 	 line1 and line2 stored in structure. */
 
 	double tempnum;
 
-	strncpy(sat.designator, SubString(sat.line1, 9, 16), 8);
-	sat.designator[9] = 0;
-	sat.catnum = atol(SubString(sat.line1, 2, 6));
-	sat.year = atoi(SubString(sat.line1, 18, 19));
-	sat.refepoch = atof(SubString(sat.line1, 20, 31));
-	tempnum = 1.0e-5 * atof(SubString(sat.line1, 44, 49));
-	sat.nddot6 = tempnum / pow(10.0, (sat.line1[51] - '0'));
-	tempnum = 1.0e-5 * atof(SubString(sat.line1, 53, 58));
-	sat.bstar = tempnum / pow(10.0, (sat.line1[60] - '0'));
-	sat.setnum = atol(SubString(sat.line1, 64, 67));
-	sat.incl = atof(SubString(sat.line2, 8, 15));
-	sat.raan = atof(SubString(sat.line2, 17, 24));
-	sat.eccn = 1.0e-07 * atof(SubString(sat.line2, 26, 32));
-	sat.argper = atof(SubString(sat.line2, 34, 41));
-	sat.meanan = atof(SubString(sat.line2, 43, 50));
-	sat.meanmo = atof(SubString(sat.line2, 52, 62));
-	sat.drag = atof(SubString(sat.line1, 33, 42));
-	sat.orbitnum = atof(SubString(sat.line2, 63, 67));
+	strncpy(ctx->sat.designator, SubString(ctx, ctx->sat.line1, 9, 16), 8);
+	ctx->sat.designator[9] = 0;
+	ctx->sat.catnum = atol(SubString(ctx, ctx->sat.line1, 2, 6));
+	ctx->sat.year = atoi(SubString(ctx, ctx->sat.line1, 18, 19));
+	ctx->sat.refepoch = atof(SubString(ctx, ctx->sat.line1, 20, 31));
+	tempnum = 1.0e-5 * atof(SubString(ctx, ctx->sat.line1, 44, 49));
+	ctx->sat.nddot6 = tempnum / pow(10.0, (ctx->sat.line1[51] - '0'));
+	tempnum = 1.0e-5 * atof(SubString(ctx, ctx->sat.line1, 53, 58));
+	ctx->sat.bstar = tempnum / pow(10.0, (ctx->sat.line1[60] - '0'));
+	ctx->sat.setnum = atol(SubString(ctx, ctx->sat.line1, 64, 67));
+	ctx->sat.incl = atof(SubString(ctx, ctx->sat.line2, 8, 15));
+	ctx->sat.raan = atof(SubString(ctx, ctx->sat.line2, 17, 24));
+	ctx->sat.eccn = 1.0e-07 * atof(SubString(ctx, ctx->sat.line2, 26, 32));
+	ctx->sat.argper = atof(SubString(ctx, ctx->sat.line2, 34, 41));
+	ctx->sat.meanan = atof(SubString(ctx, ctx->sat.line2, 43, 50));
+	ctx->sat.meanmo = atof(SubString(ctx, ctx->sat.line2, 52, 62));
+	ctx->sat.drag = atof(SubString(ctx, ctx->sat.line1, 33, 42));
+	ctx->sat.orbitnum = atof(SubString(ctx, ctx->sat.line2, 63, 67));
 }
 
 long DayNum(int m, int d, int y) {
@@ -1235,36 +1261,36 @@ long DayNum(int m, int d, int y) {
 	return dn;
 }
 
-void set_calc_time(long time) {
-	daynum = (((double) time) / 86400.0) - 3651.0;
+void predict_set_time(predict_ctx_t *ctx, long time) {
+	ctx->daynum = (((double) time) / 86400.0) - 3651.0;
 }
 
-void PreCalc() {
+void predict_precalc(predict_ctx_t *ctx) {
 	/* This function copies TLE data from PREDICT's sat structure
-	 to the SGP4/SDP4's single dimensioned tle structure, and
+	 to the SGP4/SDP4's single dimensioned ctx->tle structure, and
 	 prepares the tracking code for the update. */
 
-	tle.catnr = sat.catnum;
-	tle.epoch = (1000.0 * (double) sat.year) + sat.refepoch;
-	tle.xndt2o = sat.drag;
-	tle.xndd6o = sat.nddot6;
-	tle.bstar = sat.bstar;
-	tle.xincl = sat.incl;
-	tle.xnodeo = sat.raan;
-	tle.eo = sat.eccn;
-	tle.omegao = sat.argper;
-	tle.xmo = sat.meanan;
-	tle.xno = sat.meanmo;
-	tle.revnum = sat.orbitnum;
-
-	if (sat_db.squintflag) {
-		calc_squint = 1;
-		alat = deg2rad * sat_db.alat;
-		alon = deg2rad * sat_db.alon;
+	ctx->tle.catnr = ctx->sat.catnum;
+	ctx->tle.epoch = (1000.0 * (double) ctx->sat.year) + ctx->sat.refepoch;
+	ctx->tle.xndt2o = ctx->sat.drag;
+	ctx->tle.xndd6o = ctx->sat.nddot6;
+	ctx->tle.bstar = ctx->sat.bstar;
+	ctx->tle.xincl = ctx->sat.incl;
+	ctx->tle.xnodeo = ctx->sat.raan;
+	ctx->tle.eo = ctx->sat.eccn;
+	ctx->tle.omegao = ctx->sat.argper;
+	ctx->tle.xmo = ctx->sat.meanan;
+	ctx->tle.xno = ctx->sat.meanmo;
+	ctx->tle.revnum = ctx->sat.orbitnum;
+
+	if (ctx->sat_db.squintflag) {
+		ctx->calc_squint = 1;
+		ctx->alat = deg2rad * ctx->sat_db.alat;
+		ctx->alon = deg2rad * ctx->sat_db.alon;
 	} else
-		calc_squint = 0;
+		ctx->calc_squint = 0;
 
-	ClearFlag(ALL_FLAGS);
+	ClearFlag(ctx, ALL_FLAGS);
 
 	/* Select ephemeris type.  This function will set or clear the
 	 DEEP_SPACE_EPHEM_FLAG depending on the TLE parameters of the
@@ -1272,18 +1298,23 @@ void PreCalc() {
 	 ephemeris functions SGP4 or SDP4, so this function must
 	 be called each time a new tle set is used. */
 
-	select_ephemeris(&tle);
+	select_ephemeris(&ctx->tle);
 }
 
-void Calc() {
+/* Observer geodetic position from the ground station in the context */
+static void predict_observer(const predict_ctx_t *ctx, geodetic_t *geodetic) {
+	geodetic->lat = ctx->qth.stnlat * deg2rad;
+	geodetic->lon = ctx->qth.stnlong * deg2rad;
+	geodetic->alt = ((double) ctx->qth.stnalt) / 1000.0;
+	geodetic->theta = 0.0;
+}
+
+void predict_calc(predict_ctx_t *ctx) {
 
 	/* This is the stuff we need to do repetitively... */
 
 	/*convert qth data to geodetic */
-	obs_geodetic.lat = qth.stnlat * deg2rad;
-	obs_geodetic.lon = qth.stnlong * deg2rad;
-	obs_geodetic.alt = ((double) qth.stnalt) / 1000.0;
-	obs_geodetic.theta = 0.0;
+	predict_observer(ctx, &ctx->obs_geodetic);
 
 	/* Zero vector for initializations */
 	vector_t zero_vector = { 0, 0, 0, 0 };
@@ -1304,18 +1335,18 @@ void Calc() {
 	/* Satellite's predicted geodetic position */
 	geodetic_t sat_geodetic;
 
-	jul_utc = daynum + 2444238.5;
+	ctx->jul_utc = ctx->daynum + 2444238.5;
 
 	/* Convert satellite's epoch time to Julian  */
 	/* and calculate time since epoch in minutes */
 
-	jul_epoch = Julian_Date_of_Epoch(tle.epoch);
-	tsince = (jul_utc - jul_epoch) * xmnpda;
-	age = jul_utc - jul_epoch;
+	ctx->jul_epoch = Julian_Date_of_Epoch(ctx->tle.epoch);
+	ctx->tsince = (ctx->jul_utc - ctx->jul_epoch) * xmnpda;
+	ctx->age = ctx->jul_utc - ctx->jul_epoch;
 
 	/* Call NORAD SGP4 routines For LEO satellites */
 
-	SGP4(tsince, &tle, &pos, &vel);
+	SGP4(ctx, ctx->tsince, &ctx->tle, &pos, &vel);
 
 	/* Scale position and velocity vectors to km and km/sec */
 
@@ -1324,100 +1355,523 @@ void Calc() {
 	/* Calculate velocity of satellite */
 
 	Magnitude(&vel);
-	sat_vel = vel.w;
+	ctx->sat_vel = vel.w;
 
 	/** All angles in rads. Distance in km. Velocity in km/s **/
 	/* Calculate satellite Azi, Ele, Range and Range-rate */
 
-	Calculate_Obs(jul_utc, &pos, &vel, &obs_geodetic, &obs_set);
+	Calculate_Obs(ctx, ctx->jul_utc, &pos, &vel, &ctx->obs_geodetic, &obs_set);
 
 	/* Calculate satellite Lat North, Lon East and Alt. */
 
-	Calculate_LatLonAlt(jul_utc, &pos, &sat_geodetic);
+	Calculate_LatLonAlt(ctx->jul_utc, &pos, &sat_geodetic);
 
 	/* Calculate squint angle */
 
-	if (calc_squint)
-		squint = (acos(-(ax * rx + ay * ry + az * rz) / obs_set.z)) / deg2rad;
+	if (ctx->calc_squint)
+		ctx->squint = (acos(-(ctx->ax * ctx->rx + ctx->ay * ctx->ry + ctx->az * ctx->rz) / obs_set.z)) / deg2rad;
 
 	/* Calculate solar position and satellite eclipse depth. */
 	/* Also set or clear the satellite eclipsed flag accordingly. */
 
-	Calculate_Solar_Position(jul_utc, &solar_vector);
-	Calculate_Obs(jul_utc, &solar_vector, &zero_vector, &obs_geodetic,
+	Calculate_Solar_Position(ctx->jul_utc, &solar_vector);
+	Calculate_Obs(ctx, ctx->jul_utc, &solar_vector, &zero_vector, &ctx->obs_geodetic,
 			&solar_set);
 
-	if (Sat_Eclipsed(&pos, &solar_vector, &eclipse_depth))
-		SetFlag(SAT_ECLIPSED_FLAG);
+	if (Sat_Eclipsed(&pos, &solar_vector, &ctx->eclipse_depth))
+		SetFlag(ctx, SAT_ECLIPSED_FLAG);
 	else
-		ClearFlag(SAT_ECLIPSED_FLAG);
+		ClearFlag(ctx, SAT_ECLIPSED_FLAG);
 
-	if (isFlagSet(SAT_ECLIPSED_FLAG))
-		sat_sun_status = 0; /* Eclipse */
+	if (isFlagSet(ctx, SAT_ECLIPSED_FLAG))
+		ctx->sat_sun_status = 0; /* Eclipse */
 	else
-		sat_sun_status = 1; /* In sunlight */
+		ctx->sat_sun_status = 1; /* In sunlight */
 
 	/* Convert satellite and solar data */
-	sat_azi = Degrees(obs_set.x);
-	sat_ele = Degrees(obs_set.y);
-	sat_range = obs_set.z;
-	sat_range_rate = obs_set.w;
-	sat_lat = Degrees(sat_geodetic.lat);
-	sat_lon = Degrees(sat_geodetic.lon);
-	sat_alt = sat_geodetic.alt;
-
-	fk = 12756.33 * acos(xkmper / (xkmper + sat_alt));
-	fm = fk / 1.609344;
-
-	rv = (long) floor(
-			(tle.xno * xmnpda / twopi + age * tle.bstar * ae)
-					* age+tle.xmo/twopi)+tle.revnum;
-
-	sun_azi = Degrees(solar_set.x);
-	sun_ele = Degrees(solar_set.y);
-
-	irk = (long) Round(sat_range);
-	isplat = (int) Round(sat_lat);
-	isplong = (int) Round(360.0 - sat_lon);
-	iaz = (int) Round(sat_azi);
-	iel = (int) Round(sat_ele);
-	ma256 = (int) Round(256.0 * (phase / twopi));
-
-	if (sat_sun_status) {
-		if (sun_ele <= -12.0 && sat_ele >= 0.0)
-			findsun = '+';
+	ctx->sat_azi = Degrees(obs_set.x);
+	ctx->sat_ele = Degrees(obs_set.y);
+	ctx->sat_range = obs_set.z;
+	ctx->sat_range_rate = obs_set.w;
+	ctx->sat_lat = Degrees(sat_geodetic.lat);
+	ctx->sat_lon = Degrees(sat_geodetic.lon);
+	ctx->sat_alt = sat_geodetic.alt;
+
+	ctx->fk = 12756.33 * acos(xkmper / (xkmper + ctx->sat_alt));
+	ctx->fm = ctx->fk / 1.609344;
+
+	ctx->rv = (long) floor(
+			(ctx->tle.xno * xmnpda / twopi + ctx->age * ctx->tle.bstar * ae)
+					* ctx->age+ctx->tle.xmo/twopi)+ctx->tle.revnum;
+
+	ctx->sun_azi = Degrees(solar_set.x);
+	ctx->sun_ele = Degrees(solar_set.y);
+
+	ctx->irk = (long) Round(ctx->sat_range);
+	ctx->isplat = (int) Round(ctx->sat_lat);
+	ctx->isplong = (int) Round(360.0 - ctx->sat_lon);
+	ctx->iaz = (int) Round(ctx->sat_azi);
+	ctx->iel = (int) Round(ctx->sat_ele);
+	ctx->ma256 = (int) Round(256.0 * (ctx->phase / twopi));
+
+	if (ctx->sat_sun_status) {
+		if (ctx->sun_ele <= -12.0 && ctx->sat_ele >= 0.0)
+			ctx->findsun = '+';
 		else
-			findsun = '*';
+			ctx->findsun = '*';
 	} else
-		findsun = ' ';
+		ctx->findsun = ' ';
+}
+
+/* Azimuth, elevation, range and range rate only. This is the part of
+ predict_calc() the pass search and sky plots need; the solar position,
+ eclipse, ground track and squint calculations are skipped. */
+static void predict_look(predict_ctx_t *ctx, double jul_utc, double jul_epoch,
+		geodetic_t *geodetic, vector_t *obs_set) {
+	vector_t pos = { 0, 0, 0, 0 };
+	vector_t vel = { 0, 0, 0, 0 };
+
+	SGP4(ctx, (jul_utc - jul_epoch) * xmnpda, &ctx->tle, &pos, &vel);
+	Convert_Sat_State(&pos, &vel);
+	Calculate_Obs(ctx, jul_utc, &pos, &vel, geodetic, obs_set);
+}
+
+/* Look angles for an array of Julian dates, one sample at a time */
+static void predict_look_batch_sw(predict_ctx_t *ctx, const geodetic_t *geodetic,
+		double jul_epoch, const double *jul_utc, int count, double *azi,
+		double *ele, double *range, double *range_rate) {
+	geodetic_t obs = *geodetic;
+	vector_t obs_set;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		predict_look(ctx, jul_utc[i], jul_epoch, &obs, &obs_set);
+		if (azi)
+			azi[i] = Degrees(obs_set.x);
+		if (ele)
+			ele[i] = Degrees(obs_set.y);
+		if (range)
+			range[i] = obs_set.z;
+		if (range_rate)
+			range_rate[i] = obs_set.w;
+	}
+}
+
+typedef void (*predict_look_batch_fn_t)(predict_ctx_t *ctx,
+		const geodetic_t *geodetic, double jul_epoch, const double *jul_utc,
+		int count, double *azi, double *ele, double *range, double *range_rate);
+
+#ifdef PREDICT_X86
+
+/* Four samples in the lanes of an AVX register, structure of arrays.
+ GCC vector extensions for the arithmetic, lane masks for the branches. */
+typedef double predict_v4_t __attribute__((vector_size(32)));
+typedef long predict_m4_t __attribute__((vector_size(32)));
+
+#define PREDICT_V4_INLINE static inline __attribute__((always_inline, target("avx2")))
+
+PREDICT_V4_INLINE predict_v4_t predict_v4_select(predict_m4_t mask,
+		predict_v4_t a, predict_v4_t b) {
+	return (predict_v4_t) ((mask & (predict_m4_t) a) | (~mask & (predict_m4_t) b));
+}
+
+PREDICT_V4_INLINE predict_v4_t predict_v4_sqrt(predict_v4_t x) {
+	return (predict_v4_t) _mm256_sqrt_pd((__m256d) x);
+}
+
+PREDICT_V4_INLINE predict_v4_t predict_v4_floor(predict_v4_t x) {
+	return (predict_v4_t) _mm256_floor_pd((__m256d) x);
+}
+
+PREDICT_V4_INLINE predict_v4_t predict_v4_trunc(predict_v4_t x) {
+	return (predict_v4_t) _mm256_round_pd((__m256d) x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+}
+
+/* Same steps as the scalar FMod2p() and Modulus() */
+PREDICT_V4_INLINE predict_v4_t predict_v4_modulus(predict_v4_t x, double m) {
+	x -= predict_v4_trunc(x / m) * m;
+	return predict_v4_select(x < 0.0, x + m, x);
+}
+
+/* Cephes sin() and cos(): octant reduction with pi/4 split in three
+ parts and the same minimax polynomials */
+PREDICT_V4_INLINE void predict_v4_sincos(predict_v4_t x, predict_v4_t *sinx,
+		predict_v4_t *cosx) {
+	predict_v4_t ax = predict_v4_select(x < 0.0, -x, x);
+	predict_v4_t y = predict_v4_floor(ax * 1.27323954473516268615);
+	predict_v4_t j, z, zz, ps, pc, sn, cn;
+
+	/* Odd octants move up to the next zero */
+	y += y - 2.0 * predict_v4_floor(y * 0.5);
+	j = y - 8.0 * predict_v4_floor(y * 0.125);
+
+	z = ((ax - y * 7.85398125648498535156E-1) - y * 3.77489470793079817668E-8)
+			- y * 2.69515142907905952645E-15;
+	zz = z * z;
+	ps = z + z * zz * (((((1.58962301576546568060E-10 * zz
+			- 2.50507477628578072866E-8) * zz + 2.75573136213857245213E-6) * zz
+			- 1.98412698295895385996E-4) * zz + 8.33333333332211858878E-3) * zz
+			- 1.66666666666666307295E-1);
+	pc = 1.0 - 0.5 * zz + zz * zz * (((((-1.13585365213876817300E-11 * zz
+			+ 2.08757008419747316778E-9) * zz - 2.75573141792967388112E-7) * zz
+			+ 2.48015872888517045348E-5) * zz - 1.38888888888730564116E-3) * zz
+			+ 4.16666666666665929218E-2);
+
+	sn = predict_v4_select((j == 2.0) | (j == 6.0), pc, ps);
+	cn = predict_v4_select((j == 2.0) | (j == 6.0), ps, pc);
+	sn = predict_v4_select(j >= 4.0, -sn, sn);
+	cn = predict_v4_select((j == 2.0) | (j == 4.0), -cn, cn);
+	*sinx = predict_v4_select(x < 0.0, -sn, sn);
+	*cosx = cn;
+}
+
+/* Cephes atan() */
+PREDICT_V4_INLINE predict_v4_t predict_v4_atan(predict_v4_t x) {
+	predict_v4_t ax = predict_v4_select(x < 0.0, -x, x);
+	predict_m4_t big = ax > 2.41421356237309504880;
+	predict_m4_t mid = ~big & (ax > 0.66);
+	predict_v4_t zero = { 0.0, 0.0, 0.0, 0.0 };
+	predict_v4_t y, more, z, r;
+
+	r = predict_v4_select(big, -1.0 / ax,
+			predict_v4_select(mid, (ax - 1.0) / (ax + 1.0), ax));
+	y = predict_v4_select(big, zero + pio2, predict_v4_select(mid, zero + pio2 * 0.5, zero));
+	more = predict_v4_select(big, zero + 6.123233995736765886130E-17,
+			predict_v4_select(mid, zero + 3.061616997868382943065E-17, zero));
+	z = r * r;
+	z = z * ((((-8.750608600031904122785E-1 * z - 1.615753718733365076637E1) * z
+			- 7.500855792314704667340E1) * z - 1.228866684490136173410E2) * z
+			- 6.485021904942025371773E1)
+			/ (((((z + 2.485846490142306297962E1) * z + 1.650270098316988542046E2) * z
+					+ 4.328810604912902668951E2) * z + 4.853903996359136964868E2) * z
+					+ 1.945506571482613964425E2);
+	y += r * z + r + more;
+	return predict_v4_select(x < 0.0, -y, y);
+}
+
+/* AcTan() and ArcSin() with the same branches as lane selects */
+PREDICT_V4_INLINE predict_v4_t predict_v4_actan(predict_v4_t sinx, predict_v4_t cosx) {
+	predict_v4_t t = predict_v4_atan(sinx / cosx);
+
+	t = predict_v4_select(cosx > 0.0, predict_v4_select(sinx > 0.0, t, twopi + t), pi + t);
+	return predict_v4_select(cosx == 0.0, predict_v4_select(sinx > 0.0,
+			(predict_v4_t) { pio2, pio2, pio2, pio2 },
+			(predict_v4_t) { x3pio2, x3pio2, x3pio2, x3pio2 }), t);
+}
+
+PREDICT_V4_INLINE predict_v4_t predict_v4_arcsin(predict_v4_t x) {
+	predict_v4_t t = predict_v4_atan(x / predict_v4_sqrt(1.0 - x * x));
+
+	return predict_v4_select(x >= 1.0, (predict_v4_t) { pio2, pio2, pio2, pio2 },
+			predict_v4_select(x <= -1.0, (predict_v4_t) { -pio2, -pio2, -pio2, -pio2 }, t));
+}
+
+/* predict_look() for four Julian dates: SGP4() without the
+ initialisation, Convert_Sat_State() and Calculate_Obs(). The observer
+ terms that do not depend on time are passed in. */
+PREDICT_V4_INLINE void predict_look_v4(const predict_ctx_t *ctx,
+		const geodetic_t *geodetic, double achcp, double obs_z,
+		double jul_epoch, const double *jul_utc, predict_v4_t *obs_set) {
+	const sgp4_state_t *st = &ctx->sgp4;
+	const tle_t *tle = &ctx->tle;
+
+	predict_v4_t jul, tsince, xmdf, omgadf, xnode, omega, xmp, tsq, tempa,
+			tempe, templ, temp, temp1, temp2, temp3, temp4, temp5, temp6,
+			tcube, tfour, a, e, xl, beta, xn, axn, ayn, xlt, capu, epw,
+			sinepw, cosepw, sinw, cosw, ecose, esine, pl, r, rdot, rfdot,
+			betal, cosu, sinu, u, sin2u, cos2u, rk, uk, xnodek, xinck, rdotk,
+			rfdotk, sinuk, cosuk, sinik, cosik, sinnok, cosnok, xmx, xmy, ux,
+			uy, uz, vx, vy, vz, px, py, pz, theta, sin_theta, cos_theta,
+			obs_x, obs_y, rx, ry, rz, rw, top_s, top_e, top_z, azim;
+	predict_m4_t active = { -1, -1, -1, -1 }, done;
+	double sin_lat = sin(geodetic->lat), cos_lat = cos(geodetic->lat);
+	int i;
+
+	memcpy(&jul, jul_utc, sizeof(jul));
+	tsince = (jul - jul_epoch) * xmnpda;
+
+	/* Update for secular gravity and atmospheric drag. */
+	xmdf = tle->xmo + st->xmdot * tsince;
+	omgadf = tle->omegao + st->omgdot * tsince;
+	omega = omgadf;
+	xmp = xmdf;
+	tsq = tsince * tsince;
+	xnode = tle->xnodeo + st->xnodot * tsince + st->xnodcf * tsq;
+	tempa = 1 - st->c1 * tsince;
+	tempe = tle->bstar * st->c4 * tsince;
+	templ = st->t2cof * tsq;
+
+	if (!(ctx->Flags & SIMPLE_FLAG)) {
+		predict_v4_sincos(xmdf, &sinw, &cosw);
+		temp1 = 1 + st->eta * cosw;
+		temp = st->omgcof * tsince + st->xmcof * (temp1 * temp1 * temp1 - st->delmo);
+		xmp = xmdf + temp;
+		omega = omgadf - temp;
+		tcube = tsq * tsince;
+		tfour = tsince * tcube;
+		tempa = tempa - st->d2 * tsq - st->d3 * tcube - st->d4 * tfour;
+		predict_v4_sincos(xmp, &sinw, &cosw);
+		tempe = tempe + tle->bstar * st->c5 * (sinw - st->sinmo);
+		templ = templ + st->t3cof * tcube + tfour * (st->t4cof + tsince * st->t5cof);
+	}
+
+	a = st->aodp * tempa * tempa;
+	e = tle->eo - tempe;
+	xl = xmp + omega + xnode + st->xnodp * templ;
+	beta = predict_v4_sqrt(1 - e * e);
+	xn = xke / (a * predict_v4_sqrt(a));
+
+	/* Long period periodics */
+	predict_v4_sincos(omega, &sinw, &cosw);
+	axn = e * cosw;
+	temp = 1 / (a * beta * beta);
+	xlt = xl + temp * st->xlcof * axn;
+	ayn = e * sinw + temp * st->aycof;
+
+	/* Solve Kepler's Equation, lanes stop updating once converged */
+	capu = predict_v4_modulus(xlt - xnode, twopi);
+	temp2 = capu;
+	sinepw = cosepw = temp3 = temp4 = temp5 = temp6 = capu;
+
+	for (i = 0; i <= 10; i++) {
+		predict_v4_sincos(temp2, &sinw, &cosw);
+		sinepw = predict_v4_select(active, sinw, sinepw);
+		cosepw = predict_v4_select(active, cosw, cosepw);
+		temp3 = predict_v4_select(active, axn * sinw, temp3);
+		temp4 = predict_v4_select(active, ayn * cosw, temp4);
+		temp5 = predict_v4_select(active, axn * cosw, temp5);
+		temp6 = predict_v4_select(active, ayn * sinw, temp6);
+		epw = (capu - temp4 + temp3 - temp2) / (1 - temp5 - temp6) + temp2;
+
+		done = predict_v4_select(epw - temp2 < 0.0, temp2 - epw, epw - temp2) <= e6a;
+		temp2 = predict_v4_select(active & ~done, epw, temp2);
+		active &= ~done;
+		if (!(active[0] | active[1] | active[2] | active[3]))
+			break;
+	}
+
+	/* Short period preliminary quantities */
+	ecose = temp5 + temp6;
+	esine = temp3 - temp4;
+	temp = 1 - (axn * axn + ayn * ayn);
+	pl = a * temp;
+	r = a * (1 - ecose);
+	temp1 = 1 / r;
+	rdot = xke * predict_v4_sqrt(a) * esine * temp1;
+	rfdot = xke * predict_v4_sqrt(pl) * temp1;
+	temp2 = a * temp1;
+	betal = predict_v4_sqrt(temp);
+	temp3 = 1 / (1 + betal);
+	cosu = temp2 * (cosepw - axn + ayn * esine * temp3);
+	sinu = temp2 * (sinepw - ayn - axn * esine * temp3);
+	u = predict_v4_actan(sinu, cosu);
+	sin2u = 2 * sinu * cosu;
+	cos2u = 2 * cosu * cosu - 1;
+	temp = 1 / pl;
+	temp1 = ck2 * temp;
+	temp2 = temp1 * temp;
+
+	/* Update for short periodics */
+	rk = r * (1 - 1.5 * temp2 * betal * st->x3thm1) + 0.5 * temp1 * st->x1mth2 * cos2u;
+	uk = u - 0.25 * temp2 * st->x7thm1 * sin2u;
+	xnodek = xnode + 1.5 * temp2 * st->cosio * sin2u;
+	xinck = tle->xincl + 1.5 * temp2 * st->cosio * st->sinio * cos2u;
+	rdotk = rdot - xn * temp1 * st->x1mth2 * sin2u;
+	rfdotk = rfdot + xn * temp1 * (st->x1mth2 * cos2u + 1.5 * st->x3thm1);
+
+	/* Orientation vectors */
+	predict_v4_sincos(uk, &sinuk, &cosuk);
+	predict_v4_sincos(xinck, &sinik, &cosik);
+	predict_v4_sincos(xnodek, &sinnok, &cosnok);
+	xmx = -sinnok * cosik;
+	xmy = cosnok * cosik;
+	ux = xmx * sinuk + cosnok * cosuk;
+	uy = xmy * sinuk + sinnok * cosuk;
+	uz = sinik * sinuk;
+	vx = xmx * cosuk - cosnok * sinuk;
+	vy = xmy * cosuk - sinnok * sinuk;
+	vz = sinik * cosuk;
+
+	/* Position and velocity in km and km/s */
+	px = rk * ux * xkmper;
+	py = rk * uy * xkmper;
+	pz = rk * uz * xkmper;
+	vx = (rdotk * ux + rfdotk * vx) * (xkmper * xmnpda / secday);
+	vy = (rdotk * uy + rfdotk * vy) * (xkmper * xmnpda / secday);
+	vz = (rdotk * uz + rfdotk * vz) * (xkmper * xmnpda / secday);
+
+	/* Observer ECI position from ThetaG_JD() */
+	temp = jul + 0.5;
+	temp1 = temp - predict_v4_floor(temp);
+	temp = (jul - temp1 - 2451545.0) / 36525;
+	temp = 24110.54841 + temp * (8640184.812866 + temp * (0.093104 - temp * 6.2E-6));
+	temp = predict_v4_modulus(temp + secday * omega_E * temp1, secday);
+	theta = predict_v4_modulus(twopi * temp / secday + geodetic->lon, twopi);
+	predict_v4_sincos(theta, &sin_theta, &cos_theta);
+	obs_x = achcp * cos_theta;
+	obs_y = achcp * sin_theta;
+
+	/* Topocentric look angles, as Calculate_Obs() */
+	rx = px - obs_x;
+	ry = py - obs_y;
+	rz = pz - obs_z;
+	vx += mfactor * obs_y;
+	vy -= mfactor * obs_x;
+	rw = predict_v4_sqrt(rx * rx + ry * ry + rz * rz);
+
+	top_s = sin_lat * cos_theta * rx + sin_lat * sin_theta * ry - cos_lat * rz;
+	top_e = -sin_theta * rx + cos_theta * ry;
+	top_z = cos_lat * cos_theta * rx + cos_lat * sin_theta * ry + sin_lat * rz;
+	azim = predict_v4_atan(-top_e / top_s);
+	azim = predict_v4_select(top_s > 0.0, azim + pi, azim);
+	azim = predict_v4_select(azim < 0.0, azim + twopi, azim);
+
+	obs_set[0] = azim;
+	obs_set[1] = predict_v4_arcsin(top_z / rw);
+	obs_set[2] = rw;
+	obs_set[3] = (rx * vx + ry * vy + rz * vz) / rw;
+}
+
+__attribute__((target("avx2")))
+static void predict_look_batch_avx2(predict_ctx_t *ctx,
+		const geodetic_t *geodetic, double jul_epoch, const double *jul_utc,
+		int count, double *azi, double *ele, double *range, double *range_rate) {
+	predict_v4_t obs_set[4];
+	double c, sq, achcp, obs_z;
+	int i, k;
+
+	/* Observer terms of Calculate_User_PosVel() that are fixed in time */
+	c = 1 / sqrt(1 + f * (f - 2) * Sqr(sin(geodetic->lat)));
+	sq = Sqr(1 - f) * c;
+	achcp = (xkmper * c + geodetic->alt) * cos(geodetic->lat);
+	obs_z = (xkmper * sq + geodetic->alt) * sin(geodetic->lat);
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		predict_look_v4(ctx, geodetic, achcp, obs_z, jul_epoch, &jul_utc[i], obs_set);
+		for (k = 0; k < 4; k++) {
+			if (azi)
+				azi[i + k] = obs_set[0][k] / deg2rad;
+			if (ele)
+				ele[i + k] = obs_set[1][k] / deg2rad;
+			if (range)
+				range[i + k] = obs_set[2][k];
+			if (range_rate)
+				range_rate[i + k] = obs_set[3][k];
+		}
+	}
+
+	predict_look_batch_sw(ctx, geodetic, jul_epoch, &jul_utc[i], count - i,
+			azi ? &azi[i] : NULL, ele ? &ele[i] : NULL,
+			range ? &range[i] : NULL, range_rate ? &range_rate[i] : NULL);
+}
+
+#endif // PREDICT_X86
+
+static void predict_look_batch_select(predict_ctx_t *ctx,
+		const geodetic_t *geodetic, double jul_epoch, const double *jul_utc,
+		int count, double *azi, double *ele, double *range, double *range_rate);
+
+static predict_look_batch_fn_t predict_look_batch_impl = predict_look_batch_select;
+
+/* Pick the batch kernel on first use, every caller stores the same pointer */
+static void predict_look_batch_select(predict_ctx_t *ctx,
+		const geodetic_t *geodetic, double jul_epoch, const double *jul_utc,
+		int count, double *azi, double *ele, double *range, double *range_rate) {
+	predict_look_batch_fn_t batch_fn = predict_look_batch_sw;
+
+#ifdef PREDICT_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		batch_fn = predict_look_batch_avx2;
+#endif
+
+	__atomic_store_n(&predict_look_batch_impl, batch_fn, __ATOMIC_RELAXED);
+	batch_fn(ctx, geodetic, jul_epoch, jul_utc, count, azi, ele, range, range_rate);
+}
+
+/* Look angles over Julian dates. The kernels read the SGP4 state, so it
+ is initialised here first. */
+static void predict_look_batch(predict_ctx_t *ctx, const double *jul_utc,
+		int count, double *azi, double *ele, double *range, double *range_rate) {
+	geodetic_t geodetic;
+	vector_t pos, vel;
+
+	if (count <= 0)
+		return;
+
+	if (isFlagClear(ctx, SGP4_INITIALIZED_FLAG))
+		SGP4(ctx, 0.0, &ctx->tle, &pos, &vel);
+
+	/* Loop invariants: observer position and TLE epoch */
+	predict_observer(ctx, &geodetic);
+	__atomic_load_n(&predict_look_batch_impl, __ATOMIC_RELAXED)(ctx, &geodetic,
+			Julian_Date_of_Epoch(ctx->tle.epoch), jul_utc, count, azi, ele,
+			range, range_rate);
+}
+
+void predict_calc_batch(predict_ctx_t *ctx, const double *times, int count,
+		double *azi, double *ele, double *range, double *range_rate) {
+	double jul_utc[PREDICT_BATCH_CHUNK];
+	int i, n;
+
+	for (i = 0; i < count; i += n) {
+		n = count - i < PREDICT_BATCH_CHUNK ? count - i : PREDICT_BATCH_CHUNK;
+		for (int k = 0; k < n; k++)
+			jul_utc[k] = times[i + k] / 86400.0 - 3651.0 + 2444238.5;
+		predict_look_batch(ctx, jul_utc, n, azi ? &azi[i] : NULL,
+				ele ? &ele[i] : NULL, range ? &range[i] : NULL,
+				range_rate ? &range_rate[i] : NULL);
+	}
+}
+
+void predict_calc_sats(predict_ctx_t **ctx, int count, long time,
+		double *azi, double *ele, double *range, double *range_rate) {
+	geodetic_t geodetic;
+	vector_t obs_set;
+	double jul_utc = ((double) time) / 86400.0 - 3651.0 + 2444238.5;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		predict_observer(ctx[i], &geodetic);
+		predict_look(ctx[i], jul_utc, Julian_Date_of_Epoch(ctx[i]->tle.epoch),
+				&geodetic, &obs_set);
+		if (azi)
+			azi[i] = Degrees(obs_set.x);
+		if (ele)
+			ele[i] = Degrees(obs_set.y);
+		if (range)
+			range[i] = obs_set.z;
+		if (range_rate)
+			range_rate[i] = obs_set.w;
+	}
 }
 
-char AosHappens() {
+static char AosHappens(predict_ctx_t *ctx) {
 	/* This function returns a 1 if the satellite pointed to by
 	 "x" can ever rise above the horizon of the ground station. */
 
 	double lin, sma, apogee;
 
-	if (sat.meanmo == 0.0)
+	if (ctx->sat.meanmo == 0.0)
 		return 0;
 	else {
-		lin = sat.incl;
+		lin = ctx->sat.incl;
 
 		if (lin >= 90.0)
 			lin = 180.0 - lin;
 
-		sma = 331.25 * exp(log(1440.0 / sat.meanmo) * (2.0 / 3.0));
-		apogee = sma * (1.0 + sat.eccn) - xkmper;
+		sma = 331.25 * exp(log(1440.0 / ctx->sat.meanmo) * (2.0 / 3.0));
+		apogee = sma * (1.0 + ctx->sat.eccn) - xkmper;
 
 		if ((acos(xkmper / (apogee + xkmper)) + (lin * deg2rad))
-				> fabs(qth.stnlat * deg2rad))
+				> fabs(ctx->qth.stnlat * deg2rad))
 			return 1;
 		else
 			return 0;
 	}
 }
 
-char Decayed(double time) {
+static char Decayed(predict_ctx_t *ctx, double time) {
 	/* This function returns a 1 if it appears that the
 	 satellite pointed to by 'x' has decayed at the
 	 time of 'time'.  If 'time' is 0.0, then the
@@ -1429,35 +1883,97 @@ char Decayed(double time) {
 		time = CurrentDaynum();
 	}
 
-	satepoch = DayNum(1, 0, sat.year) + sat.refepoch;
+	satepoch = DayNum(1, 0, ctx->sat.year) + ctx->sat.refepoch;
 
-	if (satepoch + ((16.666666 - sat.meanmo) / (10.0 * fabs(sat.drag))) < time)
+	if (satepoch + ((16.666666 - ctx->sat.meanmo) / (10.0 * fabs(ctx->sat.drag))) < time)
 		return 1;
 	else
 		return 0;
 }
 
-double FindAOS() {
-	/* This function finds and returns the time of AOS (aostime). */
+/* Lowest altitude the orbit reaches, the coarse search steps below grow
+ with altitude so this keeps them on the safe side */
+static double predict_perigee_alt(const predict_ctx_t *ctx) {
+	double sma = 331.25 * exp(log(1440.0 / ctx->sat.meanmo) * (2.0 / 3.0));
+	double alt = sma * (1.0 - ctx->sat.eccn) - xkmper;
 
-	aostime = 0.0;
+	/* Decaying orbits may dip below the surface */
+	return alt < 100.0 ? 100.0 : alt;
+}
 
-	if (AosHappens() && Decayed(daynum) == 0) {
-		Calc();
+/* Coarse step towards AOS from an elevation below -1 deg */
+static double predict_aos_step(double ele, double alt) {
+	/* Technically, this should be:
 
-		/* Get the satellite in range */
+	 0.0007*(sat_ele*(((sat_alt/8400.0)+0.46))-2.0);
 
-		while (sat_ele < -1.0) {
-			daynum -= 0.00035 * (sat_ele * (((sat_alt / 8400.0) + 0.46)) - 2.0);
+	 but it sometimes skipped passes for
+	 satellites in highly elliptical orbits. */
 
-			/* Technically, this should be:
+	return -0.00035 * (ele * (((alt / 8400.0) + 0.46)) - 2.0);
+}
 
-			 daynum-=0.0007*(sat_ele*(((sat_alt/8400.0)+0.46))-2.0);
+/* Coarse step through a pass towards LOS */
+static double predict_los_step(double ele, double alt) {
+	return cos((ele - 1.0) * deg2rad) * sqrt(alt) / 25000.0;
+}
 
-			 but it sometimes skipped passes for
-			 satellites in highly elliptical orbits. */
+/* Step forward from daynum, starting at elevation ele, until the
+ elevation is >= -1 deg (aos) or < 0 deg (los). At least one step is
+ taken. Each step is the one
+ the scalar search would take from the previous elevation. Several steps
+ of the current size are evaluated in one batch, and samples are kept
+ while every step stays within what its predecessor allows. */
+static double predict_scan(predict_ctx_t *ctx, double daynum, double ele, int aos) {
+	double jul_utc[PREDICT_SCAN_STEPS], batch_ele[PREDICT_SCAN_STEPS];
+	double alt = predict_perigee_alt(ctx);
+	double step;
+	int i;
 
-			Calc();
+	do {
+		step = aos ? predict_aos_step(ele, alt) : predict_los_step(ele, alt);
+		for (i = 0; i < PREDICT_SCAN_STEPS; i++)
+			jul_utc[i] = daynum + (i + 1) * step + 2444238.5;
+		predict_look_batch(ctx, jul_utc, PREDICT_SCAN_STEPS, NULL, batch_ele, NULL, NULL);
+
+		for (i = 0; i < PREDICT_SCAN_STEPS; i++) {
+			ele = batch_ele[i];
+			if (aos ? ele >= -1.0 || predict_aos_step(ele, alt) < step
+					: ele < 0.0 || predict_los_step(ele, alt) < step)
+				break;
+		}
+		if (i == PREDICT_SCAN_STEPS)
+			i--;
+		daynum += (i + 1) * step;
+	} while (aos ? ele < -1.0 : ele >= 0.0);
+
+	return daynum;
+}
+
+/* Elevation alone at a day number, for the fine search steps */
+static double predict_ele_at(predict_ctx_t *ctx, double daynum) {
+	double jul_utc = daynum + 2444238.5;
+	double ele;
+
+	predict_look_batch(ctx, &jul_utc, 1, NULL, &ele, NULL, NULL);
+	return ele;
+}
+
+double predict_find_aos(predict_ctx_t *ctx) {
+	/* This function finds and returns the time of AOS (aostime). */
+
+	double ele;
+
+	ctx->aostime = 0.0;
+
+	if (AosHappens(ctx) && Decayed(ctx, ctx->daynum) == 0) {
+		predict_calc(ctx);
+
+		/* Get the satellite in range */
+
+		if (ctx->sat_ele < -1.0) {
+			ctx->daynum = predict_scan(ctx, ctx->daynum, ctx->sat_ele, 1);
+			predict_calc(ctx);
 		}
 
 		/* Find AOS */
@@ -1466,157 +1982,235 @@ double FindAOS() {
 		 this section goes into an infinite loop when tracking
 		 the Sun if their QTH is below 30 deg N! **/
 
-		while (aostime == 0.0) {
-			if (fabs(sat_ele) < 0.03)
-				aostime = daynum;
-			else {
-				daynum -= sat_ele * sqrt(sat_alt) / 530000.0;
-				Calc();
-			}
+		/* The altitude hardly changes over these few seconds */
+		ele = ctx->sat_ele;
+		while (fabs(ele) >= 0.03) {
+			ctx->daynum -= ele * sqrt(ctx->sat_alt) / 530000.0;
+			ele = predict_ele_at(ctx, ctx->daynum);
 		}
+
+		ctx->aostime = ctx->daynum;
+		predict_calc(ctx);
 	}
 
-	return aostime;
+	return ctx->aostime;
 }
 
-double FindLOS() {
-	lostime = 0.0;
+double predict_find_los(predict_ctx_t *ctx) {
+	double ele;
 
-	if (AosHappens() == 1 && Decayed(daynum) == 0) {
-		Calc();
+	ctx->lostime = 0.0;
 
-		do {
-			daynum += sat_ele * sqrt(sat_alt) / 502500.0;
-			Calc();
+	if (AosHappens(ctx) == 1 && Decayed(ctx, ctx->daynum) == 0) {
+		predict_calc(ctx);
 
-			if (fabs(sat_ele) < 0.03)
-				lostime = daynum;
+		ele = ctx->sat_ele;
+		do {
+			ctx->daynum += ele * sqrt(ctx->sat_alt) / 502500.0;
+			ele = predict_ele_at(ctx, ctx->daynum);
+		} while (fabs(ele) >= 0.03);
 
-		} while (lostime == 0.0);
+		ctx->lostime = ctx->daynum;
+		predict_calc(ctx);
 	}
 
-	return lostime;
+	return ctx->lostime;
 }
 
-double FindLOS2() {
+double predict_find_los2(predict_ctx_t *ctx) {
 	/* This function steps through the pass to find LOS.
-	 FindLOS() is called to "fine tune" and return the result. */
+	 predict_find_los() is called to "fine tune" and return the result. */
 
-	do {
-		daynum += cos((sat_ele - 1.0) * deg2rad) * sqrt(sat_alt) / 25000.0;
-		Calc();
-
-	} while (sat_ele >= 0.0);
+	ctx->daynum = predict_scan(ctx, ctx->daynum, ctx->sat_ele, 0);
 
-	return (FindLOS());
+	return (predict_find_los(ctx));
 }
 
-double NextAOS() {
+double predict_next_aos(predict_ctx_t *ctx) {
 	/* This function finds and returns the time of the next
 	 AOS for a satellite that is currently in range. */
 
-	aostime = 0.0;
-
-	if (AosHappens() && Decayed(daynum) == 0)
-		daynum = FindLOS2() + 0.014; /* Move to LOS + 20 minutes */
-
-	return (FindAOS());
-}
-
-void getSatInfo(sat_info_t *info) {
-	info->tsince = tsince;
-	info->jul_epoch = jul_epoch;
-	info->jul_utc = jul_utc;
-	info->eclipse_depth = eclipse_depth;
-	info->sat_azi = sat_azi;
-	info->sat_ele = sat_ele;
-	info->sat_range = sat_range;
-	info->sat_range_rate = sat_range_rate;
-	info->sat_lat = sat_lat;
-	info->sat_lon = sat_lon;
-	info->sat_alt = sat_alt;
-	info->sat_vel = sat_vel;
-	info->phase = phase;
-	info->sun_azi = sun_azi;
-	info->sun_ele = sun_ele;
-	info->daynum = daynum;
-	info->fm = fm;
-	info->fk = fk;
-	info->age = age;
-	info->aostime = aostime;
-	info->lostime = lostime;
-	info->ax = ax;
-	info->ay = ay;
-	info->az = az;
-	info->rx = rx;
-	info->ry = ry;
-	info->rz = rz;
-	info->squint = squint;
-	info->alat = alat;
-	info->alon = alon;
-}
-
-int setTLE(char* line1, char* line2) {
+	ctx->aostime = 0.0;
+
+	if (AosHappens(ctx) && Decayed(ctx, ctx->daynum) == 0)
+		ctx->daynum = predict_find_los2(ctx) + 0.014; /* Move to LOS + 20 minutes */
+
+	return (predict_find_aos(ctx));
+}
+
+void predict_get_info(predict_ctx_t *ctx, sat_info_t *info) {
+	info->tsince = ctx->tsince;
+	info->jul_epoch = ctx->jul_epoch;
+	info->jul_utc = ctx->jul_utc;
+	info->eclipse_depth = ctx->eclipse_depth;
+	info->sat_azi = ctx->sat_azi;
+	info->sat_ele = ctx->sat_ele;
+	info->sat_range = ctx->sat_range;
+	info->sat_range_rate = ctx->sat_range_rate;
+	info->sat_lat = ctx->sat_lat;
+	info->sat_lon = ctx->sat_lon;
+	info->sat_alt = ctx->sat_alt;
+	info->sat_vel = ctx->sat_vel;
+	info->phase = ctx->phase;
+	info->sun_azi = ctx->sun_azi;
+	info->sun_ele = ctx->sun_ele;
+	info->daynum = ctx->daynum;
+	info->fm = ctx->fm;
+	info->fk = ctx->fk;
+	info->age = ctx->age;
+	info->aostime = ctx->aostime;
+	info->lostime = ctx->lostime;
+	info->ax = ctx->ax;
+	info->ay = ctx->ay;
+	info->az = ctx->az;
+	info->rx = ctx->rx;
+	info->ry = ctx->ry;
+	info->rz = ctx->rz;
+	info->squint = ctx->squint;
+	info->alat = ctx->alat;
+	info->alon = ctx->alon;
+}
+
+int predict_set_tle(predict_ctx_t *ctx, char* line1, char* line2) {
 	/* Read element set */
 	if (KepCheck(line1, line2)) {
 		/* We found a valid TLE! */
 		/* Copy TLE data into the sat data structure */
-		strncpy(sat.line1, line1, 69);
-		strncpy(sat.line2, line2, 69);
+		strncpy(ctx->sat.line1, line1, 69);
+		strncpy(ctx->sat.line2, line2, 69);
 		/* Update individual parameters */
-		InternalUpdate();
+		InternalUpdate(ctx);
 		return 1;
 	}
 	return 0;
 }
 
-void setStation(double lat, double lon, int alt) {
-	qth.stnlat = lat;
-	qth.stnlong = lon;
-	qth.stnalt = alt;
+void predict_set_station(predict_ctx_t *ctx, double lat, double lon, int alt) {
+	ctx->qth.stnlat = lat;
+	ctx->qth.stnlong = lon;
+	ctx->qth.stnalt = alt;
 }
 
-long int comp_dopp_frq(long int frq, int direction) {
-
-	
+long int predict_dopp_frq(double range_rate, long int frq, int direction) {
 	long dopp;
 	if (direction == 1) {
-		dopp = frq - (-frq *((sat_range_rate*1000.0)/299792458.0));
+		dopp = frq - (-frq *((range_rate*1000.0)/299792458.0));
 	} else {
-		dopp = frq + (-frq *((sat_range_rate*1000.0)/299792458.0));
+		dopp = frq + (-frq *((range_rate*1000.0)/299792458.0));
 	}
 	return dopp;
+}
+
+long int predict_comp_dopp_frq(predict_ctx_t *ctx, long int frq, int direction) {
+	return predict_dopp_frq(ctx->sat_range_rate, frq, direction);
+}
+
+/* Context management */
+
+predict_ctx_t *predict_ctx_create(void) {
+	predict_ctx_t *ctx = malloc(sizeof(*ctx));
+
+	if (ctx != NULL)
+		*ctx = (predict_ctx_t) PREDICT_CTX_INIT;
+
+	return ctx;
+}
+
+void predict_ctx_destroy(predict_ctx_t *ctx) {
+	free(ctx);
+}
+
+double predict_get_azi(const predict_ctx_t *ctx) {
+	return ctx->sat_azi;
+}
+
+double predict_get_ele(const predict_ctx_t *ctx) {
+	return ctx->sat_ele;
+}
+
+double predict_get_range_rate(const predict_ctx_t *ctx) {
+	return ctx->sat_range_rate;
+}
+
+/* Single satellite API operating on the default context */
+
+void set_calc_time(long time) {
+	predict_set_time(&predict_default, time);
+}
+
+void PreCalc() {
+	predict_precalc(&predict_default);
+}
 
+void Calc() {
+	predict_calc(&predict_default);
+}
+
+void CalcBatch(const double *times, int count, double *azi, double *ele,
+		double *range, double *range_rate) {
+	predict_calc_batch(&predict_default, times, count, azi, ele, range, range_rate);
+}
+
+double FindAOS() {
+	return predict_find_aos(&predict_default);
+}
+
+double FindLOS() {
+	return predict_find_los(&predict_default);
+}
+
+double FindLOS2() {
+	return predict_find_los2(&predict_default);
+}
+
+double NextAOS() {
+	return predict_next_aos(&predict_default);
+}
+
+void getSatInfo(sat_info_t *info) {
+	predict_get_info(&predict_default, info);
+}
+
+int setTLE(char* line1, char* line2) {
+	return predict_set_tle(&predict_default, line1, line2);
+}
+
+void setStation(double lat, double lon, int alt) {
+	predict_set_station(&predict_default, lat, lon, alt);
+}
+
+long int comp_dopp_frq(long int frq, int direction) {
+	return predict_comp_dopp_frq(&predict_default, frq, direction);
 }
 
 double get_azi(void) {
-	return sat_azi;
+	return predict_default.sat_azi;
 }
 
 double get_ele(void) {
-	return sat_ele;
+	return predict_default.sat_ele;
 }
 
 double get_satlat(void) {
-	return sat_lat;
+	return predict_default.sat_lat;
 }
 
 double get_satlon(void) {
-	return sat_lon;
+	return predict_default.sat_lon;
 }
 
 double get_satalt(void) {
-	return sat_alt;
+	return predict_default.sat_alt;
 }
 
 double get_satvel(void) {
-	return sat_vel;
+	return predict_default.sat_vel;
 }
 
 double get_sataos(void) {
-	return aostime;
+	return predict_default.aostime;
 }
 
 double get_satlos(void) {
-	return lostime;
+	return predict_default.lostime;
 }
@@ -1,125 +1,213 @@
-/**
- * @file predict.h
- */
-
-#include <math.h>
-
-typedef struct {
-	double tsince, jul_epoch, jul_utc, eclipse_depth, sat_azi, sat_ele,
-			sat_range, sat_range_rate, sat_lat, sat_lon, sat_alt, sat_vel,
-			phase, sun_azi, sun_ele, daynum, fm, fk, age, aostime, lostime, ax,
-			ay, az, rx, ry, rz, squint, alat, alon;
-} sat_info_t;
-
-
-/** set the TLE line 1 and 2 for the satellite
- *
- * @param line1: TLE line 1
- * @param line2: TLE line 2
- * @return
- */
-int setTLE(char* line1, char* line2);
-
-/**
- * set latitude, longitude and altitude for the ground station
- * @param lat
- * @param lon
- * @param alt
- */
-void setStation(double lat, double lon, int alt);
-
-/**
- * Get all info about the satellite lon,lat range etc.
- * @param info
- */
-void getSatInfo(sat_info_t *info);
-
-/**
- * Find next AOS
- * @return next_aos (not a unix timestamp)
- * to convert to a unix time stamp do:
- * unix_time = floor(86400.0*(3651.0+next_aos));
- */
-double NextAOS();
-
-/**
- * Set the time to calculate the sat info
- * @param time: A unix time stamp
- */
-void set_calc_time(long time);
-
-/**
- * Calculate the Doppler compensated frq
- * @param frq The radio frq
- * @param direction 1 = rx, 0 = tx
- * @return The Doppler compensated frq
- */
-long int comp_dopp_frq(long int frq, int direction);
-
-/**
- * Get azimuth angle to the sat
- * @return azimuth angle
- */
-double get_azi(void);
-
-/**
- * Get elevation angle to the sat
- * @return elevation angle
- */
-double get_ele(void);
-
-/**
- * Get satellite latitude
- * @return satellite latitude
- */
-double get_satlat(void);
-
-/**
- * Get satellite longtitude
- * @return satellite longtitude
- */
-double get_satlon(void);
-
-/**
- * Get satellite altitude
- * @return satellite altitude
- */
-double get_satalt(void);
-/**
- * Get satellite velocity
- * @return satellite velocity
- */
-double get_satvel(void);
-
-double get_sataos(void);
-
-double get_satlos(void);
-
-/** This function copies TLE data from PREDICT's sat structure
-*	 to the SGP4 single dimensioned tle structure.
-*	 Must be run once before doing calc.
-*/
-void PreCalc();
-
-/**
- * Do the repetitive calculation of sat info
- */
-void Calc();
-
-/**
- * Check a TLE
- * @param line1
- * @param line2
- * @return 0 = ERR, 1 = OK
- */
-char KepCheck(char *line1, char *line2);
-
-/**
- * Find next AOS event
- * @return next_los (not a unix timestamp)
- * to convert to a unix time stamp do:
- * unix_time = floor(86400.0*(3651.0+next_los));
- */
-double FindLOS2();
-
-double FindAOS();
+/**
+ * @file predict.h
+ */
+
+#ifndef PREDICT_H
+#define PREDICT_H
+
+#include <math.h>
+
+typedef struct {
+	double tsince, jul_epoch, jul_utc, eclipse_depth, sat_azi, sat_ele,
+			sat_range, sat_range_rate, sat_lat, sat_lon, sat_alt, sat_vel,
+			phase, sun_azi, sun_ele, daynum, fm, fk, age, aostime, lostime, ax,
+			ay, az, rx, ry, rz, squint, alat, alon;
+} sat_info_t;
+
+/**
+ * Prediction context. Holds the TLE, ground station, SGP4 state and the
+ * latest results for one satellite. Contexts are independent, so different
+ * threads may each use their own without locking.
+ */
+typedef struct predict_ctx_s predict_ctx_t;
+
+/**
+ * Allocate a context with the default ground station
+ * @return new context or NULL if out of memory
+ */
+predict_ctx_t *predict_ctx_create(void);
+
+/**
+ * Free a context from predict_ctx_create
+ * @param ctx
+ */
+void predict_ctx_destroy(predict_ctx_t *ctx);
+
+/**
+ * Context versions of the functions below. setTLE() and friends
+ * operate on a shared default context and are not thread safe.
+ */
+int predict_set_tle(predict_ctx_t *ctx, char* line1, char* line2);
+void predict_set_station(predict_ctx_t *ctx, double lat, double lon, int alt);
+void predict_set_time(predict_ctx_t *ctx, long time);
+void predict_precalc(predict_ctx_t *ctx);
+void predict_calc(predict_ctx_t *ctx);
+double predict_find_aos(predict_ctx_t *ctx);
+double predict_find_los(predict_ctx_t *ctx);
+double predict_find_los2(predict_ctx_t *ctx);
+double predict_next_aos(predict_ctx_t *ctx);
+void predict_get_info(predict_ctx_t *ctx, sat_info_t *info);
+long int predict_comp_dopp_frq(predict_ctx_t *ctx, long int frq, int direction);
+
+/**
+ * Doppler compensated frq for a given range rate
+ * @param range_rate Range rate [km/s]
+ * @param frq The radio frq
+ * @param direction 1 = rx, 0 = tx
+ * @return The Doppler compensated frq
+ */
+long int predict_dopp_frq(double range_rate, long int frq, int direction);
+
+/**
+ * Propagate one satellite over an array of times. Only the look angles
+ * are computed, which makes this much cheaper than calling predict_calc()
+ * per sample. predict_precalc() must have been called on the context.
+ * On x86-64 CPUs with AVX2 four samples are propagated per vector, the
+ * results then match the scalar code to within rounding.
+ * @param ctx Prediction context
+ * @param times Unix times, may have fractional seconds
+ * @param count Number of time stamps
+ * @param azi Output azimuth [deg] per time, or NULL
+ * @param ele Output elevation [deg] per time, or NULL
+ * @param range Output range [km] per time, or NULL
+ * @param range_rate Output range rate [km/s] per time, or NULL
+ */
+void predict_calc_batch(predict_ctx_t *ctx, const double *times, int count,
+		double *azi, double *ele, double *range, double *range_rate);
+
+/**
+ * Look angles for several satellites at one time. Each context uses its
+ * own TLE and ground station.
+ * @param ctx Array of prepared contexts
+ * @param count Number of contexts
+ * @param time Unix time stamp
+ * Outputs as for predict_calc_batch, indexed by context.
+ */
+void predict_calc_sats(predict_ctx_t **ctx, int count, long time,
+		double *azi, double *ele, double *range, double *range_rate);
+
+double predict_get_azi(const predict_ctx_t *ctx);
+double predict_get_ele(const predict_ctx_t *ctx);
+double predict_get_range_rate(const predict_ctx_t *ctx);
+
+/** set the TLE line 1 and 2 for the satellite
+ *
+ * @param line1: TLE line 1
+ * @param line2: TLE line 2
+ * @return
+ */
+int setTLE(char* line1, char* line2);
+
+/**
+ * set latitude, longitude and altitude for the ground station
+ * @param lat
+ * @param lon
+ * @param alt
+ */
+void setStation(double lat, double lon, int alt);
+
+/**
+ * Get all info about the satellite lon,lat range etc.
+ * @param info
+ */
+void getSatInfo(sat_info_t *info);
+
+/**
+ * Find next AOS
+ * @return next_aos (not a unix timestamp)
+ * to convert to a unix time stamp do:
+ * unix_time = floor(86400.0*(3651.0+next_aos));
+ */
+double NextAOS();
+
+/**
+ * Set the time to calculate the sat info
+ * @param time: A unix time stamp
+ */
+void set_calc_time(long time);
+
+/**
+ * Calculate the Doppler compensated frq
+ * @param frq The radio frq
+ * @param direction 1 = rx, 0 = tx
+ * @return The Doppler compensated frq
+ */
+long int comp_dopp_frq(long int frq, int direction);
+
+/**
+ * Get azimuth angle to the sat
+ * @return azimuth angle
+ */
+double get_azi(void);
+
+/**
+ * Get elevation angle to the sat
+ * @return elevation angle
+ */
+double get_ele(void);
+
+/**
+ * Get satellite latitude
+ * @return satellite latitude
+ */
+double get_satlat(void);
+
+/**
+ * Get satellite longtitude
+ * @return satellite longtitude
+ */
+double get_satlon(void);
+
+/**
+ * Get satellite altitude
+ * @return satellite altitude
+ */
+double get_satalt(void);
+/**
+ * Get satellite velocity
+ * @return satellite velocity
+ */
+double get_satvel(void);
+
+double get_sataos(void);
+
+double get_satlos(void);
+
+/** This function copies TLE data from PREDICT's sat structure
+*	 to the SGP4 single dimensioned tle structure.
+*	 Must be run once before doing calc.
+*/
+void PreCalc();
+
+/**
+ * Do the repetitive calculation of sat info
+ */
+void Calc();
+
+/**
+ * predict_calc_batch() on the default context
+ */
+void CalcBatch(const double *times, int count, double *azi, double *ele,
+		double *range, double *range_rate);
+
+/**
+ * Check a TLE
+ * @param line1
+ * @param line2
+ * @return 0 = ERR, 1 = OK
+ */
+char KepCheck(char *line1, char *line2);
+
+/**
+ * Find next AOS event
+ * @return next_los (not a unix timestamp)
+ * to convert to a unix time stamp do:
+ * unix_time = floor(86400.0*(3651.0+next_los));
+ */
+double FindLOS2();
+
+double FindAOS();
+
+double FindLOS();
+
+#endif
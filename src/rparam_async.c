@@ -0,0 +1,268 @@
+/* Asynchronous remote parameter setter, see rparam_async.h
+ *
+ * Lives with csp-term rather than in libparam, which is linked from
+ * prebuilt objects and has no sources in this tree.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+#include <csp/csp.h>
+#include <csp/csp_endian.h>
+#include <csp/arch/csp_thread.h>
+#include <csp/arch/csp_semaphore.h>
+#include <csp/arch/csp_time.h>
+
+#include <param/param_serializer.h>
+
+#include "rparam_async.h"
+
+/* Table checksum value the server accepts without checking */
+#define RPARAM_ASYNC_CHECKSUM		0xB00B
+
+/* Same payload limit as the blocking client. RPARAM_ASYNC_MAX_PENDING
+ * items of RPARAM_ASYNC_MAX_VALUE always fit in one query */
+#define RPARAM_ASYNC_MAX_PAYLOAD	180
+
+typedef enum {
+	RPARAM_ASYNC_FREE = 0,
+	RPARAM_ASYNC_QUEUED,
+	RPARAM_ASYNC_SENDING,
+} rparam_async_state_t;
+
+typedef struct {
+	rparam_async_state_t state;
+	uint8_t node;
+	uint8_t port;
+	uint8_t mem_id;
+	uint16_t addr;
+	param_type_t type;
+	uint8_t size;
+	uint8_t value[RPARAM_ASYNC_MAX_VALUE];
+	uint32_t timeout;
+	rparam_async_callback_t callback;
+	void * arg;
+} rparam_async_entry_t;
+
+/* One query in flight: all sets to a node, port and memory area */
+typedef struct {
+	uint8_t node;
+	uint8_t port;
+	uint8_t mem_id;
+	uint32_t timeout;
+	csp_conn_t * conn;
+	int result;
+} rparam_async_query_t;
+
+static rparam_async_entry_t entries[RPARAM_ASYNC_MAX_PENDING];
+static csp_mutex_t entries_lock;
+static csp_bin_sem_handle_t submit_sem;
+static int initialized = 0;
+
+int rparam_async_set(const void * value, param_type_t type, int size, uint16_t addr, uint8_t mem_id,
+		uint8_t node, uint8_t port, uint32_t timeout, rparam_async_callback_t callback, void * arg) {
+
+	rparam_async_entry_t * entry = NULL;
+	rparam_async_callback_t superseded = NULL;
+	void * superseded_arg = NULL;
+
+	if (!initialized || size <= 0 || size > RPARAM_ASYNC_MAX_VALUE)
+		return -1;
+
+	csp_mutex_lock(&entries_lock, CSP_MAX_DELAY);
+	for (int i = 0; i < RPARAM_ASYNC_MAX_PENDING; i++) {
+		rparam_async_entry_t * e = &entries[i];
+		if (e->state == RPARAM_ASYNC_QUEUED && e->node == node && e->port == port
+				&& e->mem_id == mem_id && e->addr == addr) {
+			/* Only the newest value of a parameter is worth sending */
+			superseded = e->callback;
+			superseded_arg = e->arg;
+			entry = e;
+			break;
+		}
+		if (e->state == RPARAM_ASYNC_FREE && entry == NULL)
+			entry = e;
+	}
+
+	if (entry == NULL) {
+		csp_mutex_unlock(&entries_lock);
+		return -1;
+	}
+
+	entry->state = RPARAM_ASYNC_QUEUED;
+	entry->node = node;
+	entry->port = port;
+	entry->mem_id = mem_id;
+	entry->addr = addr;
+	entry->type = type;
+	entry->size = size;
+	memcpy(entry->value, value, size);
+	entry->timeout = timeout;
+	entry->callback = callback;
+	entry->arg = arg;
+	csp_mutex_unlock(&entries_lock);
+
+	if (superseded)
+		superseded(RPARAM_ASYNC_SUPERSEDED, superseded_arg);
+
+	return 0;
+}
+
+void rparam_async_submit(void) {
+	if (initialized)
+		csp_bin_sem_post(&submit_sem);
+}
+
+/* Build and send the query for one memory area, the reply is read later */
+static void rparam_async_send(rparam_async_query_t * query, rparam_async_entry_t * batch, int count) {
+
+	query->result = RPARAM_ASYNC_ERROR;
+
+	csp_packet_t * packet = csp_buffer_get(offsetof(rparam_query, packed) + RPARAM_ASYNC_MAX_PAYLOAD);
+	if (packet == NULL)
+		return;
+
+	rparam_query * frame = (rparam_query *) packet->data;
+	frame->action = RPARAM_SET;
+	frame->mem = query->mem_id;
+	frame->checksum = csp_hton16(RPARAM_ASYNC_CHECKSUM);
+	frame->seq = 0;
+	frame->total = 0;
+
+	/* Items are address and value, both big endian */
+	uint16_t length = 0;
+	for (int i = 0; i < count; i++) {
+		rparam_async_entry_t * e = &batch[i];
+		if (e->node != query->node || e->port != query->port || e->mem_id != query->mem_id)
+			continue;
+		uint16_t addr = csp_hton16(e->addr);
+		memcpy(&frame->packed[length], &addr, sizeof(addr));
+		memcpy(&frame->packed[length + sizeof(addr)], e->value, e->size);
+		param_htobe(e->type, &frame->packed[length + sizeof(addr)]);
+		length += sizeof(addr) + e->size;
+	}
+	frame->length = csp_hton16(length);
+	packet->length = offsetof(rparam_query, packed) + length;
+
+	query->conn = csp_connect(CSP_PRIO_HIGH, query->node, query->port, query->timeout, CSP_O_NONE);
+	if (query->conn == NULL) {
+		csp_buffer_free(packet);
+		return;
+	}
+
+	if (!csp_send(query->conn, packet, query->timeout)) {
+		csp_buffer_free(packet);
+		csp_close(query->conn);
+		query->conn = NULL;
+	}
+}
+
+static void rparam_async_wait(rparam_async_query_t * query, uint32_t start) {
+
+	if (query->conn == NULL)
+		return;
+
+	uint32_t elapsed = csp_get_ms() - start;
+	uint32_t remaining = (elapsed < query->timeout) ? query->timeout - elapsed : 0;
+
+	/* The server answers a set with a single status byte */
+	csp_packet_t * reply = csp_read(query->conn, remaining);
+	if (reply != NULL) {
+		if (reply->length == 1 && reply->data[0] != RPARAM_ERROR)
+			query->result = RPARAM_ASYNC_OK;
+		csp_buffer_free(reply);
+	}
+
+	csp_close(query->conn);
+	query->conn = NULL;
+}
+
+static CSP_DEFINE_TASK(rparam_async_task) {
+
+	rparam_async_entry_t batch[RPARAM_ASYNC_MAX_PENDING];
+	rparam_async_query_t queries[RPARAM_ASYNC_MAX_PENDING];
+
+	while (1) {
+		csp_bin_sem_wait(&submit_sem, CSP_MAX_DELAY);
+
+		/* Take everything queued, new sets may be queued meanwhile */
+		int count = 0;
+		csp_mutex_lock(&entries_lock, CSP_MAX_DELAY);
+		for (int i = 0; i < RPARAM_ASYNC_MAX_PENDING; i++) {
+			if (entries[i].state == RPARAM_ASYNC_QUEUED) {
+				batch[count++] = entries[i];
+				entries[i].state = RPARAM_ASYNC_FREE;
+			}
+		}
+		csp_mutex_unlock(&entries_lock);
+
+		if (count == 0)
+			continue;
+
+		/* One query per node, port and memory area */
+		int nqueries = 0;
+		for (int i = 0; i < count; i++) {
+			int q;
+			for (q = 0; q < nqueries; q++) {
+				if (queries[q].node == batch[i].node && queries[q].port == batch[i].port
+						&& queries[q].mem_id == batch[i].mem_id)
+					break;
+			}
+			if (q == nqueries) {
+				queries[q].node = batch[i].node;
+				queries[q].port = batch[i].port;
+				queries[q].mem_id = batch[i].mem_id;
+				queries[q].timeout = 0;
+				queries[q].conn = NULL;
+				nqueries++;
+			}
+			if (batch[i].timeout > queries[q].timeout)
+				queries[q].timeout = batch[i].timeout;
+		}
+
+		/* Pipeline: send all queries first, then collect the replies */
+		uint32_t start = csp_get_ms();
+		for (int q = 0; q < nqueries; q++)
+			rparam_async_send(&queries[q], batch, count);
+		for (int q = 0; q < nqueries; q++)
+			rparam_async_wait(&queries[q], start);
+
+		for (int i = 0; i < count; i++) {
+			if (batch[i].callback == NULL)
+				continue;
+			for (int q = 0; q < nqueries; q++) {
+				if (queries[q].node == batch[i].node && queries[q].port == batch[i].port
+						&& queries[q].mem_id == batch[i].mem_id) {
+					batch[i].callback(queries[q].result, batch[i].arg);
+					break;
+				}
+			}
+		}
+	}
+
+	return CSP_TASK_RETURN;
+}
+
+int rparam_async_init(void) {
+
+	static csp_thread_handle_t handle;
+
+	if (initialized)
+		return 0;
+
+	if (csp_mutex_create(&entries_lock) != CSP_MUTEX_OK)
+		return -1;
+	if (csp_bin_sem_create(&submit_sem) != CSP_SEMAPHORE_OK)
+		return -1;
+	/* Created available, take it so the task blocks until a submit */
+	csp_bin_sem_wait(&submit_sem, 0);
+
+	initialized = 1;
+	if (csp_thread_create(rparam_async_task, "RPARAM", 4000, NULL, 0, &handle) != 0) {
+		initialized = 0;
+		return -1;
+	}
+
+	return 0;
+}
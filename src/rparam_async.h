@@ -0,0 +1,67 @@
+/**
+ * @file rparam_async.h
+ * Asynchronous remote parameter setter.
+ *
+ * Sets are queued with rparam_async_set() and sent by a worker task when
+ * rparam_async_submit() is called, so the caller never waits for the
+ * remote node. Pending sets to the same node, port and memory area are
+ * coalesced into one query, a newer value for the same address replaces
+ * the queued one. Queries to different memory areas are sent back to back
+ * and their replies awaited together, so a batch costs one round trip.
+ */
+
+#ifndef RPARAM_ASYNC_H_
+#define RPARAM_ASYNC_H_
+
+#include <stdint.h>
+#include <param/param_types.h>
+
+#define RPARAM_ASYNC_MAX_PENDING	16	//! Sets waiting for submit or reply
+#define RPARAM_ASYNC_MAX_VALUE		8	//! Largest parameter value in bytes
+
+/** Result passed to the completion callback */
+#define RPARAM_ASYNC_OK			1	//! Remote node accepted the set
+#define RPARAM_ASYNC_SUPERSEDED		0	//! Replaced by a newer value before sending
+#define RPARAM_ASYNC_ERROR		-1	//! No reply, timeout or error reply
+
+/**
+ * Completion callback, called from the worker task
+ * @param result RPARAM_ASYNC_OK, RPARAM_ASYNC_SUPERSEDED or RPARAM_ASYNC_ERROR
+ * @param arg user argument given to rparam_async_set()
+ */
+typedef void (*rparam_async_callback_t)(int result, void * arg);
+
+/**
+ * Start the worker task, safe to call more than once
+ * @returns 0 on success, <0 otherwise
+ */
+int rparam_async_init(void);
+
+/**
+ * Queue a remote set. Nothing is sent until rparam_async_submit().
+ * @param value pointer to the value in host byte order
+ * @param type param type
+ * @param size size of value, at most RPARAM_ASYNC_MAX_VALUE
+ * @param addr local address of the parameter
+ * @param mem_id id of the index in which the parameter table is located
+ * @param node CSP address of the node
+ * @param port CSP port of the parameter server
+ * @param timeout reply timeout in ms
+ * @param callback completion callback or NULL
+ * @param arg argument to callback
+ * @returns 0 if queued, <0 if the queue is full or the value too large
+ */
+int rparam_async_set(const void * value, param_type_t type, int size, uint16_t addr, uint8_t mem_id,
+		uint8_t node, uint8_t port, uint32_t timeout, rparam_async_callback_t callback, void * arg);
+
+/**
+ * Send all queued sets
+ */
+void rparam_async_submit(void);
+
+static inline int rparam_async_set_uint32(uint32_t value, uint16_t addr, uint8_t mem_id, uint8_t node,
+		uint8_t port, uint32_t timeout, rparam_async_callback_t callback, void * arg) {
+	return rparam_async_set(&value, PARAM_UINT32, sizeof(value), addr, mem_id, node, port, timeout, callback, arg);
+}
+
+#endif /* RPARAM_ASYNC_H_ */
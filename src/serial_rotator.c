@@ -24,11 +24,15 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
 #include <util/log.h>
 #include <command/command.h>
 #include <stdio.h>
 
 #include "serial_rotator.h"
+#include "gui_backend.h"
 
 #define AZIMMUTH_ANGLE_OFFSET	80
 //#define AZIMMUTH_ANGLE_OFFSET	0
@@ -36,10 +40,40 @@
 // set AZEL CMD lock to '1' to prevent antenna movemnet else '0'
 #define AZEL_TRACK_CMD_LOCK	0
 
+/* Rotator thread timing */
+#define ROTATOR_AZI_MAX			450	/* GS232B azimuth range 0 to 450 degree */
+#define ROTATOR_ELE_MAX			180	/* Elevation range 0 to 180 degree */
+
+#define ROTATOR_POLL_INTERVAL_MS	1000	/* C2 position poll period */
+#define ROTATOR_REPLY_TIMEOUT_MS	500	/* Wait for C2 reply */
+#define ROTATOR_REOPEN_INTERVAL_MS	5000	/* Retry period when the port is missing */
+
 static const char *serial_port_default = "/dev/ttyUSB4";
 static int azi_old = -1;
 static int ele_old = -1;
 
+/* The rotator thread owns the serial port. Commands are handed over in a
+ * single slot: a new target replaces a pending one that was not sent yet. */
+static struct {
+	pthread_once_t once;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int running;
+	int fd;
+	int pending;		/* target waiting to be sent */
+	int pending_azi;
+	int pending_ele;
+	int poll_now;		/* position poll requested */
+	int pos_valid;		/* last C2 reply parsed */
+	int pos_azi;
+	int pos_ele;
+	unsigned int dropped;	/* targets replaced before they were sent */
+} rotator = {
+	.once = PTHREAD_ONCE_INIT,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.fd = -1,
+};
+
 int set_interface(int fd, int speed, int parity);
 int serial_set_az_el(int azi,int ele);
 int serial_read(void);
@@ -89,8 +123,8 @@ int set_interface(int fd, int speed, int parity)
 
 	options.c_oflag &= ~OPOST;
 
-        options.c_cc[VMIN]  = 15;	// read number of bytes
-        options.c_cc[VTIME] = 255;	// read timeout
+        options.c_cc[VMIN]  = 0;	// reads return what is available,
+        options.c_cc[VTIME] = 0;	// the rotator thread waits with poll()
 
         options.c_iflag &= ~(IXON | IXOFF | IXANY); // shut off xon/xoff hardware control
 
@@ -110,55 +144,237 @@ int set_interface(int fd, int speed, int parity)
         return 0;
 }
 
-int serial_read()
+static void rotator_deadline(struct timespec *ts, int ms)
+{
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (long)(ms % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+static int rotator_open(void)
 {
-	
 	const char *port = serial_port_path();
 	int fd = open (port, O_RDWR | O_NOCTTY);
 	if (fd < 0)
 	{
 		log_error("error connecting GS232B serial port (%s): %s", port, strerror(errno));
-		return 0;
-	}else{
-		log_info("GS232B serial port (%s) connected", port);
+		return -1;
 	}
 
 	if (set_interface(fd, B9600, 0) != 0)  // set speed to 9600 bps, 8n1 (no parity)
 	{
 		log_error("error interface setup");
-		return 0;
-	}	
+		close(fd);
+		return -1;
+	}
 
-	tcflush(fd, TCIFLUSH); //dicard old data and flush the buffers
+	tcflush(fd, TCIOFLUSH); //dicard old data and flush the buffers
+	log_info("GS232B serial port (%s) connected", port);
 
-  	char read_buf[]= "C2\r";
+	return fd;
+}
 
-	int wr = 0;
-	int rd = 0;
-	char buf [100] = "";
+static int rotator_write(int fd, const char *cmd)
+{
+	size_t len = strlen(cmd);
+	while (len > 0) {
+		ssize_t wr = write(fd, cmd, len);
+		if (wr < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		cmd += wr;
+		len -= wr;
+	}
+	return 0;
+}
 
-	wr = write(fd,&read_buf,sizeof(read_buf)-1);
-	if (wr < 0) {
-		log_error("Failed to write GS232B command (%s): %s", port, strerror(errno));
-		close(fd);
-		return 0;
+/* Query C2 and parse "AZ=aaa EL=eee" (GS-232B) or "+0aaa+0eee" (GS-232A).
+ * Returns -1 on port errors and -2 if the reply was missing or garbled. */
+static int rotator_query_position(int fd, int *azi, int *ele)
+{
+	char buf[64];
+	size_t len = 0;
+
+	tcflush(fd, TCIFLUSH);
+	if (rotator_write(fd, "C2\r") != 0)
+		return -1;
+
+	/* Collect the reply up to the line terminator */
+	struct pollfd pfd = {.fd = fd, .events = POLLIN};
+	while (len < sizeof(buf) - 1) {
+		int ret = poll(&pfd, 1, ROTATOR_REPLY_TIMEOUT_MS);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+		ssize_t rd = read(fd, buf + len, sizeof(buf) - 1 - len);
+		if (rd <= 0)
+			return -1;
+		len += rd;
+		buf[len] = '\0';
+		if (strchr(buf, '\r') != NULL || strchr(buf, '\n') != NULL)
+			break;
 	}
-	log_info("Send %d bytes: %s",wr,read_buf);
-	//usleep(100);	// delay for GS232B to respond	
+	buf[len] = '\0';
 
-	rd = read (fd, buf, sizeof buf);  // read up to 100 characters
-	if (rd < 0) {
-		log_error("Failed to read GS232B response (%s): %s", port, strerror(errno));
-		close(fd);
+	const char *az = strstr(buf, "AZ=");
+	const char *el = strstr(buf, "EL=");
+	if (az != NULL && el != NULL) {
+		*azi = atoi(az + 3);
+		*ele = atoi(el + 3);
 		return 0;
 	}
-	// char hex_buf[3 * sizeof(buf) + 1];
-	// bytes_to_hex((unsigned char *)buf, (size_t)rd, hex_buf, sizeof(hex_buf));
-	// log_info("Receive %d bytes: %s",rd, hex_buf);
-        log_info("Receive %d bytes: %s",rd, buf);
+	if (sscanf(buf, "%d%d", azi, ele) == 2)
+		return 0;
+
+	log_debug("GS232B unexpected C2 reply: %s", buf);
+	return -2;
+}
+
+static void * rotator_thread(void *arg)
+{
+	struct timespec deadline;
+	int next_poll_ms = 0;
+
+	while (1) {
+		pthread_mutex_lock(&rotator.lock);
+		rotator_deadline(&deadline, next_poll_ms);
+		while (!rotator.pending && !rotator.poll_now) {
+			if (pthread_cond_timedwait(&rotator.cond, &rotator.lock, &deadline) == ETIMEDOUT)
+				break;
+		}
+		int send = rotator.pending;
+		int azi = rotator.pending_azi;
+		int ele = rotator.pending_ele;
+		rotator.pending = 0;
+		rotator.poll_now = 0;
+		int fd = rotator.fd;
+		pthread_mutex_unlock(&rotator.lock);
+
+		if (fd < 0) {
+			fd = rotator_open();
+			pthread_mutex_lock(&rotator.lock);
+			rotator.fd = fd;
+			pthread_mutex_unlock(&rotator.lock);
+		}
+		if (fd < 0) {
+			if (send)
+				gui_backend_notify_rotator(azi, ele, 0);
+			next_poll_ms = ROTATOR_REOPEN_INTERVAL_MS;
+			continue;
+		}
+		next_poll_ms = ROTATOR_POLL_INTERVAL_MS;
+
+		if (send) {
+			/* Clamp to the controller range, three digits each */
+			int cmd_azi = azi + AZIMMUTH_ANGLE_OFFSET;
+			cmd_azi = cmd_azi < 0 ? 0 : (cmd_azi > ROTATOR_AZI_MAX ? ROTATOR_AZI_MAX : cmd_azi);
+			int cmd_ele = ele < 0 ? 0 : (ele > ROTATOR_ELE_MAX ? ROTATOR_ELE_MAX : ele);
+			char set_az_el[16];
+			snprintf(set_az_el, sizeof(set_az_el), "W%03d %03d\r", cmd_azi, cmd_ele);
+			log_info("%s", set_az_el);
+			if (rotator_write(fd, set_az_el) != 0) {
+				log_error("Setting AZ:%d EL%d failed: %s", azi, ele, strerror(errno));
+				gui_backend_notify_rotator(azi, ele, 0);
+			}
+		}
+
+		/* Publish the measured position, not the commanded one */
+		int pos_azi, pos_ele;
+		int ret = rotator_query_position(fd, &pos_azi, &pos_ele);
+		if (ret != 0) {
+			if (ret == -1) {
+				log_error("GS232B serial port lost, reopening");
+				close(fd);
+				pthread_mutex_lock(&rotator.lock);
+				rotator.fd = -1;
+				rotator.pos_valid = 0;
+				pthread_mutex_unlock(&rotator.lock);
+			}
+			continue;
+		}
+		pos_azi -= AZIMMUTH_ANGLE_OFFSET;
+
+		pthread_mutex_lock(&rotator.lock);
+		int changed = !rotator.pos_valid || pos_azi != rotator.pos_azi || pos_ele != rotator.pos_ele;
+		rotator.pos_valid = 1;
+		rotator.pos_azi = pos_azi;
+		rotator.pos_ele = pos_ele;
+		pthread_mutex_unlock(&rotator.lock);
+
+		if (changed || send)
+			gui_backend_notify_rotator(pos_azi, pos_ele, 1);
+	}
+
+	return NULL;
+}
+
+static void rotator_init(void)
+{
+	pthread_condattr_t attr;
+	pthread_t handle;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&rotator.cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	if (pthread_create(&handle, NULL, rotator_thread, NULL) != 0) {
+		log_error("Failed to start rotator thread");
+		return;
+	}
+	pthread_detach(handle);
+	rotator.running = 1;
+}
+
+int rotator_start(void)
+{
+	pthread_once(&rotator.once, rotator_init);
+	return rotator.running;
+}
 
-	close(fd);
+int rotator_get_position(int *azi, int *ele)
+{
+	pthread_mutex_lock(&rotator.lock);
+	int valid = rotator.pos_valid;
+	if (valid) {
+		*azi = rotator.pos_azi;
+		*ele = rotator.pos_ele;
+	}
+	pthread_mutex_unlock(&rotator.lock);
+	return valid;
+}
+
+unsigned int rotator_get_dropped(void)
+{
+	pthread_mutex_lock(&rotator.lock);
+	unsigned int dropped = rotator.dropped;
+	pthread_mutex_unlock(&rotator.lock);
+	return dropped;
+}
+
+int serial_read()
+{
+	if (!rotator_start())
+		return 0;
 
+	/* Ask for a fresh reading and report the latest known position */
+	pthread_mutex_lock(&rotator.lock);
+	rotator.poll_now = 1;
+	pthread_cond_signal(&rotator.cond);
+	pthread_mutex_unlock(&rotator.lock);
+
+	int azi, ele;
+	if (!rotator_get_position(&azi, &ele))
+		return 0;
+
+	log_info("AZ: %d EL: %d", azi, ele);
 	return 1;
 }
 
@@ -188,40 +404,20 @@ int serial_set_az_el(int azi,int ele)
 	azi_old = azi;
 	ele_old = ele;
 
-	const char *port = serial_port_path();
-	int fd = open (port, O_RDWR | O_NOCTTY);
-	if (fd < 0)
-	{
-		log_error("error connecting GS232B serial port (%s): %s", port, strerror(errno));
-		return 0;
-	}
-
-	if (set_interface(fd, B9600, 0) != 0)  // set speed to 9600 bps, 8n1 (no parity)
-	{
-		log_error("error interface setup");
+	if (!rotator_start())
 		return 0;
-	}	
-
-	tcflush(fd, TCIFLUSH); //dicard old data and flush the buffers
 
-	char set_az_el[] = "W150 000\r"; //default antenna orientation
-
-	int wr = 0;
-
-	sprintf(set_az_el+1,"%03d %03d\r", azi+AZIMMUTH_ANGLE_OFFSET, ele);
-
-
-	log_info("%s",set_az_el);
-	wr = write(fd,&set_az_el,sizeof(set_az_el)-1);
-	if (wr == 0) {
-		log_error("Setting AZ:%d EL%d failed",azi,ele);
-	} else if (wr > 0) {
-		gui_backend_notify_rotator(azi, ele, 1);
-	} else {
-		gui_backend_notify_rotator(azi, ele, 0);
+	/* Hand the target to the rotator thread, replacing a stale one */
+	pthread_mutex_lock(&rotator.lock);
+	if (rotator.pending) {
+		rotator.dropped++;
+		log_debug("Dropped stale AZ:%d EL:%d", rotator.pending_azi, rotator.pending_ele);
 	}
-	
-	close(fd);
+	rotator.pending = 1;
+	rotator.pending_azi = azi;
+	rotator.pending_ele = ele;
+	pthread_cond_signal(&rotator.cond);
+	pthread_mutex_unlock(&rotator.lock);
 
 	return 1;
 }
@@ -10,3 +10,12 @@ int serial_set_az_el(int azi,int ele);
 
 /* Read for current UHF antenna Azimuth and Elevation angles */
 int serial_read(void);
+
+/* Start the rotator thread that owns the GS232B serial port (idempotent) */
+int rotator_start(void);
+
+/* Last measured Azimuth and Elevation, returns 0 if unknown */
+int rotator_get_position(int *azi, int *ele);
+
+/* Number of targets replaced by a newer one before being sent */
+unsigned int rotator_get_dropped(void);